@@ -0,0 +1,94 @@
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <linux/videodev2.h>
+#include <iostream>
+#include <string>
+
+#include "capture.hh"
+#include "conversion.hh"
+
+using namespace std;
+
+void print_usage(const string & program_name)
+{
+  cerr <<
+  "Usage: " << program_name << " [options] width height fps output.y4m\n\n"
+  "Options:\n"
+  "-d, --device <video_device>  webcam device (default: /dev/video0)\n"
+  "--segment-mb <MB>            start a new segment at this size\n"
+  "--segment-sec <sec>          start a new segment after this long\n"
+  "--disk-budget-mb <MB>        delete the oldest segments beyond this total"
+  << endl;
+}
+
+// record the camera's YUYV frames as I420 to a Y4M file, or to segments of
+// it (output_0000.y4m, ...) each with a ".idx" index; stop with Ctrl-C or 'q'
+int main(int argc, char * argv[])
+{
+  const option cmd_line_opts[] = {
+    {"device",         required_argument, nullptr, 'd'},
+    {"segment-mb",     required_argument, nullptr, 'M'},
+    {"segment-sec",    required_argument, nullptr, 'T'},
+    {"disk-budget-mb", required_argument, nullptr, 'B'},
+    { nullptr,         0,                 nullptr,  0 },
+  };
+
+  while (true) {
+    const int opt = getopt_long(argc, argv, "d:", cmd_line_opts, nullptr);
+    if (opt == -1) {
+      break;
+    }
+
+    switch (opt) {
+      case 'd':
+        dev_name = optarg;
+        break;
+      case 'M':
+        segment_limits.max_bytes = strict_stoll(optarg) * 1024 * 1024;
+        break;
+      case 'T':
+        segment_limits.max_seconds = strict_stoi(optarg);
+        break;
+      case 'B':
+        segment_limits.budget_bytes = strict_stoll(optarg) * 1024 * 1024;
+        break;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc - 4) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (segment_limits.budget_bytes > 0 and not segment_limits.rotating()) {
+    cerr << "--disk-budget-mb requires --segment-mb or --segment-sec.\n";
+    return EXIT_FAILURE;
+  }
+
+  width = strict_stoi(argv[optind]);
+  height = strict_stoi(argv[optind + 1]);
+  fps = strict_stoi(argv[optind + 2]);
+  const string output_path = argv[optind + 3];
+
+  fd = open(dev_name, O_RDWR | O_NONBLOCK, 0);
+  if (fd < 0) {
+    perror(dev_name);
+    return EXIT_FAILURE;
+  }
+
+  // the recording loop converts YUYV only
+  pixel_format = V4L2_PIX_FMT_YUYV;
+  set_format();
+  init_buffers();
+
+  signal(SIGINT, sigint_handler);
+  capture_disk_loop(output_path.c_str());
+
+  close(fd);
+  return EXIT_SUCCESS;
+}
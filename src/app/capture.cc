@@ -6,12 +6,17 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <iostream>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
 #include <signal.h>
 #include <pthread.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/poll.h>
 #include <sys/statvfs.h>
+#include <sys/sysinfo.h>
 #include <time.h>
 #include <linux/videodev2.h>
 #include <SDL2/SDL.h>
@@ -24,6 +29,13 @@ extern "C" {
 }
 
 #include "capture.hh"
+#include "mjpeg_decoder.hh"
+#include "pixel_format.hh"
+#include "v4l2.hh"
+#include "v4l2_buffers.hh"
+#include "timestamp.hh"
+#include "yuyv.hh"
+#include "worker_pool.hh"
 
 using namespace std;
 
@@ -35,33 +47,234 @@ int width = 1920;
 int height = 1080;
 int fps = 60;
 // int pixel_mode = 422;
-void *buffers = NULL;
-unsigned n_buffers = 0;
 int run = 1;
 
-pthread_mutex_t preview_mtx = PTHREAD_MUTEX_INITIALIZER;
-uint8_t *preview_rgb = NULL;
+// V4L2 capture buffers, set up by init_buffers(); 0 buffers picks the
+// queue depth by frame size and rate
+V4L2IO v4l2_io = V4L2IO::MMap;
+unsigned num_v4l2_buffers = 0;
+unique_ptr<V4L2Buffers> v4l2_buffers;
+
+SegmentLimits segment_limits;
+
+// V4L2 pixel format to capture in (0 picks one with negotiate_pixel_format)
+// and the stride of its first plane, both set by set_format()
+uint32_t pixel_format = 0;
+unsigned bytes_per_line = 0;
+
+// in order of preference: 4:2:0 formats the encoder takes (almost) as is,
+// MJPEG when raw frames cannot reach the frame rate, and YUYV conversion
+// as the last resort
+const vector<uint32_t> capture_formats = {
+  V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_YUYV
+};
+
 struct SwsContext *sws_ctx = NULL;
-uint8_t *ff_in_data = NULL;
 int ff_in_linesize = 0;
 uint8_t *ff_out_data = NULL;
 int ff_out_linesize[4];
-struct SwsContext *sws_preview_ctx = NULL;
-uint8_t *prev_in_data = NULL;
-int prev_in_linesize = 0;
-uint8_t *prev_out_data = NULL;
-int prev_out_linesize = 0;
 
+// ------------------ Preview Buffers ------------------
+// Latest-wins triple buffer between the capture thread, which fills
+// 'preview_back' and swaps it into the middle slot, and the preview thread,
+// which swaps the middle slot out whenever it is flagged fresh. Neither side
+// ever waits for the other, so a slow display cannot hold back capture.
 const int preview_w = 640;
 const int preview_h = 480;
+const int PREVIEW_FRESH = 4;
+
+uint8_t *preview_bufs[3] = { NULL, NULL, NULL };
+atomic<int> preview_middle{1};
+int preview_back = 0;   // owned by the capture thread
+int preview_front = 2;  // owned by the preview thread
+
+int preview_fps = 30;   // preview conversions per second; 0 disables preview
+int preview_every = 1;  // convert at most every Nth captured frame
+unsigned long preview_seq = 0;
+uint64_t preview_last_ns = 0;
+
+static uint64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// CLOCK_MONOTONIC time (ns) at which the driver captured 'buf'; drivers
+// that timestamp on another clock are stamped with the dequeue time instead
+static uint64_t buffer_capture_ns(const struct v4l2_buffer &buf) {
+  if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) != V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+    return monotonic_ns();
+  return (uint64_t)buf.timestamp.tv_sec * 1000000000ULL + buf.timestamp.tv_usec * 1000ULL;
+}
+
+static void preview_init() {
+  for (auto &buf : preview_bufs) buf = (uint8_t *)calloc(preview_w * preview_h, 2);
+}
+
+static void preview_free() {
+  for (auto &buf : preview_bufs) { free(buf); buf = NULL; }
+}
+
+// Capture thread: downscale a frame for the preview if one is due, from the
+// YUYV buffer if there is one or else from the converted image. The fused
+// kernels only read the ~640x480 source pixels they sample.
+static void preview_submit(const uint8_t *yuyv, const RawImage *image) {
+  if (preview_fps <= 0 || (!yuyv && !image) || preview_seq++ % preview_every != 0) return;
+
+  const uint64_t now = monotonic_ns();
+  if (now - preview_last_ns < 1000000000ULL / preview_fps) return;
+  preview_last_ns = now;
+
+  if (yuyv) {
+    yuyv_to_rgb565_scaled(yuyv, bytes_per_line, width, height,
+                          preview_bufs[preview_back], preview_w * 2, preview_w, preview_h);
+  } else {
+    image_to_rgb565_scaled(*image, preview_bufs[preview_back], preview_w * 2, preview_w, preview_h);
+  }
+  preview_back = preview_middle.exchange(preview_back | PREVIEW_FRESH) & ~PREVIEW_FRESH;
+}
+
+// ------------------ Frame Ring ------------------
+uint32_t parse_pixel_format(const string &name) {
+  if (name == "auto") return 0;
+  if (name == "i420") return V4L2_PIX_FMT_YUV420;
+  if (name == "nv12") return V4L2_PIX_FMT_NV12;
+  if (name == "mjpeg") return V4L2_PIX_FMT_MJPEG;
+  if (name == "yuyv") return V4L2_PIX_FMT_YUYV;
+  throw runtime_error("unknown pixel format: " + name);
+}
 
-// Frame ring definition
-YUV420PFrame frame_ring[FRAME_RING_SIZE];
-int frame_ring_head = 0;
-int frame_ring_tail = 0;
-pthread_mutex_t frame_ring_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t frame_available = PTHREAD_COND_INITIALIZER;
-size_t yuv_frame_size = 0;
+AdmissionPolicy parse_admission_policy(const string &name) {
+  if (name == "newest") return AdmissionPolicy::DropNewest;
+  if (name == "oldest") return AdmissionPolicy::DropOldest;
+  if (name == "latest") return AdmissionPolicy::Latest;
+  throw runtime_error("unknown admission policy: " + name);
+}
+
+size_t frames_for_latency_budget(const unsigned budget_ms, const int fps) {
+  return max<size_t>(1, (size_t)budget_ms * fps / 1000);
+}
+
+FrameRing::FrameRing(const size_t depth, const uint16_t width, const uint16_t height,
+                     const AdmissionPolicy policy, const unsigned max_age_ms,
+                     const bool huge_pages)
+  : policy_(policy),
+    depth_(policy == AdmissionPolicy::Latest ? 1 : depth),
+    max_age_ns_(max_age_ms * 1000000ULL),
+    pool_(width, height, depth_ + 2, huge_pages),
+    frames_(depth_ + 2), ready_(depth_), free_(depth_ + 2), notifier_() {
+  if (depth_ == 0) {
+    throw runtime_error("FrameRing: depth must be positive");
+  }
+}
+
+YUV420PFrame *FrameRing::acquire() {
+  // don't waste a conversion on a frame that will not be admitted
+  if (policy_ == AdmissionPolicy::DropNewest && ready_.size() >= depth_) {
+    num_dropped_++;
+    return nullptr;
+  }
+
+  YUV420PFrame *frame = spare_;
+  spare_ = nullptr;
+
+  if (!frame && !free_.pop(frame)) {
+    // every frame created so far is in use: map another one if allowed
+    if (num_created_ == frames_.size()) {
+      num_dropped_++;
+      return nullptr;
+    }
+
+    frame = &frames_[num_created_++];
+    frame->image = pool_.allocate();
+  }
+
+  // the frame just taken is not in 'free_' any more
+  const size_t in_use = num_created_ - free_.size();
+  if (in_use > peak_in_use_.load(memory_order_relaxed)) {
+    peak_in_use_.store(in_use, memory_order_relaxed);
+  }
+
+  return frame;
+}
+
+void FrameRing::discard(YUV420PFrame *frame) {
+  // acquire() always empties 'spare_'
+  spare_ = frame;
+  num_dropped_++;
+}
+
+void FrameRing::set_image_format(const vpx_img_fmt_t format) {
+  pool_.set_format(format);
+}
+
+void FrameRing::publish(YUV420PFrame *frame) {
+  while (!ready_.push(frame)) {
+    // full: only reachable by DropNewest if the consumer raced us, in which
+    // case the new frame is dropped after all
+    if (policy_ == AdmissionPolicy::DropNewest) {
+      spare_ = frame;
+      num_dropped_++;
+      return;
+    }
+
+    // the evicted frame becomes the next one to fill; if the consumer took
+    // the oldest frame first, the push is simply retried
+    if (ready_.drop_oldest(spare_)) {
+      num_overwritten_++;
+    }
+  }
+
+  num_admitted_++;
+  notifier_.signal();
+}
+
+YUV420PFrame *FrameRing::next() {
+  YUV420PFrame *frame = nullptr;
+
+  while (ready_.pop(frame)) {
+    if (max_age_ns_ == 0 || monotonic_ns() - frame->capture_ns <= max_age_ns_) {
+      return frame;
+    }
+
+    // too stale to be worth encoding
+    release(frame);
+    num_expired_++;
+  }
+
+  return nullptr;
+}
+
+void FrameRing::release(YUV420PFrame *frame) {
+  free_.push(frame);
+}
+
+void FrameRing::output_periodic_stats() {
+  const uint64_t admitted = num_admitted_.exchange(0);
+  const uint64_t dropped = num_dropped_.exchange(0);
+  const uint64_t overwritten = num_overwritten_.exchange(0);
+  const uint64_t expired = num_expired_.exchange(0);
+
+  if (dropped || overwritten || expired) {
+    cerr << "  - Capture ring admitted/dropped/overwritten/expired: "
+         << admitted << "/" << dropped << "/" << overwritten << "/" << expired << endl;
+  }
+
+  cerr << "  - Frame pool peak in use/allocated/capacity: "
+       << peak_in_use_.exchange(0) << "/" << pool_.num_allocated()
+       << "/" << pool_.capacity() << ", "
+       << pool_.bytes_mapped() / (1024 * 1024) << " MiB mapped"
+       << (pool_.using_hugetlb() ? " (hugetlb)" : "") << endl;
+}
+
+int default_convert_threads(int w, int h) {
+  // one band per ~1080p worth of pixels, bounded by the cores available
+  const long pixels = (long)w * h;
+  int bands = 1;
+  if (pixels >= 3840L * 2160) bands = 4;
+  else if (pixels >= 1920L * 1080) bands = 2;
+  return max(1, min(bands, get_nprocs()));
+}
 
 void sigint_handler(int s) {
   (void)s;
@@ -69,18 +282,36 @@ void sigint_handler(int s) {
 }
 
 void set_format() {
+  // unless forced, pick the most preferred format the camera offers
+  if (pixel_format == 0) {
+    try {
+      pixel_format = negotiate_pixel_format(fd, width, height, fps, capture_formats);
+    } catch (const exception &e) {
+      fprintf(stderr, "%s\n", e.what());
+      exit(1);
+    }
+  }
+
   struct v4l2_format fmt;
   CLEAR(fmt);
   fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
   fmt.fmt.pix.width = width;
   fmt.fmt.pix.height = height;
-  fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+  fmt.fmt.pix.pixelformat = pixel_format;
   fmt.fmt.pix.field = V4L2_FIELD_NONE;
   if (ioctl(fd, VIDIOC_S_FMT, &fmt) < 0) {
     perror("VIDIOC_S_FMT");
     exit(1);
   }
 
+  if (fmt.fmt.pix.pixelformat != pixel_format) {
+    fprintf(stderr, "Camera does not capture in %s\n", fourcc_to_string(pixel_format).c_str());
+    exit(1);
+  }
+  bytes_per_line = fmt.fmt.pix.bytesperline;
+  if (bytes_per_line == 0)  // compressed formats
+    bytes_per_line = pixel_format == V4L2_PIX_FMT_YUYV ? width * 2 : width;
+
   struct v4l2_streamparm parm;
   CLEAR(parm);
   parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -92,36 +323,16 @@ void set_format() {
   }
 }
 
-void init_mmap() {
-  struct v4l2_requestbuffers req;
-  CLEAR(req);
-  req.count = 4;
-  req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  req.memory = V4L2_MEMORY_MMAP;
-
-  if (ioctl(fd, VIDIOC_REQBUFS, &req) < 0) {
-    perror("VIDIOC_REQBUFS");
+void init_buffers() {
+  try {
+    v4l2_buffers = make_unique<V4L2Buffers>(fd, v4l2_io, num_v4l2_buffers, fps);
+  } catch (const exception &e) {
+    fprintf(stderr, "%s\n", e.what());
     exit(1);
   }
 
-  n_buffers = req.count;
-  buffers = calloc(n_buffers, sizeof(void*));
-
-  for (unsigned i = 0; i < n_buffers; i++) {
-    struct v4l2_buffer buf;
-    CLEAR(buf);
-    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_MMAP;
-    buf.index = i;
-
-    ioctl(fd, VIDIOC_QUERYBUF, &buf);
-    buffers = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
-    if (buffers == MAP_FAILED) {
-      perror("mmap");
-      exit(1);
-    }
-    ioctl(fd, VIDIOC_QBUF, &buf);
-  }
+  cerr << "V4L2: " << v4l2_buffers->count() << " " << v4l2_io_name(v4l2_io)
+       << " buffers of " << v4l2_buffers->buffer_size() / 1024 << " KiB" << endl;
 }
 
 int low_space() {
@@ -144,17 +355,16 @@ void *preview_thread(void *arg) {
       if (ev.type == SDL_KEYDOWN && ev.key.keysym.sym == SDLK_q) run = 0;
     }
 
-    pthread_mutex_lock(&preview_mtx);
-    if (preview_rgb) {
-      SDL_UpdateTexture(tex, NULL, preview_rgb, preview_w * 2);
-      pthread_mutex_unlock(&preview_mtx);
+    // render only when the capture thread has swapped in a newer picture
+    if (preview_middle.load() & PREVIEW_FRESH) {
+      preview_front = preview_middle.exchange(preview_front) & ~PREVIEW_FRESH;
+      SDL_UpdateTexture(tex, NULL, preview_bufs[preview_front], preview_w * 2);
 
       SDL_RenderClear(ren);
       SDL_RenderCopy(ren, tex, NULL, NULL);
       SDL_RenderPresent(ren);
     } else {
-      pthread_mutex_unlock(&preview_mtx);
-      SDL_Delay(33);
+      SDL_Delay(5);
     }
   }
 
@@ -166,15 +376,35 @@ void *preview_thread(void *arg) {
 }
 
 // ------------------ Disk Recording Capture Loop ------------------
+// open a Y4M segment and its index ("frame,offset,capture_ts" per frame);
+// returns the size of the header
+static uint64_t open_disk_segment(const char *path, FILE **out, FILE **idx) {
+  *out = fopen(path, "wb");
+  if (!*out) { perror("fopen"); exit(1); }
+
+  const string idx_path = string(path) + ".idx";
+  *idx = fopen(idx_path.c_str(), "w");
+  if (!*idx) { perror("fopen"); exit(1); }
+  fprintf(*idx, "frame,offset,capture_ts\n");
+
+  return fprintf(*out, "YUV4MPEG2 W%d H%d F%d:1 Ip A0:0\n", width, height, fps);
+}
+
 void capture_disk_loop(const char *fname) {
+  if (pixel_format != V4L2_PIX_FMT_YUYV) {
+    fprintf(stderr, "Disk recording only supports YUYV capture\n");
+    exit(1);
+  }
+
+  preview_init();
   pthread_t tid;
   pthread_create(&tid, NULL, preview_thread, NULL);
-  FILE *out = fopen(fname, "wb");
-  if (!out) { perror("fopen"); exit(1); }
-  fprintf(out, "YUV4MPEG2 W%d H%d F%d:1 Ip A0:0\n", width, height, fps);
+  SegmentRotator segments(fname, segment_limits);
+  FILE *out = NULL, *idx = NULL;
+  uint64_t seg_bytes = open_disk_segment(segments.current().c_str(), &out, &idx);
+  uint64_t seg_frames = 0;
 
   ff_in_linesize = width * 2;
-  ff_in_data = (uint8_t *) av_malloc(ff_in_linesize * height);
   ff_out_linesize[0] = width;
   ff_out_linesize[1] = width / 2;
   ff_out_linesize[2] = width / 2;
@@ -185,24 +415,25 @@ void capture_disk_loop(const char *fname) {
   sws_ctx = sws_getContext(width, height, AV_PIX_FMT_YUYV422, width, height, AV_PIX_FMT_YUV420P, SWS_BILINEAR, NULL, NULL, NULL);
 
   struct pollfd pfd = { fd, POLLIN, 0 };
-  int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  ioctl(fd, VIDIOC_STREAMON, &type);
+  v4l2_buffers->stream_on();
   
   time_t last_flush = time(NULL);
 
   while (run) {
-    if (low_space()) break;
+    // running low on disk deletes the oldest segment instead of ending the
+    // recording; only a recording with none left to delete stops
+    if (low_space() && !segments.evict_oldest()) {
+      fprintf(stderr, "Disk <1GiB, stopping.\n");
+      break;
+    }
     if (poll(&pfd, 1, 1000) < 0) continue;
 
     struct v4l2_buffer buf;
-    CLEAR(buf);
-    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_MMAP;
-    ioctl(fd, VIDIOC_DQBUF, &buf);
-    uint8_t *data = (uint8_t *)buffers + buf.m.offset;
-
-    memcpy(ff_in_data, data, ff_in_linesize * height);
-    const uint8_t *in[1] = { ff_in_data };
+    if (!v4l2_buffers->dequeue(buf)) continue;
+    const uint8_t *data = v4l2_buffers->data(buf.index);
+    const uint64_t capture_ts = timestamp_us() - (monotonic_ns() - buffer_capture_ns(buf)) / 1000;
+
+    const uint8_t *in[1] = { data };
     int in_ls[1] = { ff_in_linesize };
     uint8_t *out_planes[3] = {
       ff_out_data,
@@ -210,23 +441,37 @@ void capture_disk_loop(const char *fname) {
       ff_out_data + ysz + usz
     };
     sws_scale(sws_ctx, in, in_ls, 0, height, out_planes, ff_out_linesize);
+    preview_submit(data, NULL);
+
+    // every frame can start a segment
+    if (seg_frames > 0 && segments.due(seg_bytes)) {
+      fclose(out);
+      fclose(idx);
+      seg_bytes = open_disk_segment(segments.rotate(seg_bytes).c_str(), &out, &idx);
+      seg_frames = 0;
+    }
+
+    fprintf(idx, "%llu,%llu,%llu\n", (unsigned long long)seg_frames,
+            (unsigned long long)seg_bytes, (unsigned long long)capture_ts);
+    seg_frames++;
+    seg_bytes += 6 + ysz + 2 * usz;
 
     fprintf(out, "FRAME\n");
     fwrite(out_planes[0], 1, ysz, out);
     fwrite(out_planes[1], 1, usz, out);
     fwrite(out_planes[2], 1, usz, out);
 
-    ioctl(fd, VIDIOC_QBUF, &buf);
-    if (difftime(time(NULL), last_flush) >= 5.0) { fflush(out); last_flush = time(NULL); }
+    v4l2_buffers->requeue(buf);
+    if (difftime(time(NULL), last_flush) >= 5.0) { fflush(out); fflush(idx); last_flush = time(NULL); }
   }
 
-  int type_off = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  ioctl(fd, VIDIOC_STREAMOFF, &type_off);
+  v4l2_buffers.reset();
 
   fclose(out);
+  fclose(idx);
   pthread_join(tid, NULL);
+  preview_free();
   sws_freeContext(sws_ctx);
-  av_free(ff_in_data);
   av_free(ff_out_data);
 }
 
@@ -237,56 +482,65 @@ void *capture_streaming_loop(void *arg) {
   width = params->width;
   height = params->height;
   fps = params->fps;
+  FrameRing *ring = params->ring;
 
   fd = open(dev_name, O_RDWR | O_NONBLOCK, 0);
 
   // Set V4L2 format & parameters, initialize memory mapping, and start capture
+  pixel_format = params->pixel_format;
   set_format();
   cerr << "Set format: " << dev_name 
        << " width=" << width 
        << " height=" << height 
-       << " FPS=" << fps << endl;
-  init_mmap();
-
-  // Initialize buffers for preview
-  prev_in_linesize = width * 2;
-  prev_out_linesize = preview_w * 2;
-  prev_in_data = (uint8_t *) av_malloc(prev_in_linesize * height);
-  prev_out_data = (uint8_t *) av_malloc(prev_out_linesize * preview_h);
-  preview_rgb = (uint8_t *) malloc(preview_w * preview_h * 2);
-
-  sws_preview_ctx = sws_getContext(
-    width, height, AV_PIX_FMT_YUYV422, 
-    preview_w, preview_h, AV_PIX_FMT_RGB565, 
-    SWS_BILINEAR, NULL, NULL, NULL);
-
-  // Initilize buffers for YUV420P conversion
-  ff_in_linesize     = width * 2;
-  ff_in_data         = (uint8_t *)av_malloc(ff_in_linesize * height);
-  ff_out_linesize[0] = width;       // Y plane pitch = width
-  ff_out_linesize[1] = width / 2;   // U plane pitch
-  ff_out_linesize[2] = width / 2;   // V plane pitch
-  // ff_out_data        = (uint8_t *)av_malloc(av_image_get_buffer_size(AV_PIX_FMT_YUV420P, width, height, 1));
-  yuv_frame_size = width * height * 3 / 2;
-  ff_out_data        = (uint8_t *)av_malloc(yuv_frame_size);
-
-  // Initialize swscale context for YUYV422 → YUV420P
-  sws_ctx = sws_getContext(
-    width, height, AV_PIX_FMT_YUYV422, 
-    width, height, AV_PIX_FMT_YUV420P, 
-    SWS_BILINEAR, NULL, NULL, NULL);
+       << " FPS=" << fps
+       << " pixel format=" << fourcc_to_string(pixel_format) << endl;
+  v4l2_io = params->v4l2_io;
+  num_v4l2_buffers = params->v4l2_buffers;
+  init_buffers();
+
+  // NV12 goes to the encoder as is; everything else is turned into I420
+  ring->set_image_format(pixel_format == V4L2_PIX_FMT_NV12 ? VPX_IMG_FMT_NV12 : VPX_IMG_FMT_I420);
+  unique_ptr<MJPEGDecoder> mjpeg;
+  if (pixel_format == V4L2_PIX_FMT_MJPEG) mjpeg = make_unique<MJPEGDecoder>();
+
+  // Preview runs at its own (decimated) rate on its own thread; headless
+  // deployments disable it entirely
+  preview_fps = params->preview_fps;
+  preview_every = max(1, params->preview_every);
+  if (preview_fps > 0) preview_init();
+
+  // The conversion is split into horizontal bands that run in parallel on a
+  // persistent pool; the calling thread converts one band itself
+  const size_t num_bands = params->convert_threads > 0
+      ? params->convert_threads : default_convert_threads(width, height);
+  WorkerPool band_pool(num_bands - 1);
+  cerr << "Converting frames in " << num_bands << " band(s)" << endl;
+
+  // I420 bands must start on an even row to keep chroma rows whole
+  auto i420_row = [&](size_t k) {
+    return k == num_bands ? height : (int)(k * (height / 2) / num_bands) * 2;
+  };
+
+  // YUV420P conversion reads the V4L2 buffer in place and writes straight
+  // into a frame from the ring, so no intermediate buffers are needed
+  ff_in_linesize = bytes_per_line;
+  if (pixel_format == V4L2_PIX_FMT_YUYV)
+    cerr << "YUYV to I420 conversion kernel: " << yuyv_kernel_name() << endl;
   
   // cerr<< "Initialized Preview and YUV420P conversion." << endl;
 
   pthread_t tid;
-  pthread_create(&tid, NULL, preview_thread, NULL);
+  if (preview_fps > 0) {
+    pthread_create(&tid, NULL, preview_thread, NULL);
+  } else {
+    cerr << "Preview disabled" << endl;
+  }
 
   // cerr << "Launched preview thread." << endl;
 
   // Start streaming on the V4L2 device
   struct pollfd pfd = { fd, POLLIN, 0 };
-  int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  ioctl(fd, VIDIOC_STREAMON, &type);
+  v4l2_buffers->stream_on();
 
   cerr << "Started streaming on device: " << dev_name << endl;
 
@@ -305,79 +559,146 @@ void *capture_streaming_loop(void *arg) {
 
     // Dequeue the next buffer containing a captured frame
     struct v4l2_buffer buf;
-    CLEAR(buf);
-    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_MMAP;
-    ioctl(fd, VIDIOC_DQBUF, &buf);
+    try {
+      if (!v4l2_buffers->dequeue(buf)) continue;  // poll timed out
+    } catch (const exception &e) {
+      cerr << e.what() << endl;
+      break;
+    }
 
     // cerr << "Dequeued buffer index: " << buf.index << endl;
 
-    // Pointer to raw YUYV data from mapped buffers
-    uint8_t *data = (uint8_t *)buffers + buf.m.offset;
+    // Pointer to the raw frame in this buffer's own mapping
+    const uint8_t *data = v4l2_buffers->data(buf.index);
 
     // cerr << "Buffer size: " << buf.bytesused << ", offset: " << buf.m.offset << endl;
 
-    // --- Preview conversion: YUYV422 → RGB565 (scaled to 640×480) ---
-    memcpy(prev_in_data, data, prev_in_linesize * height);
-    const uint8_t *in[1] = { prev_in_data };
-    int in_ls[1] = { prev_in_linesize };
-    uint8_t *out[1] = { prev_out_data };
-    int out_ls[1] = { prev_out_linesize };
+    // YUV420P conversion straight into a pooled frame, band by band; the
+    // frame is dropped if the streaming thread still holds every frame
+    YUV420PFrame *frame = ring->acquire();
+    if (frame) {
+      // the monotonic capture time bounds the frame's age in the ring; the
+      // wall-clock one travels with the image to the receiver
+      frame->capture_ns = buffer_capture_ns(buf);
+      frame->image->set_capture_ts(timestamp_us() - (monotonic_ns() - frame->capture_ns) / 1000);
+      RawImage &image = *frame->image;
+
+      if (pixel_format == V4L2_PIX_FMT_MJPEG) {
+        try {
+          mjpeg->decode({(const char *)data, buf.bytesused}, image);
+        } catch (const exception &e) {
+          // e.g., a truncated JPEG; the frame is skipped
+          cerr << e.what() << endl;
+          ring->discard(frame);
+          frame = NULL;
+        }
+      } else if (pixel_format == V4L2_PIX_FMT_YUYV) {
+        band_pool.run(num_bands, [&](size_t k) {
+          yuyv_to_i420(data, ff_in_linesize, image, i420_row(k), i420_row(k + 1));
+        });
+      } else {
+        band_pool.run(num_bands, [&](size_t k) {
+          copy_planar_420(data, bytes_per_line, pixel_format, image, i420_row(k), i420_row(k + 1));
+        });
+      }
+
+      // publish only once every band is complete; ownership of the frame
+      // passes to the encoder (which only reads it, as does the preview below)
+      if (frame) ring->publish(frame);
+    }
 
-    sws_scale(sws_preview_ctx, in, in_ls, 0, height, out, out_ls);
-    pthread_mutex_lock(&preview_mtx);
-    memcpy(preview_rgb, prev_out_data, prev_out_linesize * preview_h);
-    pthread_mutex_unlock(&preview_mtx);
+    // --- Preview conversion: → RGB565 (scaled to 640×480) ---
+    preview_submit(pixel_format == V4L2_PIX_FMT_YUYV ? data : NULL,
+                   frame ? frame->image : NULL);
 
-    // cerr << "Captured frame: " << buf.index << ", size: " << buf.bytesused << endl;
+    // hand the buffer back to the driver as soon as both conversions are done
+    v4l2_buffers->requeue(buf);
+  }
 
-    // YUV420P conversion
-    memcpy(ff_in_data, data, ff_in_linesize * height);
-    const uint8_t *src_planes[1] = { ff_in_data };
-    int src_stride[1] = { ff_in_linesize };
+  // streaming stops and the buffers are freed before the device is closed
+  v4l2_buffers.reset();
 
-    size_t y_sz = ff_out_linesize[0] * height;
-    size_t u_sz = ff_out_linesize[1] * (height / 2);
-    uint8_t *out_planes[3] = {
-      ff_out_data,
-      ff_out_data + y_sz,
-      ff_out_data + y_sz + u_sz
-    };
+  if (preview_fps > 0) {
+    pthread_join(tid, NULL);
+    preview_free();
+  }
+  close(fd);
 
-    sws_scale(
-        sws_ctx,
-        src_planes, src_stride,
-        0, height,
-        out_planes, ff_out_linesize
-    );
-
-    pthread_mutex_lock(&frame_ring_mutex);
-    if (!frame_ring[frame_ring_head].ready) {
-      pthread_mutex_lock(&frame_ring[frame_ring_head].lock);
-      memcpy(frame_ring[frame_ring_head].data, ff_out_data, yuv_frame_size);
-      frame_ring[frame_ring_head].size = yuv_frame_size;
-      frame_ring[frame_ring_head].ready = true;
-
-      pthread_mutex_unlock(&frame_ring[frame_ring_head].lock);
-      frame_ring_head = (frame_ring_head + 1) % FRAME_RING_SIZE;
-      pthread_cond_signal(&frame_available);
-
-      // cerr << "Stored frame in ring buffer at index: " << frame_ring_head << endl;
-    }
-    pthread_mutex_unlock(&frame_ring_mutex);
+  return nullptr;
+}
 
-    ioctl(fd, VIDIOC_QBUF, &buf);
+// ------------------ Camera-less Capture Loop ------------------
+// Feeds frames from a file replay or a generated pattern into the same ring
+// as the camera would, either paced at the configured rate or as fast as
+// the encoder takes them
+void *capture_source_loop(void *arg) {
+  auto *params = static_cast<CaptureParams *>(arg);
+  width = params->width;
+  height = params->height;
+  fps = params->fps;
+  FrameRing *ring = params->ring;
+  VideoInput *source = params->source;
+
+  preview_fps = params->preview_fps;
+  preview_every = max(1, params->preview_every);
+  pthread_t tid;
+  if (preview_fps > 0) {
+    preview_init();
+    pthread_create(&tid, NULL, preview_thread, NULL);
   }
 
-  int type_off = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  ioctl(fd, VIDIOC_STREAMOFF, &type_off);
+  cerr << "Capturing from a " << (params->paced ? "paced" : "unpaced")
+       << " source: width=" << width << " height=" << height << endl;
 
-  pthread_join(tid, NULL);
-  sws_freeContext(sws_preview_ctx);
-  av_free(prev_in_data);
-  av_free(prev_out_data);
-  free(preview_rgb);
-  close(fd);
+  const uint64_t interval_ns = 1000000000ULL / fps;
+  uint64_t deadline_ns = monotonic_ns();
+
+  while (run) {
+    if (params->paced) {
+      // absolute deadlines keep the rate exact; after a stall the schedule
+      // restarts instead of bursting to catch up
+      deadline_ns += interval_ns;
+      const uint64_t now = monotonic_ns();
+      if (deadline_ns + interval_ns < now) deadline_ns = now;
+
+      struct timespec ts;
+      ts.tv_sec = deadline_ns / 1000000000ULL;
+      ts.tv_nsec = deadline_ns % 1000000000ULL;
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+    }
+
+    YUV420PFrame *frame = ring->acquire();
+    if (!frame) {
+      // unpaced: wait for the encoder rather than spin
+      if (!params->paced) usleep(500);
+      continue;
+    }
+
+    bool got_frame;
+    try {
+      got_frame = source->read_frame(*frame->image);
+    } catch (const exception &e) {
+      cerr << e.what() << endl;
+      got_frame = false;
+    }
+
+    if (!got_frame) {
+      ring->discard(frame);
+      run = 0;
+      break;
+    }
+
+    frame->capture_ns = monotonic_ns();
+    frame->image->set_capture_ts(timestamp_us());
+    ring->publish(frame);
+
+    preview_submit(NULL, frame->image);
+  }
+
+  if (preview_fps > 0) {
+    pthread_join(tid, NULL);
+    preview_free();
+  }
 
   return nullptr;
 }
@@ -3,56 +3,173 @@
 
 #include <stdint.h>
 #include <pthread.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "image.hh"
+#include "image_pool.hh"
+#include "segments.hh"
+#include "eventfd.hh"
+#include "spsc_ring.hh"
+#include "v4l2_buffers.hh"
+#include "video_input.hh"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 void set_format();
-void init_mmap();
+void init_buffers();
 void *preview_thread(void *arg);
 void capture_loop(const char *fname);
 void sigint_handler(int s);
 int low_space();
 void capture_disk_loop(const char *fname);
 void *capture_streaming_loop(void *arg);
+void *capture_source_loop(void *arg);
+int default_convert_threads(int w, int h);
 
 extern const char *dev_name;
 extern int fd;
 extern int width;
 extern int height;
 extern int fps;
+extern uint32_t pixel_format;
 extern int pixel_mode;
-extern void *buffers;
-extern unsigned n_buffers;
 extern int run;
 
 #ifdef __cplusplus
 }
 #endif
 
+// segment sizes and disk budget of capture_disk_loop's recording (set by
+// camera_recorder); the default records one file until the disk is nearly
+// full (low_space()), and a rotating recording deletes its oldest segments
+// instead of stopping there
+extern SegmentLimits segment_limits;
+
 // ===== Shared ring buffer between capturing thread and streaming thread =====
-constexpr int FRAME_RING_SIZE = 500;
+// frames may queue for the encoder for at most this long by default
+constexpr unsigned DEFAULT_LATENCY_BUDGET_MS = 200;
+
+// number of queued frames that fit in 'budget_ms' at 'fps' (at least 1)
+size_t frames_for_latency_budget(const unsigned budget_ms, const int fps);
 
+// A pooled I420 (or NV12) image that the capture thread converts straight into and
+// the encoder reads straight from; whoever holds the pointer owns the frame.
 struct YUV420PFrame {
-  uint8_t *data;
-  size_t size;
-  bool ready;
-  pthread_mutex_t lock;
+  RawImage *image {nullptr}; // owned by the ring's image pool
+  uint64_t capture_ns {0}; // CLOCK_MONOTONIC time the frame was captured
 };
 
-extern YUV420PFrame frame_ring[FRAME_RING_SIZE];
-extern int frame_ring_head;
-extern int frame_ring_tail;
-extern pthread_cond_t frame_available;
-extern pthread_mutex_t frame_ring_mutex;
-extern size_t yuv_frame_size;
+// What the capture thread does when the encoder falls behind and the ring
+// is full:
+//   DropNewest: the new frame is not admitted (the old behavior)
+//   DropOldest: the oldest queued frame is overwritten by the new one
+//   Latest:     a mailbox of depth 1; the encoder always gets the newest frame
+enum class AdmissionPolicy { DropNewest, DropOldest, Latest };
+
+// parse "auto" (0), "i420", "nv12", "mjpeg" or "yuyv" into a V4L2 fourcc;
+// throws on anything else
+uint32_t parse_pixel_format(const std::string &name);
+
+// parse "newest", "oldest" or "latest"; throws on anything else
+AdmissionPolicy parse_admission_policy(const std::string &name);
+
+// Lock-free handoff of frames from the capture thread (single producer) to
+// the streaming thread (single consumer). Filled frames travel through
+// 'ready_' and are handed back through 'free_', so a frame is only ever
+// touched by one thread at a time and no per-frame locking is needed.
+// Images are only mapped when a frame is first needed, so a ring that is
+// sized generously costs memory only if the encoder actually falls behind.
+class FrameRing {
+public:
+  // 'depth' bounds the frames queued for the encoder (forced to 1 by the
+  // Latest policy); frames older than 'max_age_ms' are skipped by next()
+  // unless it is 0; 'huge_pages' backs the images with huge pages
+  FrameRing(const size_t depth, const uint16_t width, const uint16_t height,
+            const AdmissionPolicy policy = AdmissionPolicy::DropNewest,
+            const unsigned max_age_ms = 0, const bool huge_pages = false);
+
+  // producer: take an empty frame to fill; nullptr if the frame must be
+  // dropped under the admission policy
+  YUV420PFrame *acquire();
+
+  // producer: give back an acquired frame that could not be filled
+  void discard(YUV420PFrame *frame);
+
+  // producer: format of the images (I420 by default); only before the
+  // first acquire()
+  void set_image_format(const vpx_img_fmt_t format);
+
+  // producer: queue a filled frame and wake up the consumer; under the
+  // DropOldest and Latest policies this evicts the oldest queued frame
+  // if the ring is full
+  void publish(YUV420PFrame *frame);
+
+  // consumer: oldest filled frame that is not too old; nullptr if none
+  YUV420PFrame *next();
+
+  // consumer: give a frame back once it has been consumed
+  void release(YUV420PFrame *frame);
+
+  // readable whenever frames were published since the last read_count()
+  Eventfd &notifier() { return notifier_; }
+
+  // output admission counters and pool usage of the last period and reset
+  // the counters
+  void output_periodic_stats();
+
+  // forbid copying and moving
+  FrameRing(const FrameRing &other) = delete;
+  const FrameRing &operator=(const FrameRing &other) = delete;
+  FrameRing(FrameRing &&other) = delete;
+  FrameRing &operator=(FrameRing &&other) = delete;
+
+private:
+  AdmissionPolicy policy_;
+  size_t depth_;
+  uint64_t max_age_ns_;
+
+  // depth + 2 frames: one being filled, one being encoded, the rest queued
+  ImagePool pool_;
+  std::vector<YUV420PFrame> frames_;
+  SPSCRing<YUV420PFrame *> ready_;
+  SPSCRing<YUV420PFrame *> free_;
+  Eventfd notifier_;
+
+  // producer only: a frame evicted from 'ready_', reused by acquire()
+  YUV420PFrame *spare_ {nullptr};
+
+  // producer only: frames_[0, num_created_) have an image
+  size_t num_created_ {0};
+
+  // most frames held at once (filled, queued or encoding) in the period
+  std::atomic<size_t> peak_in_use_ {0};
+
+  // updated by both threads, read and reset by output_periodic_stats()
+  std::atomic<uint64_t> num_admitted_ {0};
+  std::atomic<uint64_t> num_dropped_ {0};     // not admitted (ring full)
+  std::atomic<uint64_t> num_overwritten_ {0}; // evicted by a newer frame
+  std::atomic<uint64_t> num_expired_ {0};     // older than the max age
+};
 
 // ===== Capture parameters structure =====
 struct CaptureParams {
   int width;
   int height;
   int fps;
+  FrameRing *ring;
+  int convert_threads; // conversion bands; 0 picks by resolution
+  int preview_fps;     // preview refresh rate; 0 disables preview
+  int preview_every;   // preview at most every Nth captured frame
+  uint32_t pixel_format; // V4L2 fourcc to capture in; 0 negotiates
+  V4L2IO v4l2_io;        // how capture buffers are shared with the driver
+  unsigned v4l2_buffers; // driver queue depth; 0 picks by frame size and rate
+  VideoInput *source;    // replaces the camera if set (capture_source_loop)
+  bool paced;            // source frames at 'fps' rather than as fast as possible
 };
 
 
@@ -1,5 +1,6 @@
 #include <sys/sysinfo.h>
 #include <cassert>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 #include <algorithm>
@@ -11,6 +12,7 @@
 #include <iomanip>
 // **************************************
 #include "decoder.hh"
+#include "fec.hh"
 #include "exception.hh"
 #include "conversion.hh"
 #include "image.hh"
@@ -21,8 +23,14 @@ using namespace chrono;
 
 Frame::Frame(const uint32_t frame_id,
              const FrameType frame_type,
-             const uint16_t frag_cnt)
-  : id_(frame_id), type_(frame_type), frags_(frag_cnt), null_frags_(frag_cnt)
+             const uint16_t frag_cnt,
+             const uint64_t capture_ts,
+             const uint8_t stripe_cnt,
+             const uint16_t fec_cnt,
+             const uint16_t fec_groups)
+  : id_(frame_id), type_(frame_type), capture_ts_(capture_ts),
+    stripe_cnt_(stripe_cnt), frags_(frag_cnt), null_frags_(frag_cnt),
+    parity_(fec_cnt), fec_groups_(fec_groups)
 {
   if (frag_cnt == 0) {
     throw runtime_error("frame cannot have zero fragments");
@@ -57,8 +65,11 @@ void Frame::validate_datagram(const Datagram & datagram) const
 {
   if (datagram.frame_id != id_ or
       datagram.frame_type != type_ or
-      datagram.frag_id >= frags_.size() or
-      datagram.frag_cnt != frags_.size()) {
+      datagram.frag_id >= frags_.size() + parity_.size() or
+      datagram.frag_cnt != frags_.size() or
+      datagram.stripe_cnt != stripe_cnt_ or
+      datagram.fec_cnt != parity_.size() or
+      datagram.fec_groups != fec_groups_) {
     throw runtime_error("unable to insert an incompatible datagram");
   }
 }
@@ -67,6 +78,14 @@ void Frame::insert_frag(const Datagram & datagram)
 {
   validate_datagram(datagram);
 
+  if (datagram.is_parity()) {
+    auto & parity = parity_[datagram.frag_id - frags_.size()];
+    if (not parity) {
+      parity = datagram.payload;
+    }
+    return;
+  }
+
   // insert only if the datagram does not exist yet
   if (not frags_[datagram.frag_id]) {
     frame_size_ += datagram.payload.size();
@@ -79,6 +98,14 @@ void Frame::insert_frag(Datagram && datagram)
 {
   validate_datagram(datagram);
 
+  if (datagram.is_parity()) {
+    auto & parity = parity_[datagram.frag_id - frags_.size()];
+    if (not parity) {
+      parity = move(datagram.payload);
+    }
+    return;
+  }
+
   // insert only if the datagram does not exist yet
   if (not frags_[datagram.frag_id]) {
     frame_size_ += datagram.payload.size();
@@ -87,14 +114,108 @@ void Frame::insert_frag(Datagram && datagram)
   }
 }
 
+vector<uint16_t> Frame::recover(const uint16_t frag_id)
+{
+  if (parity_.empty() or complete()) {
+    return {};
+  }
+
+  const unsigned frag_cnt = frags_.size();
+  const unsigned group = (frag_id < frag_cnt ? frag_id : frag_id - frag_cnt)
+                         % fec_groups_;
+
+  // the group's data fragments, in column order
+  vector<uint16_t> ids;
+  for (unsigned i = group; i < frag_cnt; i += fec_groups_) {
+    ids.push_back(i);
+  }
+
+  vector<FecSymbol> symbols;
+  symbols.reserve(ids.size()); // 'data' points into it
+  vector<const FecSymbol *> data;
+  unsigned int num_lost = 0;
+
+  for (const auto id : ids) {
+    if (frags_[id]) {
+      symbols.push_back({frags_[id]->payload, frags_[id]->stripe_id});
+      data.push_back(&symbols.back());
+    } else {
+      data.push_back(nullptr);
+      num_lost++;
+    }
+  }
+
+  vector<pair<unsigned, string_view>> parity;
+  for (unsigned p = group; p < parity_.size(); p += fec_groups_) {
+    if (parity_[p]) {
+      parity.emplace_back(p / fec_groups_, *parity_[p]);
+    }
+  }
+
+  if (num_lost == 0 or parity.size() < num_lost) {
+    return {};
+  }
+
+  auto rebuilt = fec_decode(data, parity);
+  if (not rebuilt) {
+    return {};
+  }
+
+  vector<uint16_t> recovered;
+  for (auto & symbol : *rebuilt) {
+    if (symbol.stripe_id >= stripe_cnt_) {
+      continue; // inconsistent parity
+    }
+
+    Datagram datagram(id_, type_, ids[symbol.col], frag_cnt, capture_ts_, {},
+                      symbol.stripe_id, stripe_cnt_);
+    datagram.fec_cnt = parity_.size();
+    datagram.fec_groups = fec_groups_;
+    datagram.payload = move(symbol.payload);
+
+    recovered.push_back(datagram.frag_id);
+    insert_frag(move(datagram));
+  }
+
+  return recovered;
+}
+
+double LatencyStats::add(const uint64_t capture_ts, const uint64_t now_ts)
+{
+  // unknown, or the clocks are too far apart to make sense of it
+  if (capture_ts == 0 or now_ts < capture_ts) {
+    return 0.0;
+  }
+
+  const double latency_ms = (now_ts - capture_ts) / 1000.0;
+
+  num_frames++;
+  total_ms += latency_ms;
+  max_ms = max(max_ms, latency_ms);
+
+  return latency_ms;
+}
+
+void LatencyStats::output(const string & label) const
+{
+  if (num_frames > 0) {
+    cerr << "  - Avg/Max " << label << " latency (ms): "
+         << double_to_string(total_ms / num_frames)
+         << "/" << double_to_string(max_ms) << endl;
+  }
+}
+
 Decoder::Decoder(const uint16_t display_width,
                  const uint16_t display_height,
                  const int lazy_level,
                  const uint16_t frame_rate,
-                 const string & output_path)
+                 const string & output_path,
+                 const bool y4m_direct_io,
+                 const size_t y4m_prealloc_bytes,
+                 const SegmentLimits & segments)
   : display_width_(display_width), display_height_(display_height),
     lazy_level_(), frame_rate_(frame_rate),
-    output_fd_(), decoder_epoch_(steady_clock::now())
+    output_fd_(), segments_(segments), decoder_epoch_(steady_clock::now())
 {
   // validate lazy level
   if (lazy_level < DECODE_DISPLAY or lazy_level > NO_DECODE_DISPLAY) {
@@ -113,16 +234,43 @@ Decoder::Decoder(const uint16_t display_width,
 
   // start the worker thread only if we are going to decode or display frames
   if (lazy_level <= DECODE_ONLY) {
+    // Yuxin: generate a timestamp-based filename for the Y4M file
+    const auto now = chrono::system_clock::now();
+    const auto now_time_t = chrono::system_clock::to_time_t(now);
+    const auto now_tm = *localtime(&now_time_t);
+
+    char y4m_filename[64];
+    strftime(y4m_filename, sizeof(y4m_filename), "./data/output_%Y%m%d_%H%M%S.y4m", &now_tm);
+
+    // decoded frames are written on a thread of their own; up to a second
+    // of them may wait for a slow disk before frames are dropped
+    y4m_writer_ = make_unique<Y4MWriter>(
+        y4m_filename, display_width_, display_height_, frame_rate_,
+        max<size_t>(4, frame_rate_), y4m_direct_io, y4m_prealloc_bytes,
+        true, segments_);
+
     worker_ = thread(&Decoder::worker_main, this);
     cerr << "Spawned a new thread for decoding and displaying frames" << endl;
   }
 }
 
+void Decoder::store_to(const string & ivf_path)
+{
+  ivf_writer_ = make_unique<IVFWriter>(ivf_path, "VP90", display_width_,
+                                       display_height_, frame_rate_,
+                                       segments_);
+  cerr << "Storing the compressed stream to " << ivf_path << endl;
+}
+
 bool Decoder::add_datagram_common(const Datagram & datagram)
 {
   const auto frame_id = datagram.frame_id;
   const auto frame_type = datagram.frame_type;
   const auto frag_cnt = datagram.frag_cnt;
+  const auto capture_ts = datagram.capture_ts;
+  const auto stripe_cnt = datagram.stripe_cnt;
+  const auto fec_cnt = datagram.fec_cnt;
+  const auto fec_groups = datagram.fec_groups;
 
   // ignore any datagrams from the old frames
   if (frame_id < next_frame_) {
@@ -133,7 +281,9 @@ bool Decoder::add_datagram_common(const Datagram & datagram)
     // initialize a Frame instance for frame 'frame_id'
     frame_buf_.emplace(piecewise_construct,
                        forward_as_tuple(frame_id),
-                       forward_as_tuple(frame_id, frame_type, frag_cnt));
+                       forward_as_tuple(frame_id, frame_type, frag_cnt,
+                                        capture_ts, stripe_cnt,
+                                        fec_cnt, fec_groups));
   }
 
   return true;
@@ -146,7 +296,9 @@ void Decoder::add_datagram(const Datagram & datagram)
   }
 
   // copy the fragment into the frame
-  frame_buf_.at(datagram.frame_id).insert_frag(datagram);
+  Frame & frame = frame_buf_.at(datagram.frame_id);
+  frame.insert_frag(datagram);
+  recover_frags(frame, datagram.frag_id);
 }
 
 void Decoder::add_datagram(Datagram && datagram)
@@ -156,7 +308,30 @@ void Decoder::add_datagram(Datagram && datagram)
   }
 
   // move the fragment into the frame
-  frame_buf_.at(datagram.frame_id).insert_frag(move(datagram));
+  const auto frag_id = datagram.frag_id;
+  Frame & frame = frame_buf_.at(datagram.frame_id);
+  frame.insert_frag(move(datagram));
+  recover_frags(frame, frag_id);
+}
+
+void Decoder::recover_frags(Frame & frame, const uint16_t frag_id)
+{
+  for (const auto id : frame.recover(frag_id)) {
+    recovered_.emplace_back(frame.id(), id);
+    num_recovered_frags_++;
+
+    if (verbose_) {
+      cerr << "Recovered datagram: frame_id=" << frame.id()
+           << " frag_id=" << id << endl;
+    }
+  }
+}
+
+vector<SeqNum> Decoder::take_recovered()
+{
+  vector<SeqNum> recovered;
+  recovered.swap(recovered_);
+  return recovered;
 }
 
 bool Decoder::next_frame_complete()
@@ -204,6 +379,9 @@ void Decoder::consume_next_frame()
   const size_t frame_size = frame.frame_size().value();
   total_decodable_frame_size_ += frame_size;
 
+  const auto frame_decodable_ts = timestamp_us();
+  decodable_latency_.add(frame.capture_ts(), frame_decodable_ts);
+
   const auto stats_now = steady_clock::now();
   while (stats_now >= last_stats_time_ + 1s) {
     cerr << "Decodable frames in the last ~1s: "
@@ -223,12 +401,38 @@ void Decoder::consume_next_frame()
       pending_bitrate_.reset();
     }
 
+    decodable_latency_.output("capture to decodable");
+
+    if (num_recovered_frags_ > 0) {
+      cerr << "  - Fragments recovered by FEC: " << num_recovered_frags_ << endl;
+    }
+
     // reset stats
     num_decodable_frames_ = 0;
+    num_recovered_frags_ = 0;
     total_decodable_frame_size_ = 0;
+    decodable_latency_.reset();
     last_stats_time_ += 1s;
   }
 
+  if (ivf_writer_ and frame.stripe_cnt() > 1) {
+    cerr << "Cannot store a stream of " << int(frame.stripe_cnt())
+         << " stripes to IVF; stopped storing" << endl;
+    ivf_writer_.reset();
+  }
+
+  if (ivf_writer_) {
+    // frame IDs as timestamps keep the gaps left by skipped frames
+    vector<string_view> payloads;
+    payloads.reserve(frame.frags().size());
+    for (const auto & datagram : frame.frags()) {
+      payloads.emplace_back(datagram.value().payload);
+    }
+
+    ivf_writer_->write_frame(payloads, frame.id(),
+                             frame.type() == FrameType::KEY, frame.capture_ts());
+  }
+
   if (lazy_level_ <= DECODE_ONLY) {
     // dispatch the frame to worker thread
     {
@@ -241,11 +445,10 @@ void Decoder::consume_next_frame()
   } else {
     // main thread outputs frame information if no worker thread
     if (output_fd_) {
-      const auto frame_decodable_ts = timestamp_us();
-
       output_fd_->write(to_string(next_frame_) + "," +
                         to_string(frame_size) + "," +
-                        to_string(frame_decodable_ts) + "\n");
+                        to_string(frame_decodable_ts) + "," +
+                        to_string(frame.capture_ts()) + "\n");
     }
   }
 
@@ -272,62 +475,139 @@ void Decoder::clean_up_to(const uint32_t frontier)
   }
 }
 
-double Decoder::decode_frame(vpx_codec_ctx_t & context, const Frame & frame)
+void Decoder::init_stripe_decoders(StripeDecoders & decoders,
+                                   const unsigned stripe_cnt)
+{
+  destroy_stripe_decoders(decoders);
+
+  // the stripes share the decoder threads, one at least each
+  const unsigned int max_threads = max(1, min(get_nprocs(), 4) / int(stripe_cnt));
+
+  decoders.contexts.resize(stripe_cnt);
+  decoders.bufs.resize(stripe_cnt);
+
+  for (unsigned i = 0; i < stripe_cnt; i++) {
+    const StripeRows rows = stripe_rows(display_height_, stripe_cnt, i);
+    vpx_codec_dec_cfg_t cfg {max_threads, display_width_, rows.height};
+
+    check_call(vpx_codec_dec_init(&decoders.contexts[i], &vpx_codec_vp9_dx_algo,
+                                  &cfg, 0),
+               VPX_CODEC_OK, "vpx_codec_dec_init");
+  }
+
+  if (stripe_cnt > 1) {
+    // the worker thread decodes a stripe too
+    decoders.pool = make_unique<WorkerPool>(stripe_cnt - 1);
+    decoders.composed = make_unique<RawImage>(display_width_, display_height_);
+  }
+
+  cerr << "[worker] Initialized decoder (stripes: " << stripe_cnt
+       << ", max threads: " << max_threads << ")" << endl;
+}
+
+void Decoder::destroy_stripe_decoders(StripeDecoders & decoders)
+{
+  for (auto & context : decoders.contexts) {
+    check_call(vpx_codec_destroy(&context), VPX_CODEC_OK, "vpx_codec_destroy");
+  }
+
+  decoders = StripeDecoders();
+}
+
+double Decoder::decode_frame(StripeDecoders & decoders, const Frame & frame)
 {
   if (not frame.complete()) {
     throw runtime_error("frame must be complete before decoding");
   }
 
-  // allocate a decoding buffer once
-  static constexpr size_t MAX_DECODING_BUF = 1000000; // 1 MB
-  static vector<uint8_t> decode_buf(MAX_DECODING_BUF);
+  // the sender started (or stopped) splitting frames into stripes
+  if (frame.stripe_cnt() != decoders.contexts.size()) {
+    init_stripe_decoders(decoders, frame.stripe_cnt());
+  }
 
-  // copy the payload of the frame's datagrams to 'decode_buf'
-  uint8_t * buf_ptr = decode_buf.data();
-  const uint8_t * const buf_end = buf_ptr + decode_buf.size();
+  // gather the payloads of each stripe's datagrams, which are in order
+  static constexpr size_t MAX_DECODING_BUF = 1000000; // 1 MB
+  for (auto & buf : decoders.bufs) {
+    buf.clear();
+  }
 
   for (const auto & datagram : frame.frags()) {
     const string & payload = datagram.value().payload;
+    auto & buf = decoders.bufs.at(datagram.value().stripe_id);
 
-    if (buf_ptr + payload.size() >= buf_end) {
+    if (buf.size() + payload.size() >= MAX_DECODING_BUF) {
       throw runtime_error("frame size exceeds max decoding buffer size");
     }
 
-    memcpy(buf_ptr, payload.data(), payload.size());
-    buf_ptr += payload.size();
+    buf.insert(buf.end(), payload.begin(), payload.end());
   }
 
-  const size_t frame_size = buf_ptr - decode_buf.data();
-
-  // decode the compressed frame in 'decode_buf'
+  // decode the compressed stripes, in parallel if more than one
   const auto decode_start = steady_clock::now();
-  check_call(vpx_codec_decode(&context, decode_buf.data(), frame_size,
-                              nullptr, 1),
-             VPX_CODEC_OK, "failed to decode a frame");
+
+  auto decode_stripe = [&](const size_t i) {
+    check_call(vpx_codec_decode(&decoders.contexts[i], decoders.bufs[i].data(),
+                                decoders.bufs[i].size(), nullptr, 1),
+               VPX_CODEC_OK, "failed to decode a frame");
+  };
+
+  if (decoders.pool) {
+    decoders.pool->run(decoders.contexts.size(), decode_stripe);
+  } else {
+    decode_stripe(0);
+  }
+
   const auto decode_end = steady_clock::now();
 
   return duration<double, milli>(decode_end - decode_start).count();
 }
 
-void Decoder::display_decoded_frame(vpx_codec_ctx_t & context,
-                                    VideoDisplay & display)
+vpx_image * Decoder::get_decoded_frame(StripeDecoders & decoders)
 {
-  vpx_codec_iter_t iter = nullptr;
-  vpx_image * raw_img;
-  unsigned int frame_decoded = 0;
-
-  // display the decoded frame stored in 'context_'
-  while ((raw_img = vpx_codec_get_frame(&context, &iter))) {
-    frame_decoded++;
+  auto get_frame = [](vpx_codec_ctx_t & context) {
+    vpx_codec_iter_t iter = nullptr;
+    vpx_image * const raw_img = vpx_codec_get_frame(&context, &iter);
 
     // there should be exactly one frame decoded
-    if (frame_decoded > 1) {
+    if (raw_img and vpx_codec_get_frame(&context, &iter)) {
       throw runtime_error("Multiple frames were decoded at once");
     }
 
-    // construct a temporary RawImage that does not own the raw_img
-    display.show_frame(RawImage(raw_img));
+    return raw_img;
+  };
+
+  if (not decoders.composed) {
+    return get_frame(decoders.contexts.at(0));
+  }
+
+  // copy each decoded stripe (I420) to its rows of the composed frame
+  const RawImage & out = *decoders.composed;
+  for (size_t i = 0; i < decoders.contexts.size(); i++) {
+    const vpx_image * const stripe = get_frame(decoders.contexts[i]);
+    if (not stripe) {
+      return nullptr;
+    }
+
+    const StripeRows rows = stripe_rows(display_height_,
+                                        decoders.contexts.size(), i);
+
+    for (unsigned r = 0; r < rows.height; r++) {
+      memcpy(out.y_plane() + (rows.y + r) * out.y_stride(),
+             stripe->planes[VPX_PLANE_Y] + r * stripe->stride[VPX_PLANE_Y],
+             display_width_);
+    }
+
+    for (unsigned r = 0; r < rows.height / 2u; r++) {
+      memcpy(out.u_plane() + (rows.y / 2 + r) * out.u_stride(),
+             stripe->planes[VPX_PLANE_U] + r * stripe->stride[VPX_PLANE_U],
+             display_width_ / 2);
+      memcpy(out.v_plane() + (rows.y / 2 + r) * out.v_stride(),
+             stripe->planes[VPX_PLANE_V] + r * stripe->stride[VPX_PLANE_V],
+             display_width_ / 2);
+    }
   }
+
+  return out.get_vpx_image();
 }
 
 void Decoder::worker_main()
@@ -337,16 +617,8 @@ void Decoder::worker_main()
     return;
   }
 
-  // initialize a VP9 decoding context
-  const unsigned int max_threads = min(get_nprocs(), 4);
-  vpx_codec_dec_cfg_t cfg {max_threads, display_width_, display_height_};
-
-  vpx_codec_ctx_t context;
-  check_call(vpx_codec_dec_init(&context, &vpx_codec_vp9_dx_algo, &cfg, 0),
-             VPX_CODEC_OK, "vpx_codec_dec_init");
-
-  cerr << "[worker] Initialized decoder (max threads: "
-       << max_threads << ")" << endl;
+  // VP9 decoding contexts, initialized for the stripes of the first frame
+  StripeDecoders decoders;
 
   // video display
   unique_ptr<VideoDisplay> display;
@@ -354,30 +626,6 @@ void Decoder::worker_main()
     display = make_unique<VideoDisplay>(display_width_, display_height_);
   }
 
-  // **********************************************************
-  // Yuxin: generate a timestamp-based filename for the Y4M file
-  const auto now = chrono::system_clock::now();
-  const auto now_time_t = chrono::system_clock::to_time_t(now);
-  const auto now_tm = *localtime(&now_time_t);
-
-  char y4m_filename[64];
-  strftime(y4m_filename, sizeof(y4m_filename), "./data/output_%Y%m%d_%H%M%S.y4m", &now_tm);
-
-  // Open the Y4M file
-  ofstream y4m_file(y4m_filename, ios::binary);
-  if (!y4m_file.is_open()) {
-    throw runtime_error("Failed to open Y4M file for writing");
-  }
-
-  // Improvement: set an 8MB buffer for the output file
-  std::vector<char> y4m_buffer(32 * 1024 * 1024); // 8MB buffer
-  y4m_file.rdbuf()->pubsetbuf(y4m_buffer.data(), y4m_buffer.size());
-
-  // Write the Y4M header
-  y4m_file << "YUV4MPEG2 W" << display_width_ << " H" << display_height_
-           << " F" << frame_rate_ << ":1 Ip A128:117\n";
-  // **********************************************************
-
   // local queue of frames
   deque<Frame> local_queue;
 
@@ -385,6 +633,7 @@ void Decoder::worker_main()
   unsigned int num_decoded_frames = 0;
   double total_decode_time_ms = 0.0;
   double max_decode_time_ms = 0.0;
+  LatencyStats decoded_latency; // capture -> decoded
   auto last_stats_time = decoder_epoch_;
 
   while (true) {
@@ -408,41 +657,27 @@ void Decoder::worker_main()
     // now worker can take its time to decode and render the frames kept locally
     while (not local_queue.empty()) {
       const Frame & frame = local_queue.front();
-      const double decode_time_ms = decode_frame(context, frame);
+      const double decode_time_ms = decode_frame(decoders, frame);
 
-      if (output_fd_) {
-        const auto frame_decoded_ts = timestamp_us();
+      const auto frame_decoded_ts = timestamp_us();
+      decoded_latency.add(frame.capture_ts(), frame_decoded_ts);
 
+      if (output_fd_) {
         output_fd_->write(to_string(frame.id()) + "," +
                           to_string(frame.frame_size().value()) + "," +
-                          to_string(frame_decoded_ts) + "\n");
+                          to_string(frame_decoded_ts) + "," +
+                          to_string(frame.capture_ts()) + "\n");
       }
 
-      // **********************************************************
-      // Yuxin: write the decoded frame to the Y4M file
-      vpx_codec_iter_t iter = nullptr;
-      vpx_image * raw_img;
-      while ((raw_img = vpx_codec_get_frame(&context, &iter))) {
-        // Write the Y4M frame header
-        y4m_file << "FRAME\n";
-
-        // Write the YUV data to the Y4M file
-        for (int plane = 0; plane < 3; ++plane) {
-          const uint8_t * data = raw_img->planes[plane];
-          const int stride = raw_img->stride[plane];
-          const int height = (plane == 0) ? raw_img->d_h : (raw_img->d_h + 1) / 2;
-          const int width = (plane == 0) ? raw_img->d_w : (raw_img->d_w + 1) / 2;
-
-          for (int y = 0; y < height; ++y) {
-            y4m_file.write(reinterpret_cast<const char *>(data), width);
-            data += stride;
-          }
-        }
-      }
-      // **********************************************************
+      // Yuxin: write the decoded frame to the Y4M file (asynchronously)
+      vpx_image * const raw_img = get_decoded_frame(decoders);
+      if (raw_img) {
+        y4m_writer_->write(*raw_img, frame.capture_ts());
 
-      if (display) {
-        display_decoded_frame(context, *display);
+        if (display) {
+          // construct a temporary RawImage that does not own the raw_img
+          display->show_frame(RawImage(raw_img));
+        }
       }
 
       local_queue.pop_front();
@@ -461,15 +696,18 @@ void Decoder::worker_main()
         //        << double_to_string(total_decode_time_ms / num_decoded_frames)
         //        << "/" << double_to_string(max_decode_time_ms) << endl;
         // }
+        decoded_latency.output("capture to decoded (worker)");
+        y4m_writer_->output_periodic_stats();
 
         // reset stats
         num_decoded_frames = 0;
         total_decode_time_ms = 0.0;
         max_decode_time_ms = 0.0;
+        decoded_latency.reset();
         last_stats_time += 1s;
       }
     }
   }
 
-  check_call(vpx_codec_destroy(&context), VPX_CODEC_OK, "vpx_codec_destroy");
+  destroy_stripe_decoders(decoders);
 }
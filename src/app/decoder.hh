@@ -7,6 +7,7 @@ extern "C" {
 }
 
 #include <map>
+#include <memory>
 #include <vector>
 #include <deque>
 #include <optional>
@@ -18,6 +19,10 @@ extern "C" {
 #include "protocol.hh"
 #include "sdl.hh"
 #include "file_descriptor.hh"
+#include "y4m_writer.hh"
+#include "ivf.hh"
+#include "image.hh"
+#include "worker_pool.hh"
 
 // decoder's view of a video frame
 class Frame
@@ -25,7 +30,11 @@ class Frame
 public:
   Frame(const uint32_t frame_id,
         const FrameType frame_type,
-        const uint16_t frag_cnt);
+        const uint16_t frag_cnt,
+        const uint64_t capture_ts = 0,
+        const uint8_t stripe_cnt = 1,
+        const uint16_t fec_cnt = 0,
+        const uint16_t fec_groups = 0);
 
   // if the frame has fragment 'frag_id'
   bool has_frag(const uint16_t frag_id) const;
@@ -34,10 +43,14 @@ public:
   Datagram & get_frag(const uint16_t frag_id);
   const Datagram & get_frag(const uint16_t frag_id) const;
 
-  // insert a fragment into the frame
+  // insert a fragment (data or parity) into the frame
   void insert_frag(const Datagram & datagram);
   void insert_frag(Datagram && datagram);
 
+  // rebuild the lost data fragments in the FEC group of fragment 'frag_id'
+  // once enough of its parity has arrived; returns the rebuilt IDs
+  std::vector<uint16_t> recover(const uint16_t frag_id);
+
   // if the frame has received all fragments
   bool complete() const { return null_frags_ == 0; }
   std::optional<size_t> frame_size() const;
@@ -45,6 +58,8 @@ public:
   // accessors
   uint32_t id() const { return id_; }
   FrameType type() const { return type_; }
+  uint64_t capture_ts() const { return capture_ts_; }
+  uint8_t stripe_cnt() const { return stripe_cnt_; }
 
   std::vector<std::optional<Datagram>> & frags() { return frags_; }
   const std::vector<std::optional<Datagram>> & frags() const { return frags_; }
@@ -54,15 +69,39 @@ public:
 private:
   uint32_t id_;    // frame ID
   FrameType type_; // frame type
+  uint64_t capture_ts_; // sender's wall-clock time (us) of capture; 0 if unknown
+  uint8_t stripe_cnt_;  // independently encoded stripes (see stripe_rows())
 
   std::vector<std::optional<Datagram>> frags_; // fragments of this frame
   unsigned int null_frags_; // number of uninitialized fragments
   size_t frame_size_ {0}; // frame size so far
 
+  // parity payloads (see fec.hh) and the groups they protect
+  std::vector<std::optional<std::string>> parity_;
+  uint16_t fec_groups_;
+
   // validate if a datagram belongs to this frame
   void validate_datagram(const Datagram & datagram) const;
 };
 
+// capture-to-now latency of the frames in a stats period; relies on the
+// sender's and receiver's clocks being synchronized (e.g., NTP or PTP)
+struct LatencyStats
+{
+  unsigned int num_frames {0};
+  double total_ms {0.0};
+  double max_ms {0.0};
+
+  // add the latency of a frame captured at 'capture_ts' and return it in
+  // ms; frames without a capture timestamp are ignored (and return 0)
+  double add(const uint64_t capture_ts, const uint64_t now_ts);
+
+  // output average and max as "<avg>/<max>" if any frame was added
+  void output(const std::string & label) const;
+
+  void reset() { *this = LatencyStats(); }
+};
+
 class Decoder
 {
 public:
@@ -76,12 +115,19 @@ public:
           const uint16_t display_height,
           const int lazy_level = 0,
           const uint16_t frame_rate = 30,
-          const std::string & output_path = "");
+          const std::string & output_path = "",
+          const bool y4m_direct_io = false,
+          const size_t y4m_prealloc_bytes = 0,
+          const SegmentLimits & segments = {});
 
   // add a received datagram
   void add_datagram(const Datagram & datagram);
   void add_datagram(Datagram && datagram);
 
+  // fragments rebuilt from parity since the last call, to be acknowledged
+  // as if they had been received
+  std::vector<SeqNum> take_recovered();
+
   // is next frame complete; might skip to a complete key frame ahead
   bool next_frame_complete();
 
@@ -105,6 +151,11 @@ public:
   // mutators
   void set_verbose(const bool verbose) { verbose_ = verbose; }
 
+  // also record every decodable frame, still compressed, to an IVF file
+  // (on the main thread); with NO_DECODE_DISPLAY, this stores the stream
+  // without decoding it; split into segments like the Y4M output
+  void store_to(const std::string & ivf_path);
+
   // forbid copying and moving
   Decoder(const Decoder & other) = delete;
   const Decoder & operator=(const Decoder & other) = delete;
@@ -118,6 +169,9 @@ private:
   LazyLevel lazy_level_;
   uint16_t frame_rate_; // Yuxin: frames per second
   std::optional<FileDescriptor> output_fd_; // only one thread should output
+  SegmentLimits segments_; // of both recordings
+  std::unique_ptr<Y4MWriter> y4m_writer_ {}; // fed by the worker thread
+  std::unique_ptr<IVFWriter> ivf_writer_ {};  // fed by the main thread
   std::chrono::time_point<std::chrono::steady_clock> decoder_epoch_;
 
   // print debugging info
@@ -129,9 +183,14 @@ private:
   // frame ID => class Frame
   std::map<uint32_t, Frame> frame_buf_ {};
 
+  // fragments rebuilt from parity and not yet acknowledged
+  std::vector<SeqNum> recovered_ {};
+
   // performance stats
   unsigned int num_decodable_frames_ {0};
   size_t total_decodable_frame_size_ {0}; // bytes
+  LatencyStats decodable_latency_ {}; // capture -> decodable
+  unsigned int num_recovered_frags_ {0}; // by FEC
   std::chrono::time_point<std::chrono::steady_clock> last_stats_time_ {};
   std::optional<uint32_t> lastest_bitrate_ {}; // kbps
   std::optional<uint32_t> pending_bitrate_ {}; // kbps
@@ -147,15 +206,29 @@ private:
   // common code between the two versions of add_datagram()
   bool add_datagram_common(const Datagram & datagram);
 
+  // try FEC recovery in 'frame' after fragment 'frag_id' arrived
+  void recover_frags(Frame & frame, const uint16_t frag_id);
+
   // advance next frame ID by 'n'
   void advance_next_frame(const unsigned int n = 1);
 
   // clean up states (such as frame_buf_) up to frame 'frontier'
   void clean_up_to(const uint32_t frontier);
 
+  // worker thread: the decoding state of every stripe of a frame
+  struct StripeDecoders
+  {
+    std::vector<vpx_codec_ctx_t> contexts {}; // one per stripe; never moved
+    std::vector<std::vector<uint8_t>> bufs {}; // compressed data per stripe
+    std::unique_ptr<WorkerPool> pool {};       // with more than one stripe
+    std::unique_ptr<RawImage> composed {};     // stripes put back together
+  };
+
   // worker thread calls the functions below
-  double decode_frame(vpx_codec_ctx_t & context, const Frame & frame);
-  void display_decoded_frame(vpx_codec_ctx_t & context, VideoDisplay & display);
+  void init_stripe_decoders(StripeDecoders & decoders, const unsigned stripe_cnt);
+  void destroy_stripe_decoders(StripeDecoders & decoders);
+  double decode_frame(StripeDecoders & decoders, const Frame & frame);
+  vpx_image * get_decoded_frame(StripeDecoders & decoders);
   void worker_main();
 };
 
@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <cmath>
+
+#include "delay_gradient.hh"
+
+using namespace std;
+
+const char * to_string(const BandwidthUsage usage)
+{
+  switch (usage) {
+    case BandwidthUsage::OVERUSE: return "overuse";
+    case BandwidthUsage::UNDERUSE: return "underuse";
+    default: return "normal";
+  }
+}
+
+BandwidthUsage TrendlineEstimator::add(vector<PacketArrival> arrivals)
+{
+  // ACKs may come back out of order; groups are formed in send order
+  sort(arrivals.begin(), arrivals.end(),
+       [](const PacketArrival & a, const PacketArrival & b) {
+         return a.send_ts < b.send_ts;
+       });
+
+  for (const auto & p : arrivals) {
+    if (not curr_group_) {
+      curr_group_ = Group{p.send_ts, p.send_ts, p.recv_ts, p.size};
+      continue;
+    }
+
+    auto & curr = *curr_group_;
+
+    // belongs to a group that is already complete
+    if (p.send_ts < curr.first_send_ts) {
+      continue;
+    }
+
+    // same burst
+    if (p.send_ts - curr.first_send_ts <= BURST_US) {
+      curr.last_send_ts = max(curr.last_send_ts, p.send_ts);
+      curr.last_recv_ts = max(curr.last_recv_ts, p.recv_ts);
+      curr.size += p.size;
+      continue;
+    }
+
+    if (prev_group_) {
+      on_group(*prev_group_, curr);
+    }
+
+    prev_group_ = curr;
+    curr_group_ = Group{p.send_ts, p.send_ts, p.recv_ts, p.size};
+  }
+
+  return state_;
+}
+
+void TrendlineEstimator::on_group(const Group & prev, const Group & curr)
+{
+  // reordered on the path: no meaningful delta
+  if (curr.last_recv_ts < prev.last_recv_ts) {
+    return;
+  }
+
+  const double send_delta_ms = (curr.last_send_ts - prev.last_send_ts) / 1000.0;
+  const double recv_delta_ms = (curr.last_recv_ts - prev.last_recv_ts) / 1000.0;
+
+  num_deltas_ = min(num_deltas_ + 1, MAX_DELTAS);
+  accumulated_delay_ms_ += recv_delta_ms - send_delta_ms;
+  smoothed_delay_ms_ = SMOOTHING * smoothed_delay_ms_
+                       + (1 - SMOOTHING) * accumulated_delay_ms_;
+
+  if (not first_recv_ts_) {
+    first_recv_ts_ = curr.last_recv_ts;
+  }
+
+  history_.emplace_back((curr.last_recv_ts - *first_recv_ts_) / 1000.0,
+                        smoothed_delay_ms_);
+  if (history_.size() > WINDOW) {
+    history_.pop_front();
+  }
+
+  // least-squares slope once the window is full; keep the last one until then
+  if (history_.size() == WINDOW) {
+    double mean_x = 0, mean_y = 0;
+    for (const auto & [x, y] : history_) {
+      mean_x += x;
+      mean_y += y;
+    }
+    mean_x /= history_.size();
+    mean_y /= history_.size();
+
+    double num = 0, den = 0;
+    for (const auto & [x, y] : history_) {
+      num += (x - mean_x) * (y - mean_y);
+      den += (x - mean_x) * (x - mean_x);
+    }
+
+    if (den != 0) {
+      slope_ = num / den;
+    }
+  }
+
+  detect(send_delta_ms, curr.last_recv_ts);
+}
+
+void TrendlineEstimator::detect(const double send_delta_ms, const uint64_t now_us)
+{
+  // the slope is tiny; scale it by how much evidence there is
+  modified_trend_ = num_deltas_ * slope_ * TREND_GAIN;
+
+  if (modified_trend_ > threshold_) {
+    // signal only once the delay kept growing for a while
+    overusing_ms_ = overusing_ms_ ? *overusing_ms_ + send_delta_ms
+                                  : send_delta_ms / 2;
+    overuse_count_++;
+
+    if (*overusing_ms_ > OVERUSE_TIME_MS and overuse_count_ > 1
+        and modified_trend_ >= prev_trend_) {
+      overusing_ms_ = 0.0;
+      overuse_count_ = 0;
+      state_ = BandwidthUsage::OVERUSE;
+    }
+  } else if (modified_trend_ < -threshold_) {
+    overusing_ms_.reset();
+    overuse_count_ = 0;
+    state_ = BandwidthUsage::UNDERUSE;
+  } else {
+    overusing_ms_.reset();
+    overuse_count_ = 0;
+    state_ = BandwidthUsage::NORMAL;
+  }
+
+  prev_trend_ = modified_trend_;
+  update_threshold(now_us);
+}
+
+void TrendlineEstimator::update_threshold(const uint64_t now_us)
+{
+  if (not last_threshold_update_us_) {
+    last_threshold_update_us_ = now_us;
+  }
+
+  const double abs_trend = fabs(modified_trend_);
+
+  // a sudden spike (e.g., a handover) should not drag the threshold along
+  if (abs_trend > threshold_ + 15.0) {
+    last_threshold_update_us_ = now_us;
+    return;
+  }
+
+  // rise slowly so that competing flows are not starved, fall quickly
+  const double k = abs_trend < threshold_ ? K_DOWN : K_UP;
+  const double dt_ms = min((now_us - *last_threshold_update_us_) / 1000.0, 100.0);
+
+  threshold_ += k * (abs_trend - threshold_) * dt_ms;
+  threshold_ = clamp(threshold_, MIN_THRESHOLD, MAX_THRESHOLD);
+  last_threshold_update_us_ = now_us;
+}
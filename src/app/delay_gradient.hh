@@ -0,0 +1,96 @@
+#ifndef DELAY_GRADIENT_HH
+#define DELAY_GRADIENT_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// when a datagram left the sender and reached the receiver, as echoed in
+// its ACK; the two clocks are not synchronized, so only differences
+// between datagrams are meaningful
+struct PacketArrival
+{
+  uint64_t send_ts {0}; // sender clock (us)
+  uint64_t recv_ts {0}; // receiver clock (us)
+  size_t size {0};      // bytes on the wire
+};
+
+enum class BandwidthUsage : uint8_t {
+  NORMAL = 0,
+  OVERUSE = 1,  // queuing delay is growing
+  UNDERUSE = 2, // a queue is draining
+};
+
+const char * to_string(const BandwidthUsage usage);
+
+// Delay-gradient overuse detector after Google Congestion Control.
+// Datagrams sent within a burst are grouped; between consecutive groups,
+// the growth of the one-way delay is the difference of their arrival
+// spacing and send spacing (the clock offset cancels out). A least-squares
+// trendline over the accumulated, smoothed delay of the last groups
+// estimates how fast a queue builds up; compared against an adaptive
+// threshold, this signals overuse long before the queue overflows.
+class TrendlineEstimator
+{
+public:
+  // feed ACKed datagrams in any order; returns the current signal
+  BandwidthUsage add(std::vector<PacketArrival> arrivals);
+
+  BandwidthUsage state() const { return state_; }
+
+  // latest trend (ms of delay growth, scaled) and threshold, for logging
+  double trend() const { return modified_trend_; }
+  double threshold() const { return threshold_; }
+
+private:
+  struct Group
+  {
+    uint64_t first_send_ts {0};
+    uint64_t last_send_ts {0};
+    uint64_t last_recv_ts {0};
+    size_t size {0};
+  };
+
+  std::optional<Group> prev_group_ {};
+  std::optional<Group> curr_group_ {};
+
+  // trendline over (arrival time, smoothed accumulated delay) in ms
+  std::deque<std::pair<double, double>> history_ {};
+  std::optional<uint64_t> first_recv_ts_ {};
+  double accumulated_delay_ms_ {0.0};
+  double smoothed_delay_ms_ {0.0};
+  unsigned int num_deltas_ {0};
+
+  // overuse detection
+  BandwidthUsage state_ {BandwidthUsage::NORMAL};
+  double modified_trend_ {0.0};
+  double prev_trend_ {0.0};
+  double threshold_ {INITIAL_THRESHOLD};
+  std::optional<uint64_t> last_threshold_update_us_ {};
+  double slope_ {0.0};
+  std::optional<double> overusing_ms_ {}; // time spent over the threshold
+  unsigned int overuse_count_ {0};
+
+  static constexpr uint64_t BURST_US = 5000;      // groups span at most this
+  static constexpr size_t WINDOW = 20;            // groups in the trendline
+  static constexpr double SMOOTHING = 0.9;
+  static constexpr double TREND_GAIN = 4.0;
+  static constexpr unsigned int MAX_DELTAS = 60;
+  static constexpr double INITIAL_THRESHOLD = 12.5;
+  static constexpr double MIN_THRESHOLD = 6.0;
+  static constexpr double MAX_THRESHOLD = 600.0;
+  static constexpr double K_UP = 0.0087;          // threshold adaptation
+  static constexpr double K_DOWN = 0.039;
+  static constexpr double OVERUSE_TIME_MS = 10.0;
+
+  // a group is complete: update the trendline with its delay delta
+  void on_group(const Group & prev, const Group & curr);
+
+  void detect(const double send_delta_ms, const uint64_t now_us);
+  void update_threshold(const uint64_t now_us);
+};
+
+#endif /* DELAY_GRADIENT_HH */
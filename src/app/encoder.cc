@@ -6,20 +6,94 @@
 #include <chrono>
 #include <algorithm>
 #include <limits>
+#include <thread>
 
 #include "encoder.hh"
 #include "conversion.hh"
+#include "test_pattern.hh"
 #include "timestamp.hh"
 
 using namespace std;
 using namespace chrono;
 
+EncoderProfile EncoderProfile::resolve(const uint16_t width,
+                                       const uint16_t height,
+                                       const uint16_t frame_rate,
+                                       const unsigned cores) const
+{
+  EncoderProfile profile = *this;
+  const uint64_t pixels = uint64_t(width) * height;
+
+  // threads by resolution (as WebRTC does), as far as there are cores
+  if (profile.threads < 0) {
+    int threads = 1;
+    if (pixels >= 3840 * 2160 and cores > 16) {
+      threads = 16;
+    } else if (pixels >= 1920 * 1080 and cores > 8) {
+      threads = 8;
+    } else if (pixels >= 1280 * 720 and cores > 4) {
+      threads = 4;
+    } else if (pixels >= 640 * 360 and cores > 2) {
+      threads = 2;
+    }
+    profile.threads = threads;
+  }
+
+  // a tile column per thread, but VP9 tiles are at least 256 pixels wide
+  if (profile.tile_columns < 0) {
+    int tile_columns = 0;
+    while ((2 << tile_columns) <= profile.threads and
+           (width >> (tile_columns + 1)) >= 256 and tile_columns < 6) {
+      tile_columns++;
+    }
+    profile.tile_columns = tile_columns;
+  }
+
+  // tall 4:3 frames also get two tile rows, for the decoder's sake
+  if (profile.tile_rows < 0) {
+    profile.tile_rows = height >= 3000 ? 1 : 0;
+  }
+
+  // rows keep the threads busy if there are more threads than tiles
+  if (profile.row_mt < 0) {
+    profile.row_mt = profile.threads > 1 ? 1 : 0;
+  }
+
+  // the more pixels each thread has to encode per second, the faster the
+  // preset needs to be
+  if (profile.cpu_used < 0) {
+    const uint64_t pixel_rate = pixels * frame_rate / profile.threads;
+    if (pixel_rate < 10'000'000) {
+      profile.cpu_used = 6;
+    } else if (pixel_rate < 30'000'000) {
+      profile.cpu_used = 7;
+    } else if (pixel_rate < 60'000'000) {
+      profile.cpu_used = 8;
+    } else {
+      profile.cpu_used = MAX_CPU_USED;
+    }
+  }
+
+  return profile;
+}
+
+string EncoderProfile::str() const
+{
+  return "threads=" + to_string(threads)
+         + " tile_columns=" + to_string(tile_columns)
+         + " tile_rows=" + to_string(tile_rows)
+         + " row_mt=" + to_string(row_mt)
+         + " cpu_used=" + to_string(cpu_used);
+}
+
 Encoder::Encoder(const uint16_t display_width,
                  const uint16_t display_height,
                  const uint16_t frame_rate,
-                 const string & output_path)
+                 const string & output_path,
+                 const unsigned num_stripes,
+                 const EncoderProfile & profile)
   : display_width_(display_width), display_height_(display_height),
-    frame_rate_(frame_rate), output_fd_()
+    frame_rate_(frame_rate), output_fd_(), stripes_(num_stripes)
 {
   // open the output file
   if (not output_path.empty()) {
@@ -27,89 +101,224 @@ Encoder::Encoder(const uint16_t display_width,
         open(output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)));
   }
 
+  if (stripes_.empty()) {
+    throw runtime_error("Encoder: a frame needs at least one stripe");
+  }
+
+  // the stripes share the CPUs
+  const unsigned cores = max<int>(1, get_nprocs() / stripes_.size());
+
+  for (size_t i = 0; i < stripes_.size(); i++) {
+    stripes_[i].rows = stripe_rows(display_height_, stripes_.size(), i);
+  }
+
+  profile_ = profile.resolve(display_width_, stripes_[0].rows.height,
+                             frame_rate_, cores);
+
+  for (auto & stripe : stripes_) {
+    init_stripe(stripe);
+  }
+
+  cerr << "Initialized VP9 encoder (" << profile_.str() << ")" << endl;
+
+  if (stripes_.size() > 1) {
+    // the encoder thread encodes a stripe too
+    stripe_pool_ = make_unique<WorkerPool>(stripes_.size() - 1);
+
+    cerr << "Encoding " << stripes_.size() << " stripes of "
+         << stripes_[0].rows.height << " rows in parallel" << endl;
+  }
+}
+
+void Encoder::init_stripe(Stripe & stripe)
+{
+  vpx_codec_enc_cfg_t & cfg = stripe.cfg;
+
   // populate VP9 configuration with default values
-  check_call(vpx_codec_enc_config_default(&vpx_codec_vp9_cx_algo, &cfg_, 0),
+  check_call(vpx_codec_enc_config_default(&vpx_codec_vp9_cx_algo, &cfg, 0),
              VPX_CODEC_OK, "vpx_codec_enc_config_default");
 
   // copy the configuration below mostly from WebRTC (libvpx_vp9_encoder.cc)
-  cfg_.g_w = display_width_;
-  cfg_.g_h = display_height_;
-  cfg_.g_timebase.num = 1;
-  cfg_.g_timebase.den = frame_rate_; // WebRTC uses a 90 kHz clock
-  cfg_.g_pass = VPX_RC_ONE_PASS;
-  cfg_.g_lag_in_frames = 0; // disable lagged encoding
+  cfg.g_w = display_width_;
+  cfg.g_h = stripe.rows.height;
+  cfg.g_timebase.num = 1;
+  cfg.g_timebase.den = frame_rate_; // WebRTC uses a 90 kHz clock
+  cfg.g_pass = VPX_RC_ONE_PASS;
+  cfg.g_lag_in_frames = 0; // disable lagged encoding
   // WebRTC disables error resilient mode unless for SVC
-  cfg_.g_error_resilient = VPX_ERROR_RESILIENT_DEFAULT;
-  cfg_.g_threads = 4; // encoder threads; should equal to column tiles below
-  cfg_.rc_resize_allowed = 0; // WebRTC enables spatial sampling
-  cfg_.rc_dropframe_thresh = 0; // WebRTC sets to 30 (% of target data buffer)
-  cfg_.rc_buf_initial_sz = 500;
-  cfg_.rc_buf_optimal_sz = 600;
-  cfg_.rc_buf_sz = 1000;
-  cfg_.rc_min_quantizer = 2;
-  cfg_.rc_max_quantizer = 52;
-  cfg_.rc_undershoot_pct = 50;
-  cfg_.rc_overshoot_pct = 50;
+  cfg.g_error_resilient = VPX_ERROR_RESILIENT_DEFAULT;
+  cfg.g_threads = profile_.threads; // at least the column tiles below
+  cfg.rc_resize_allowed = 0; // WebRTC enables spatial sampling
+  cfg.rc_dropframe_thresh = 0; // WebRTC sets to 30 (% of target data buffer)
+  cfg.rc_buf_initial_sz = 500;
+  cfg.rc_buf_optimal_sz = 600;
+  cfg.rc_buf_sz = 1000;
+  cfg.rc_min_quantizer = 2;
+  cfg.rc_max_quantizer = 52;
+  cfg.rc_undershoot_pct = 50;
+  cfg.rc_overshoot_pct = 50;
 
   // prevent libvpx encoder from automatically placing key frames
-  cfg_.kf_mode = VPX_KF_DISABLED;
+  cfg.kf_mode = VPX_KF_DISABLED;
   // WebRTC sets the two values below to 3000 frames (fixed keyframe interval)
-  cfg_.kf_max_dist = numeric_limits<unsigned int>::max();
-  cfg_.kf_min_dist = 0;
-
-  cfg_.rc_end_usage = VPX_CBR;
-  cfg_.rc_target_bitrate = target_bitrate_;
+  cfg.kf_max_dist = numeric_limits<unsigned int>::max();
+  cfg.kf_min_dist = 0;
 
-  // use no more than 16 or the number of avaialble CPUs
-  const unsigned int cpu_used = min(get_nprocs(), 16);
+  cfg.rc_end_usage = VPX_CBR;
+  cfg.rc_target_bitrate = target_bitrate_;
 
   // more encoder settings
-  check_call(vpx_codec_enc_init(&context_, &vpx_codec_vp9_cx_algo, &cfg_, 0),
+  vpx_codec_ctx_t * const context = &stripe.context;
+  check_call(vpx_codec_enc_init(context, &vpx_codec_vp9_cx_algo, &cfg, 0),
              VPX_CODEC_OK, "vpx_codec_enc_init");
 
   // this value affects motion estimation and *dominates* the encoding speed
-  codec_control(&context_, VP8E_SET_CPUUSED, cpu_used);
+  codec_control(context, VP8E_SET_CPUUSED, profile_.cpu_used);
 
   // enable encoder to skip static/low content blocks
-  codec_control(&context_, VP8E_SET_STATIC_THRESHOLD, 1);
+  codec_control(context, VP8E_SET_STATIC_THRESHOLD, 1);
 
   // clamp the max bitrate of a keyframe to 900% of average per-frame bitrate
-  codec_control(&context_, VP8E_SET_MAX_INTRA_BITRATE_PCT, 900);
+  codec_control(context, VP8E_SET_MAX_INTRA_BITRATE_PCT, 900);
 
   // enable encoder to adaptively change QP for each segment within a frame
-  codec_control(&context_, VP9E_SET_AQ_MODE, 3);
+  codec_control(context, VP9E_SET_AQ_MODE, 3);
 
-  // set the number of column tiles in encoding a frame to 2 ** 2 = 4
-  codec_control(&context_, VP9E_SET_TILE_COLUMNS, 2);
+  // set the number of column and row tiles in encoding a frame to
+  // 2 ** tile_columns and 2 ** tile_rows
+  codec_control(context, VP9E_SET_TILE_COLUMNS, profile_.tile_columns);
+  codec_control(context, VP9E_SET_TILE_ROWS, profile_.tile_rows);
 
-  // enable row-based multi-threading
-  codec_control(&context_, VP9E_SET_ROW_MT, 1);
+  // row-based multi-threading
+  codec_control(context, VP9E_SET_ROW_MT, profile_.row_mt);
 
   // disable frame parallel decoding
-  codec_control(&context_, VP9E_SET_FRAME_PARALLEL_DECODING, 0);
+  codec_control(context, VP9E_SET_FRAME_PARALLEL_DECODING, 0);
 
   // enable denoiser (but not on ARM since optimization is pending)
-  codec_control(&context_, VP9E_SET_NOISE_SENSITIVITY, 1);
-
-  cerr << "Initialized VP9 encoder (CPU used: " << cpu_used << ")" << endl;
+  codec_control(context, VP9E_SET_NOISE_SENSITIVITY, 1);
 }
 
 Encoder::~Encoder()
 {
-  if (vpx_codec_destroy(&context_) != VPX_CODEC_OK) {
-    cerr << "~Encoder(): failed to destroy VPX encoder context" << endl;
+  for (auto & stripe : stripes_) {
+    if (vpx_codec_destroy(&stripe.context) != VPX_CODEC_OK) {
+      cerr << "~Encoder(): failed to destroy VPX encoder context" << endl;
+    }
+  }
+}
+
+EncoderProfile Encoder::calibrate(const uint16_t display_width,
+                                  const uint16_t display_height,
+                                  const uint16_t frame_rate,
+                                  const unsigned int bitrate_kbps,
+                                  const unsigned num_stripes,
+                                  const EncoderProfile & profile,
+                                  const double budget_fraction)
+{
+  if (profile.cpu_used >= 0) {
+    return profile;
+  }
+
+  // a second of frames, but at least enough for a 90th percentile
+  const unsigned num_frames = max<unsigned>(frame_rate, 20);
+  const double deadline_ms = budget_fraction * 1000.0 / frame_rate;
+
+  TestPattern pattern(display_width, display_height);
+  RawImage raw_img(display_width, display_height);
+
+  EncoderProfile calibrated = profile;
+  for (int cpu_used = EncoderProfile::MIN_CPU_USED;
+       cpu_used <= EncoderProfile::MAX_CPU_USED; cpu_used++) {
+    calibrated.cpu_used = cpu_used;
+
+    Encoder encoder(display_width, display_height, frame_rate, "",
+                    num_stripes, calibrated);
+    encoder.set_target_bitrate(bitrate_kbps);
+
+    // leave out the key frame
+    pattern.read_frame(raw_img);
+    encoder.compress_frame(raw_img);
+
+    vector<double> encode_times_ms;
+    for (unsigned i = 0; i < num_frames; i++) {
+      pattern.read_frame(raw_img);
+
+      const auto start = steady_clock::now();
+      encoder.compress_frame(raw_img);
+      encode_times_ms.push_back(duration<double, milli>(
+                                steady_clock::now() - start).count());
+
+      // nothing is sent; just recycle the packetized frames
+      encoder.collect_encoded_frames();
+      encoder.send_buf().clear();
+    }
+
+    auto p90 = encode_times_ms.begin() + encode_times_ms.size() * 9 / 10;
+    nth_element(encode_times_ms.begin(), p90, encode_times_ms.end());
+
+    cerr << "Calibration: cpu_used=" << cpu_used << " p90 encoding time (ms): "
+         << double_to_string(*p90) << " (deadline "
+         << double_to_string(deadline_ms) << ")" << endl;
+
+    if (*p90 <= deadline_ms) {
+      break;
+    }
   }
+
+  return calibrated;
 }
 
 void Encoder::compress_frame(const RawImage & raw_img)
 {
-  const auto frame_generation_ts = timestamp_us();
+  // nobody is left to send the frame
+  if (stopping_) {
+    return;
+  }
+
+  // a frame is generated when the camera captured it, if that is known
+  const auto frame_generation_ts = raw_img.capture_ts() ? raw_img.capture_ts()
+                                                         : timestamp_us();
+
+  // apply a target bitrate requested since the last frame
+  const unsigned int bitrate_kbps = pending_bitrate_.exchange(0);
+  if (bitrate_kbps > 0) {
+    target_bitrate_ = bitrate_kbps;
+
+    // each stripe gets a share proportional to its rows
+    for (auto & stripe : stripes_) {
+      stripe.cfg.rc_target_bitrate = max<uint64_t>(
+          1, uint64_t(target_bitrate_) * stripe.rows.height / display_height_);
+      check_call(vpx_codec_enc_config_set(&stripe.context, &stripe.cfg),
+                 VPX_CODEC_OK, "set_target_bitrate");
+    }
+  }
+
+  // under overload, only every frame_skip-th frame is encoded, and it is
+  // shown for that many frame intervals
+  const unsigned frame_skip = speed_controller_ ? speed_controller_->frame_skip() : 1;
+  const uint64_t pts = num_input_frames_++;
+  if (pts % frame_skip != 0) {
+    lock_guard<mutex> lock(stats_mtx_);
+    num_skipped_frames_++;
+    return;
+  }
 
   // encode raw_img into frame 'frame_id_'
-  encode_frame(raw_img);
+  const double encode_time_ms = encode_frame(raw_img, pts, frame_skip);
+
+  if (speed_controller_ and speed_controller_->add_sample(encode_time_ms)) {
+    apply_speed_control();
+  }
 
   // packetize frame 'frame_id_' into datagrams
-  const size_t frame_size = packetize_encoded_frame();
+  EncodedFrame * const free_frame = get_free_frame();
+  if (not free_frame) {
+    return; // stopped while waiting for the I/O thread
+  }
+
+  EncodedFrame & frame = *free_frame;
+  const size_t frame_size = packetize_encoded_frame(frame, frame_generation_ts);
 
   // output frame information
   if (output_fd_) {
@@ -122,114 +331,301 @@ void Encoder::compress_frame(const RawImage & raw_img)
                       to_string(frame_encoded_ts) + "\n");
   }
 
+  // hand the frame to the I/O thread; cannot fail since there are never
+  // more encoded frames than ring slots
+  ready_frames_.push(&frame);
+  encoded_notifier_.signal();
+
   // move onto the next frame
   frame_id_++;
 }
 
-void Encoder::encode_frame(const RawImage & raw_img)
+Encoder::EncodedFrame * Encoder::get_free_frame()
 {
-  if (raw_img.display_width() != display_width_ or
-      raw_img.display_height() != display_height_) {
-    throw runtime_error("Encoder: image dimensions don't match");
-  }
+  EncodedFrame * frame = nullptr;
 
-  // check if a key frame needs to be encoded
-  vpx_enc_frame_flags_t encode_flags = 0; // normal frame
-  if (not unacked_.empty()) {
-    const auto & first_unacked = unacked_.cbegin()->second;
+  while (not free_frames_.pop(frame)) {
+    if (encoded_frames_.size() < MAX_ENCODED_FRAMES) {
+      encoded_frames_.emplace_back(make_unique<EncodedFrame>());
+      return encoded_frames_.back().get();
+    }
+
+    // the I/O thread is far behind (or gone); wait for it to collect a frame
+    if (stopping_) {
+      return nullptr;
+    }
 
-    // give up if first unacked datagram was initially sent MAX_UNACKED_US ago
-    const auto us_since_first_send = timestamp_us() - first_unacked.send_ts;
+    this_thread::sleep_for(1ms);
+  }
+
+  return frame;
+}
 
-    if (us_since_first_send > MAX_UNACKED_US) {
-      encode_flags = VPX_EFLAG_FORCE_KF; // force next frame to be key frame
+void Encoder::collect_encoded_frames()
+{
+  encoded_notifier_.read_count();
 
-      cerr << "* Recovery: gave up retransmissions and forced a key frame "
-           << frame_id_ << endl;
+  EncodedFrame * frame = nullptr;
+  while (ready_frames_.pop(frame)) {
+    if (give_up_on_lost_datagrams()) {
+      awaiting_key_frame_ = true;
+    }
 
+    if (awaiting_key_frame_ and frame->type != FrameType::KEY) {
       if (verbose_) {
-        cerr << "Giving up on lost datagram: frame_id="
-             << first_unacked.frame_id << " frag_id=" << first_unacked.frag_id
-             << " rtx=" << first_unacked.num_rtx
-             << " us_since_first_send=" << us_since_first_send << endl;
+        cerr << "Dropped a frame encoded before the requested key frame: "
+             << "frame_id=" << frame->frame_id << endl;
       }
+    } else {
+      awaiting_key_frame_ = false;
 
-      // clean up
-      send_buf_.clear();
-      unacked_.clear();
+      for (auto & datagram : frame->datagrams) {
+        send_buf_.emplace_back(move(datagram));
+      }
     }
+
+    // recycle the frame
+    frame->datagrams.clear();
+    free_frames_.push(frame);
+  }
+}
+
+bool Encoder::give_up_on_lost_datagrams()
+{
+  if (unacked_.empty()) {
+    return false;
+  }
+
+  const auto & first_unacked = unacked_.cbegin()->second;
+
+  // give up if first unacked datagram was initially sent MAX_UNACKED_US ago
+  const auto us_since_first_send = timestamp_us() - first_unacked.send_ts;
+
+  if (us_since_first_send <= MAX_UNACKED_US) {
+    return false;
+  }
+
+  // force the next frame to be a key frame
+  force_key_frame_ = true;
+
+  cerr << "* Recovery: gave up retransmissions and forced a key frame "
+       << "after frame " << first_unacked.frame_id << endl;
+
+  if (verbose_) {
+    cerr << "Giving up on lost datagram: frame_id="
+         << first_unacked.frame_id << " frag_id=" << first_unacked.frag_id
+         << " rtx=" << first_unacked.num_rtx
+         << " us_since_first_send=" << us_since_first_send << endl;
+  }
+
+  // clean up
+  send_buf_.clear();
+  unacked_.clear();
+
+  return true;
+}
+
+void Encoder::control_speed(const double budget_fraction)
+{
+  speed_controller_ = make_unique<SpeedController>(
+      frame_rate_, budget_fraction, profile_.cpu_used, EncoderProfile::MAX_CPU_USED);
+}
+
+void Encoder::apply_speed_control()
+{
+  const int cpu_used = speed_controller_->cpu_used();
+
+  for (auto & stripe : stripes_) {
+    codec_control(&stripe.context, VP8E_SET_CPUUSED, cpu_used);
+  }
+
+  {
+    lock_guard<mutex> lock(stats_mtx_);
+    profile_.cpu_used = cpu_used;
+  }
+
+  cerr << "* Speed control: p95 encoding time "
+       << double_to_string(speed_controller_->last_p95_ms())
+       << " ms; cpu_used=" << cpu_used << ", encoding 1 in "
+       << speed_controller_->frame_skip() << " frames" << endl;
+}
+
+double Encoder::encode_frame(const RawImage & raw_img, const vpx_codec_pts_t pts,
+                             const unsigned long intervals)
+{
+  if (raw_img.display_width() != display_width_ or
+      raw_img.display_height() != display_height_) {
+    throw runtime_error("Encoder: image dimensions don't match");
+  }
+
+  // check if the I/O thread requested a key frame
+  vpx_enc_frame_flags_t encode_flags = 0; // normal frame
+  if (force_key_frame_.exchange(false)) {
+    encode_flags = VPX_EFLAG_FORCE_KF;
   }
 
   // encode a frame and calculate encoding time
   const auto encode_start = steady_clock::now();
-  check_call(vpx_codec_encode(&context_, raw_img.get_vpx_image(), frame_id_, 1,
-                              encode_flags, VPX_DL_REALTIME),
-             VPX_CODEC_OK, "failed to encode a frame");
+  const vpx_image & img = *raw_img.get_vpx_image();
+
+  if (stripe_pool_) {
+    stripe_pool_->run(stripes_.size(), [&](const size_t i) {
+      encode_stripe(stripes_[i], img, pts, intervals, encode_flags);
+    });
+  } else {
+    encode_stripe(stripes_[0], img, pts, intervals, encode_flags);
+  }
+
   const auto encode_end = steady_clock::now();
   const double encode_time_ms = duration<double, milli>(
                                 encode_end - encode_start).count();
 
   // track stats in the current period
+  lock_guard<mutex> lock(stats_mtx_);
   num_encoded_frames_++;
   total_encode_time_ms_ += encode_time_ms;
   max_encode_time_ms_ = max(max_encode_time_ms_, encode_time_ms);
+
+  return encode_time_ms;
 }
 
-size_t Encoder::packetize_encoded_frame()
+void Encoder::encode_stripe(Stripe & stripe, const vpx_image & img,
+                            const vpx_codec_pts_t pts,
+                            const unsigned long intervals,
+                            const vpx_enc_frame_flags_t encode_flags)
 {
-  // read the encoded frame's "encoder packets" from 'context_'
-  const vpx_codec_cx_pkt_t * encoder_pkt;
-  vpx_codec_iter_t iter = nullptr;
-  unsigned int frames_encoded = 0;
+  // a view of the stripe's rows that shares the planes of 'img'
+  vpx_image view = img;
+  view.h = view.d_h = stripe.rows.height;
+  view.planes[VPX_PLANE_Y] += stripe.rows.y * img.stride[VPX_PLANE_Y];
+  view.planes[VPX_PLANE_U] += stripe.rows.y / 2 * img.stride[VPX_PLANE_U];
+  view.planes[VPX_PLANE_V] += stripe.rows.y / 2 * img.stride[VPX_PLANE_V];
+
+  check_call(vpx_codec_encode(&stripe.context, &view, pts, intervals,
+                              encode_flags, VPX_DL_REALTIME),
+             VPX_CODEC_OK, "failed to encode a frame");
+}
+
+size_t Encoder::packetize_encoded_frame(EncodedFrame & frame,
+                                        const uint64_t capture_ts)
+{
+  frame.frame_id = frame_id_;
+  frame.type = FrameType::KEY; // unless any stripe is not
+  frame.datagrams.clear();
+
+  // with FEC, data payloads leave room for the symbol header in the parity
+  const size_t max_payload = fec_mode_ == FecMode::OFF
+                             ? Datagram::max_payload
+                             : Datagram::max_payload - FEC_SYMBOL_HEADER;
+
+  // the compressed data of each stripe
+  vector<string_view> stripe_data(stripes_.size());
   size_t frame_size = 0;
+  unsigned int frag_cnt_total = 0;
 
-  while ((encoder_pkt = vpx_codec_get_cx_data(&context_, &iter))) {
-    if (encoder_pkt->kind == VPX_CODEC_CX_FRAME_PKT) {
-      frames_encoded++;
+  for (size_t i = 0; i < stripes_.size(); i++) {
+    // read the stripe's "encoder packets" from its context
+    const vpx_codec_cx_pkt_t * encoder_pkt;
+    vpx_codec_iter_t iter = nullptr;
+    unsigned int frames_encoded = 0;
 
-      // there should be exactly one frame encoded
-      if (frames_encoded > 1) {
-        throw runtime_error("Multiple frames were encoded at once");
-      }
+    while ((encoder_pkt = vpx_codec_get_cx_data(&stripes_[i].context, &iter))) {
+      if (encoder_pkt->kind == VPX_CODEC_CX_FRAME_PKT) {
+        frames_encoded++;
 
-      frame_size = encoder_pkt->data.frame.sz;
-      assert(frame_size > 0);
+        // there should be exactly one frame encoded
+        if (frames_encoded > 1) {
+          throw runtime_error("Multiple frames were encoded at once");
+        }
 
-      // read the returned frame type
-      auto frame_type = FrameType::NONKEY;
-      if (encoder_pkt->data.frame.flags & VPX_FRAME_IS_KEY) {
-        frame_type = FrameType::KEY;
+        stripe_data[i] = { static_cast<const char *>(encoder_pkt->data.frame.buf),
+                           encoder_pkt->data.frame.sz };
+        assert(stripe_data[i].size() > 0);
 
-        if (verbose_) {
-          cerr << "Encoded a key frame: frame_id=" << frame_id_ << endl;
+        // read the returned frame type; the stripes are only ever forced
+        // to key frames together
+        if (not (encoder_pkt->data.frame.flags & VPX_FRAME_IS_KEY)) {
+          frame.type = FrameType::NONKEY;
         }
       }
+    }
 
-      // total fragments to divide this frame into
-      const uint16_t frag_cnt = narrow_cast<uint16_t>(
-          frame_size / (Datagram::max_payload + 1) + 1);
+    if (frames_encoded == 0) {
+      frame.type = FrameType::NONKEY;
+      continue;
+    }
 
-      // next address to copy compressed frame data from
-      uint8_t * buf_ptr = static_cast<uint8_t *>(encoder_pkt->data.frame.buf);
-      const uint8_t * const buf_end = buf_ptr + frame_size;
+    // total fragments to divide this stripe into
+    frame_size += stripe_data[i].size();
+    frag_cnt_total += (stripe_data[i].size() + max_payload - 1) / max_payload;
+  }
 
-      for (uint16_t frag_id = 0; frag_id < frag_cnt; frag_id++) {
-        // calculate payload size and construct the payload
-        const size_t payload_size = (frag_id < frag_cnt - 1) ?
-            Datagram::max_payload : buf_end - buf_ptr;
+  if (frame.type == FrameType::KEY and verbose_) {
+    cerr << "Encoded a key frame: frame_id=" << frame_id_ << endl;
+  }
 
-        // enqueue a datagram
-        send_buf_.emplace_back(frame_id_, frame_type, frag_id, frag_cnt,
-          string_view {reinterpret_cast<const char *>(buf_ptr), payload_size});
+  // fragments are numbered across the frame, stripe after stripe
+  const uint16_t frag_cnt = narrow_cast<uint16_t>(frag_cnt_total);
+  const auto stripe_cnt = narrow_cast<uint8_t>(stripes_.size());
+  uint16_t frag_id = 0;
 
-        buf_ptr += payload_size;
-      }
+  const FecParams fec = FecParams::pick(fec_mode_, frag_cnt, fec_protection_);
+  frame.datagrams.reserve(frag_cnt + fec.parity_cnt);
+
+  for (size_t i = 0; i < stripes_.size(); i++) {
+    if (stripe_data[i].empty()) {
+      continue;
     }
+
+    // next address to copy compressed stripe data from
+    const char * buf_ptr = stripe_data[i].data();
+    const char * const buf_end = buf_ptr + stripe_data[i].size();
+
+    do {
+      // calculate payload size and construct the payload
+      const size_t payload_size = min<size_t>(max_payload, buf_end - buf_ptr);
+
+      // enqueue a datagram
+      auto & datagram = frame.datagrams.emplace_back(frame_id_, frame.type,
+        frag_id++, frag_cnt, capture_ts, string_view {buf_ptr, payload_size},
+        narrow_cast<uint8_t>(i), stripe_cnt);
+      datagram.fec_cnt = fec.parity_cnt;
+      datagram.fec_groups = fec.groups;
+
+      buf_ptr += payload_size;
+    } while (buf_ptr < buf_end);
+  }
+
+  if (fec.parity_cnt > 0) {
+    add_parity_frags(frame, fec, capture_ts);
   }
 
   return frame_size;
 }
 
+void Encoder::add_parity_frags(EncodedFrame & frame, const FecParams & fec,
+                               const uint64_t capture_ts)
+{
+  const uint16_t frag_cnt = frame.datagrams.size();
+  const uint8_t stripe_cnt = frame.datagrams.front().stripe_cnt;
+
+  // interleave the data fragments into groups; the views stay valid since
+  // the parity fragments fit in the reserved capacity
+  vector<vector<FecSymbol>> groups(fec.groups);
+  for (uint16_t i = 0; i < frag_cnt; i++) {
+    const auto & datagram = frame.datagrams[i];
+    groups[i % fec.groups].push_back({datagram.payload, datagram.stripe_id});
+  }
+
+  for (uint16_t p = 0; p < fec.parity_cnt; p++) {
+    auto & parity = frame.datagrams.emplace_back(frame_id_, frame.type,
+      frag_cnt + p, frag_cnt, capture_ts, string_view {}, 0, stripe_cnt);
+    parity.fec_cnt = fec.parity_cnt;
+    parity.fec_groups = fec.groups;
+    parity.payload = fec_encode(groups[p % fec.groups], p / fec.groups);
+  }
+}
+
 void Encoder::add_unacked(const Datagram & datagram)
 {
   const auto seq_num = make_pair(datagram.frame_id, datagram.frag_id);
@@ -258,28 +654,42 @@ void Encoder::handle_ack(const shared_ptr<AckMsg> & ack)
 {
   const auto curr_ts = timestamp_us();
 
-  // Feedback from receiver can request RTT sample reset
-  if (ack->carry_info == 1) {
-    reset_rtt_sample_buffer_ = true;
-  }
+  // the receiver rebuilt the datagram from parity rather than received it
+  const bool recovered = ack->send_ts == 0;
 
-  // observed an RTT sample
-  add_rtt_sample(curr_ts - ack->send_ts);
+  if (recovered) {
+    num_recovered_++;
+  } else {
+    // observed an RTT sample (parity is as good a probe as data)
+    add_rtt_sample(curr_ts - ack->send_ts);
+  }
 
   // find the acked datagram in 'unacked_'
   const auto acked_seq_num = make_pair(ack->frame_id, ack->frag_id);
   auto acked_it = unacked_.find(acked_seq_num);
 
   if (acked_it == unacked_.end()) {
-    // do nothing else if ACK is not for an unacked datagram
+    // do nothing else if ACK is not for an unacked datagram; parity never
+    // enters 'unacked_', so it does not count as delivered data either,
+    // which would dilute the loss rate of the data
     return;
   }
 
-  // retransmit all unacked datagrams before the acked one (backward)
+  if (not recovered) {
+    num_acks_++;
+  }
+
+  // retransmit all unacked datagrams before the acked one (backward); a
+  // recovery says nothing about the datagrams before it
   for (auto rit = make_reverse_iterator(acked_it);
-       rit != unacked_.rend(); rit++) {
+       rit != unacked_.rend() and not recovered; rit++) {
     auto & datagram = rit->second;
 
+    // the parity that follows in the same frame may still recover it
+    if (datagram.fec_cnt > 0 and datagram.frame_id == ack->frame_id) {
+      continue;
+    }
+
     // skip if a datagram has been retransmitted MAX_NUM_RTX times
     if (datagram.num_rtx >= MAX_NUM_RTX) {
       continue;
@@ -290,22 +700,66 @@ void Encoder::handle_ack(const shared_ptr<AckMsg> & ack)
         curr_ts - datagram.last_send_ts > ewma_rtt_us_.value()) {
       datagram.num_rtx++;
       datagram.last_send_ts = curr_ts;
+      num_rtx_++;
 
       // retransmissions are more urgent
       send_buf_.emplace_front(datagram);
     }
   }
 
+  if (not recovered) {
+    // one-way delay gradient needs both ends' timestamps
+    if (ack->recv_ts != 0) {
+      arrivals_.push_back({ack->send_ts, ack->recv_ts,
+                           Datagram::HEADER_SIZE + acked_it->second.payload.size()});
+    }
+
+    acked_bytes_ += acked_it->second.payload.size();
+  }
+
   // finally, erase the acked datagram from 'unacked_'
   unacked_.erase(acked_it);
 }
 
-void Encoder::add_rtt_sample(const unsigned int rtt_us)
+AckFeedback Encoder::take_ack_feedback()
+{
+  if (fec_mode_ != FecMode::OFF) {
+    update_fec_protection();
+  }
+
+  AckFeedback feedback;
+  feedback.rtt_samples_us.swap(rtt_sample_array_);
+  feedback.acked_bytes = acked_bytes_;
+  feedback.num_acks = num_acks_;
+  feedback.num_rtx = num_rtx_;
+  feedback.arrivals.swap(arrivals_);
+
+  acked_bytes_ = 0;
+  num_acks_ = 0;
+  num_rtx_ = 0;
+  num_recovered_ = 0;
+
+  return feedback;
+}
+
+void Encoder::update_fec_protection()
 {
-  if (reset_rtt_sample_array_) {
-    rtt_sample_array_.clear();
-    reset_rtt_sample_array_ = false;
+  // lost datagrams were either retransmitted or recovered by the receiver
+  const unsigned int num_lost = num_rtx_ + num_recovered_;
+  const unsigned int num_sent = num_acks_ + num_lost;
+  if (num_sent == 0) {
+    return;
   }
+
+  loss_rate_ = ALPHA * num_lost / num_sent + (1 - ALPHA) * loss_rate_;
+
+  // enough parity for the loss, with a margin for bursts
+  fec_protection_ = clamp(MIN_FEC_PROTECTION + FEC_LOSS_GAIN * loss_rate_,
+                          MIN_FEC_PROTECTION, MAX_FEC_PROTECTION);
+}
+
+void Encoder::add_rtt_sample(const unsigned int rtt_us)
+{
   rtt_sample_array_.push_back(rtt_us);
 
   // min RTT
@@ -323,6 +777,8 @@ void Encoder::add_rtt_sample(const unsigned int rtt_us)
 
 void Encoder::output_periodic_stats()
 {
+  lock_guard<mutex> lock(stats_mtx_);
+
   cerr << "Frames encoded in the last ~1s: " << num_encoded_frames_ << endl;
 
   if (num_encoded_frames_ > 0) {
@@ -331,22 +787,30 @@ void Encoder::output_periodic_stats()
          << "/" << double_to_string(max_encode_time_ms_) << endl;
   }
 
+  if (num_skipped_frames_ > 0) {
+    cerr << "  - Frames skipped to keep up: " << num_skipped_frames_
+         << " (cpu_used=" << profile_.cpu_used << ")" << endl;
+  }
+
   if (min_rtt_us_ and ewma_rtt_us_) {
     cerr << "  - Min/EWMA RTT (ms): " << double_to_string(*min_rtt_us_ / 1000.0)
          << "/" << double_to_string(*ewma_rtt_us_ / 1000.0) << endl;
   }
 
+  if (fec_mode_ != FecMode::OFF) {
+    cerr << "  - FEC protection (%): " << double_to_string(100 * fec_protection_)
+         << " (loss " << double_to_string(100 * loss_rate_) << "%)" << endl;
+  }
+
   // reset all but RTT-related stats
   num_encoded_frames_ = 0;
   total_encode_time_ms_ = 0.0;
   max_encode_time_ms_ = 0.0;
+  num_skipped_frames_ = 0;
 }
 
 void Encoder::set_target_bitrate(const unsigned int bitrate_kbps)
 {
-  target_bitrate_ = bitrate_kbps;
-
-  cfg_.rc_target_bitrate = target_bitrate_;
-  check_call(vpx_codec_enc_config_set(&context_, &cfg_),
-             VPX_CODEC_OK, "set_target_bitrate");
+  // applied by the encoder thread before it encodes the next frame
+  pending_bitrate_ = bitrate_kbps;
 }
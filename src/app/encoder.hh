@@ -6,30 +6,108 @@ extern "C" {
 #include <vpx/vp8cx.h>
 }
 
+#include <atomic>
 #include <deque>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <string>
 #include <vector>
 
 #include "exception.hh"
+#include "fec.hh"
 #include "image.hh"
 #include "protocol.hh"
+#include "rate_controller.hh"
 #include "file_descriptor.hh"
+#include "eventfd.hh"
+#include "spsc_ring.hh"
+#include "speed_controller.hh"
+#include "worker_pool.hh"
+
+// Encoding and transport run on different threads: compress_frame() is
+// called on the encoder thread, which owns the VPX context, while sending,
+// ACKs and retransmissions stay on the I/O thread, which owns send_buf and
+// unacked. Packetized frames pass from one to the other through a
+// lock-free queue, so a frame can be transmitted while the next encodes.
+
+// How a VP9 encoding context uses the CPU. Fields left at -1 are picked by
+// resolve() from the resolution, frame rate and cores available, and any
+// of them can be set from the command line instead.
+struct EncoderProfile
+{
+  int threads {-1};      // encoder threads
+  int tile_columns {-1}; // log2 of the number of tile columns
+  int tile_rows {-1};    // log2 of the number of tile rows
+  int row_mt {-1};       // row-based multi-threading (0 or 1)
+  int cpu_used {-1};     // speed preset (MIN_CPU_USED slowest to MAX_CPU_USED)
+
+  // realtime presets worth considering; slower ones rarely keep up
+  static constexpr int MIN_CPU_USED = 5;
+  static constexpr int MAX_CPU_USED = 9;
+
+  // a copy with every automatic field picked for a context encoding
+  // 'width'x'height' at 'frame_rate' fps on 'cores' cores
+  EncoderProfile resolve(const uint16_t width, const uint16_t height,
+                         const uint16_t frame_rate, const unsigned cores) const;
+
+  // e.g., "threads=4 tile_columns=2 tile_rows=0 row_mt=1 cpu_used=7"
+  std::string str() const;
+};
 
 class Encoder
 {
 public:
-  // initialize a VP9 encoder
+  // initialize a VP9 encoder; with 'num_stripes' > 1, every frame is split
+  // into that many horizontal stripes encoded in parallel by independent
+  // contexts (see stripe_rows()); each context's CPU usage follows
+  // 'profile', resolved for the stripe and its share of the cores
   Encoder(const uint16_t display_width,
           const uint16_t display_height,
           const uint16_t frame_rate,
-          const std::string & output_path = "");
+          const std::string & output_path = "",
+          const unsigned num_stripes = 1,
+          const EncoderProfile & profile = {});
   ~Encoder();
 
-  // encode raw_img and packetize into datagrams
+  // encode a second or so of test pattern frames with each speed preset,
+  // from the slowest, and return 'profile' with the slowest preset whose
+  // 90th percentile encoding time stays within 'budget_fraction' of the
+  // frame interval (or the fastest if none does); 'profile.cpu_used' is
+  // left alone if set
+  static EncoderProfile calibrate(const uint16_t display_width,
+                                  const uint16_t display_height,
+                                  const uint16_t frame_rate,
+                                  const unsigned int bitrate_kbps,
+                                  const unsigned num_stripes,
+                                  const EncoderProfile & profile,
+                                  const double budget_fraction);
+
+  // encoder thread: encode raw_img, packetize it into datagrams and hand
+  // them to the I/O thread (unless the frame is skipped to keep up)
   void compress_frame(const RawImage & raw_img);
 
+  // any thread: drop every frame from now on instead of waiting for the
+  // I/O thread to collect one, so that the encoder thread can be joined
+  // after the I/O thread has stopped
+  void stop() { stopping_ = true; }
+
+  // keep the 95th percentile encoding time within 'budget_fraction' of
+  // the frame interval by switching to faster presets and, as a last
+  // resort, skipping frames (see SpeedController); call before encoding
+  void control_speed(const double budget_fraction);
+
+  // protect every frame with parity fragments (see fec.hh), more of them
+  // as the ACKs show more loss; call before encoding
+  void enable_fec(const FecMode mode) { fec_mode_ = mode; }
+
+  // I/O thread: readable whenever encoded frames are waiting
+  Eventfd & encoded_notifier() { return encoded_notifier_; }
+
+  // I/O thread: move the datagrams of newly encoded frames into send_buf
+  void collect_encoded_frames();
+
   // add a transmitted but unacked datagram (except retransmissions) to unacked
   void add_unacked(const Datagram & datagram);
   void add_unacked(Datagram && datagram);
@@ -37,14 +115,21 @@ public:
   // handle ACK
   void handle_ack(const std::shared_ptr<AckMsg> & ack);
 
+  // I/O thread: RTT samples, acked bytes and retransmissions since the
+  // last call, for rate control
+  AckFeedback take_ack_feedback();
+
   // output stats every second and reset some of them
   void output_periodic_stats();
 
-  // set target bitrate
+  // set target bitrate; safe to call from any thread, and takes effect
+  // from the next frame encoded
   void set_target_bitrate(const unsigned int bitrate_kbps);
 
   // accessors
-  uint32_t frame_id() const { return frame_id_; }
+  uint32_t frame_id() const { return frame_id_; } // encoder thread
+  unsigned num_stripes() const { return stripes_.size(); }
+  const EncoderProfile & profile() const { return profile_; } // resolved
   std::deque<Datagram> & send_buf() { return send_buf_; }
   std::map<SeqNum, Datagram> & unacked() { return unacked_; }
 
@@ -66,19 +151,73 @@ private:
   // print debugging info
   bool verbose_ {false};
 
+  // ===== owned by the encoder thread =====
+
   // current target bitrate
   unsigned int target_bitrate_ {0};
 
-  // VPX encoding configuration and context
-  vpx_codec_enc_cfg_t cfg_ {};
-  vpx_codec_ctx_t context_ {};
+  // VPX encoding configuration and context of each stripe (one stripe
+  // covers the whole frame); never resized, as contexts must not move
+  struct Stripe
+  {
+    StripeRows rows {};
+    vpx_codec_enc_cfg_t cfg {};
+    vpx_codec_ctx_t context {};
+  };
+  std::vector<Stripe> stripes_;
+
+  // encodes the stripes in parallel; only with more than one stripe
+  std::unique_ptr<WorkerPool> stripe_pool_ {};
+
+  // CPU usage of every stripe's context (cpu_used is guarded by
+  // 'stats_mtx_' once encoding starts)
+  EncoderProfile profile_ {};
 
   // frame ID to encode
   uint32_t frame_id_ {0};
 
+  // frames passed to compress_frame(), encoded or skipped; timestamps the
+  // encoded frames so that rate control accounts for skipped ones
+  uint64_t num_input_frames_ {0};
+
+  // adapts the speed preset to the encoding time; if enabled
+  std::unique_ptr<SpeedController> speed_controller_ {};
+
+  // parity fragments added to every frame
+  FecMode fec_mode_ {FecMode::OFF};
+
+  // ===== handoff between the two threads =====
+
+  // a packetized frame in flight from the encoder thread to the I/O thread;
+  // recycled through 'free_frames_' to keep the datagram vector's capacity
+  struct EncodedFrame
+  {
+    uint32_t frame_id {0};
+    FrameType type {FrameType::NONKEY};
+    std::vector<Datagram> datagrams {};
+  };
+
+  static constexpr size_t MAX_ENCODED_FRAMES = 16;
+  std::vector<std::unique_ptr<EncodedFrame>> encoded_frames_ {}; // encoder thread
+  SPSCRing<EncodedFrame *> ready_frames_ {MAX_ENCODED_FRAMES};
+  SPSCRing<EncodedFrame *> free_frames_ {MAX_ENCODED_FRAMES};
+  Eventfd encoded_notifier_ {};
+
+  // requests from the I/O thread, applied before the next frame is encoded
+  std::atomic<bool> force_key_frame_ {false};
+  std::atomic<bool> stopping_ {false};
+  std::atomic<unsigned int> pending_bitrate_ {0};
+  std::atomic<double> fec_protection_ {MIN_FEC_PROTECTION}; // parity / data
+
+  // ===== owned by the I/O thread =====
+
   // queue of datagrams (packetized video frames) to send
   std::deque<Datagram> send_buf_ {};
 
+  // after giving up on lost datagrams, drop encoded frames until the
+  // requested key frame arrives, since the receiver cannot decode them
+  bool awaiting_key_frame_ {false};
+
   // unacked datagrams
   std::map<SeqNum, Datagram> unacked_ {};
 
@@ -86,26 +225,70 @@ private:
   std::optional<unsigned int> min_rtt_us_ {};
   std::optional<double> ewma_rtt_us_ {};
   static constexpr double ALPHA = 0.2;
+  // since the last take_ack_feedback()
   std::vector<unsigned int> rtt_sample_array_ {}; // collected RTT samples
-  bool reset_rtt_sample_array_ {false};           // flag to clear RTT samples on feedback
+  uint64_t acked_bytes_ {0};
+  unsigned int num_acks_ {0};
+  unsigned int num_rtx_ {0};
+  unsigned int num_recovered_ {0}; // by the receiver's FEC
+  std::vector<PacketArrival> arrivals_ {};
+
+  // smoothed fraction of datagrams lost, which sizes the FEC protection
+  double loss_rate_ {0.0};
 
-  // performance stats
+  // performance stats (updated by the encoder thread, output by the I/O one)
+  std::mutex stats_mtx_ {};
   unsigned int num_encoded_frames_ {0};
   double total_encode_time_ms_ {0.0};
   double max_encode_time_ms_ {0.0};
+  unsigned int num_skipped_frames_ {0};
 
   // constants
   static constexpr unsigned int MAX_NUM_RTX = 3;
   static constexpr uint64_t MAX_UNACKED_US = 1000 * 1000; // 1 second
+  static constexpr double MIN_FEC_PROTECTION = 0.05;
+  static constexpr double MAX_FEC_PROTECTION = 0.5;
+  static constexpr double FEC_LOSS_GAIN = 2.0; // protection per loss
 
   // track RTT
   void add_rtt_sample(const unsigned int rtt_us);
 
-  // encode the raw frame stored in 'raw_img'
-  void encode_frame(const RawImage & raw_img);
+  // configure and initialize the context of 'stripe' as in 'profile_'
+  void init_stripe(Stripe & stripe);
+
+  // encode the raw frame stored in 'raw_img', shown at 'pts' for
+  // 'intervals' frame intervals, and return the encoding time in ms
+  double encode_frame(const RawImage & raw_img, const vpx_codec_pts_t pts,
+                      const unsigned long intervals);
+
+  // encode the rows of 'stripe' in 'img' with the stripe's context
+  void encode_stripe(Stripe & stripe, const vpx_image & img,
+                     const vpx_codec_pts_t pts, const unsigned long intervals,
+                     const vpx_enc_frame_flags_t encode_flags);
+
+  // switch every context to the speed controller's preset
+  void apply_speed_control();
+
+  // packetize the just encoded frame (stored in the stripes' contexts) into
+  // 'frame', stripe after stripe, stamping every datagram with
+  // 'capture_ts', followed by its parity fragments; return its size
+  size_t packetize_encoded_frame(EncodedFrame & frame, const uint64_t capture_ts);
+
+  // append the parity of the data fragments in 'frame'
+  void add_parity_frags(EncodedFrame & frame, const FecParams & fec,
+                        const uint64_t capture_ts);
+
+  // I/O thread: update the loss rate and FEC protection from the ACKs
+  void update_fec_protection();
+
+  // encoder thread: a recycled (or new) frame to packetize into; blocks
+  // while the I/O thread holds every frame, and returns null once stop()
+  // has been called
+  EncodedFrame * get_free_frame();
 
-  // packetize the just encoded frame (stored in context_) and return its size
-  size_t packetize_encoded_frame();
+  // I/O thread: give up on datagrams unacked for too long and request a
+  // key frame; return true if it did
+  bool give_up_on_lost_datagrams();
 
   // VPX API wrappers
   template <typename ... Args>
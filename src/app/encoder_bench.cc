@@ -0,0 +1,76 @@
+#include <sys/sysinfo.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "conversion.hh"
+#include "encoder.hh"
+#include "image.hh"
+#include "resolution_tiers.hh"
+#include "test_pattern.hh"
+
+using namespace std;
+using namespace chrono;
+
+namespace {
+
+// encode 'num_frames' test pattern frames and return the frames per second
+// the encoder kept up with
+double encode_fps(const ResolutionTier & tier, const unsigned stripes,
+                  const unsigned num_frames)
+{
+  Encoder encoder(tier.width, tier.height, tier.fps, "", stripes);
+  encoder.set_target_bitrate(tier.bitrate_kbps);
+
+  TestPattern pattern(tier.width, tier.height);
+  RawImage raw_img(tier.width, tier.height);
+
+  // the first frame is a key frame; leave it out
+  pattern.read_frame(raw_img);
+  encoder.compress_frame(raw_img);
+
+  const auto start = steady_clock::now();
+
+  for (unsigned i = 0; i < num_frames; i++) {
+    pattern.read_frame(raw_img);
+    encoder.compress_frame(raw_img);
+
+    // nothing is sent; just recycle the packetized frames
+    encoder.collect_encoded_frames();
+    encoder.send_buf().clear();
+  }
+
+  const double elapsed_s = duration<double>(steady_clock::now() - start).count();
+  return num_frames / elapsed_s;
+}
+
+} // namespace
+
+// frames per second each resolution tier encodes at with 1, 2, 4, ...
+// stripes, to pick --stripes for the sender
+int main(int argc, char * argv[])
+{
+  if (argc > 3) {
+    cerr << "Usage: " << argv[0] << " [frames per run] [max stripes]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const unsigned num_frames = argc > 1 ? strict_stoi(argv[1]) : 60;
+  const unsigned max_stripes = argc > 2 ? strict_stoi(argv[2])
+                               : min<unsigned>(get_nprocs(), MAX_STRIPES);
+
+  cout << "resolution,target_fps,stripes,fps,real_time" << endl;
+
+  for (const auto & tier : RESOLUTION_TIERS) {
+    for (unsigned stripes = 1; stripes <= max_stripes; stripes *= 2) {
+      const double fps = encode_fps(tier, stripes, num_frames);
+
+      cout << tier.width << "x" << tier.height << "," << tier.fps << ","
+           << stripes << "," << double_to_string(fps) << ","
+           << (fps >= tier.fps ? "yes" : "no") << endl;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,514 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define FEC_HAVE_NEON 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FEC_HAVE_X86 1
+#endif
+
+#include "fec.hh"
+
+using namespace std;
+
+namespace {
+
+// GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11d) and
+// generator 2
+struct GaloisTables
+{
+  uint8_t exp[512] {};
+  uint8_t log[256] {};
+
+  // c * x = lo[c][x & 0xf] ^ hi[c][x >> 4], which is what SIMD byte
+  // shuffles can look up 16 or 32 bytes at a time
+  uint8_t lo[256][16] {};
+  uint8_t hi[256][16] {};
+
+  GaloisTables()
+  {
+    unsigned x = 1;
+    for (unsigned i = 0; i < 255; i++) {
+      exp[i] = exp[i + 255] = x;
+      log[x] = i;
+
+      x <<= 1;
+      if (x & 0x100) {
+        x ^= 0x11d;
+      }
+    }
+
+    for (unsigned c = 1; c < 256; c++) {
+      for (unsigned i = 1; i < 16; i++) {
+        lo[c][i] = exp[log[c] + log[i]];
+        hi[c][i] = exp[log[c] + log[i << 4]];
+      }
+    }
+  }
+};
+
+const GaloisTables & gf()
+{
+  static const GaloisTables tables;
+  return tables;
+}
+
+uint8_t gf_mul(const uint8_t a, const uint8_t b)
+{
+  if (a == 0 or b == 0) {
+    return 0;
+  }
+
+  return gf().exp[gf().log[a] + gf().log[b]];
+}
+
+uint8_t gf_inv(const uint8_t a)
+{
+  if (a == 0) {
+    throw runtime_error("GF(256): zero has no inverse");
+  }
+
+  return gf().exp[255 - gf().log[a]];
+}
+
+// multiplies by the constant whose nibble tables are 'lo' and 'hi'
+using MulAddKernel = void (*)(uint8_t * dst, const uint8_t * src,
+                              const uint8_t * lo, const uint8_t * hi,
+                              const size_t len);
+
+// also finishes the bytes left over by the vectorized kernels
+void mul_add_scalar_from(uint8_t * dst, const uint8_t * src,
+                         const uint8_t * lo, const uint8_t * hi,
+                         const size_t begin, const size_t len)
+{
+  for (size_t i = begin; i < len; i++) {
+    dst[i] ^= lo[src[i] & 0x0f] ^ hi[src[i] >> 4];
+  }
+}
+
+void mul_add_scalar(uint8_t * dst, const uint8_t * src,
+                    const uint8_t * lo, const uint8_t * hi, const size_t len)
+{
+  mul_add_scalar_from(dst, src, lo, hi, 0, len);
+}
+
+#ifdef FEC_HAVE_NEON
+void mul_add_neon(uint8_t * dst, const uint8_t * src,
+                  const uint8_t * lo, const uint8_t * hi, const size_t len)
+{
+  const uint8x16_t lo_table = vld1q_u8(lo);
+  const uint8x16_t hi_table = vld1q_u8(hi);
+  const uint8x16_t mask = vdupq_n_u8(0x0f);
+  size_t i = 0;
+
+  for (; i + 16 <= len; i += 16) {
+    const uint8x16_t x = vld1q_u8(src + i);
+    const uint8x16_t product = veorq_u8(vqtbl1q_u8(lo_table, vandq_u8(x, mask)),
+                                        vqtbl1q_u8(hi_table, vshrq_n_u8(x, 4)));
+    vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), product));
+  }
+
+  mul_add_scalar_from(dst, src, lo, hi, i, len);
+}
+#endif
+
+#ifdef FEC_HAVE_X86
+__attribute__((target("ssse3")))
+void mul_add_ssse3(uint8_t * dst, const uint8_t * src,
+                   const uint8_t * lo, const uint8_t * hi, const size_t len)
+{
+  const __m128i lo_table = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lo));
+  const __m128i hi_table = _mm_loadu_si128(reinterpret_cast<const __m128i *>(hi));
+  const __m128i mask = _mm_set1_epi8(0x0f);
+  size_t i = 0;
+
+  for (; i + 16 <= len; i += 16) {
+    const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    const __m128i product = _mm_xor_si128(
+      _mm_shuffle_epi8(lo_table, _mm_and_si128(x, mask)),
+      _mm_shuffle_epi8(hi_table, _mm_and_si128(_mm_srli_epi64(x, 4), mask)));
+
+    __m128i * d = reinterpret_cast<__m128i *>(dst + i);
+    _mm_storeu_si128(d, _mm_xor_si128(_mm_loadu_si128(d), product));
+  }
+
+  mul_add_scalar_from(dst, src, lo, hi, i, len);
+}
+
+// same as SSSE3 with 32 bytes per iteration; the shuffle looks up within
+// each 128-bit lane, so both lanes get a copy of the tables
+__attribute__((target("avx2")))
+void mul_add_avx2(uint8_t * dst, const uint8_t * src,
+                  const uint8_t * lo, const uint8_t * hi, const size_t len)
+{
+  const __m256i lo_table = _mm256_broadcastsi128_si256(
+    _mm_loadu_si128(reinterpret_cast<const __m128i *>(lo)));
+  const __m256i hi_table = _mm256_broadcastsi128_si256(
+    _mm_loadu_si128(reinterpret_cast<const __m128i *>(hi)));
+  const __m256i mask = _mm256_set1_epi8(0x0f);
+  size_t i = 0;
+
+  for (; i + 32 <= len; i += 32) {
+    const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    const __m256i product = _mm256_xor_si256(
+      _mm256_shuffle_epi8(lo_table, _mm256_and_si256(x, mask)),
+      _mm256_shuffle_epi8(hi_table, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask)));
+
+    __m256i * d = reinterpret_cast<__m256i *>(dst + i);
+    _mm256_storeu_si256(d, _mm256_xor_si256(_mm256_loadu_si256(d), product));
+  }
+
+  // the tail runs legacy SSE code, which stalls on dirty upper halves of the
+  // AVX registers (and the compiler leaves them dirty for a tail call)
+  _mm256_zeroupper();
+  mul_add_ssse3(dst + i, src + i, lo, hi, len - i);
+}
+#endif
+
+struct Kernel
+{
+  const char * name;
+  MulAddKernel mul_add;
+};
+
+Kernel select_kernel()
+{
+#if defined(FEC_HAVE_NEON)
+  return {"neon", mul_add_neon};
+#elif defined(FEC_HAVE_X86)
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2")) {
+    return {"avx2", mul_add_avx2};
+  }
+
+  if (__builtin_cpu_supports("ssse3")) {
+    return {"ssse3", mul_add_ssse3};
+  }
+
+  return {"scalar", mul_add_scalar};
+#else
+  return {"scalar", mul_add_scalar};
+#endif
+}
+
+// resolved once on first use
+const Kernel & kernel()
+{
+  static const Kernel selected = select_kernel();
+  return selected;
+}
+
+// every kernel this CPU can run, scalar first
+vector<Kernel> supported_kernels()
+{
+  vector<Kernel> kernels { {"scalar", mul_add_scalar} };
+
+#if defined(FEC_HAVE_NEON)
+  kernels.push_back({"neon", mul_add_neon});
+#elif defined(FEC_HAVE_X86)
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("ssse3")) {
+    kernels.push_back({"ssse3", mul_add_ssse3});
+  }
+
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back({"avx2", mul_add_avx2});
+  }
+#endif
+
+  return kernels;
+}
+
+// a data symbol's length and stripe, as they enter the code
+void symbol_header(const FecSymbol & symbol, uint8_t * header)
+{
+  const size_t len = symbol.payload.size();
+  header[0] = static_cast<uint8_t>(len >> 8);
+  header[1] = static_cast<uint8_t>(len & 0xff);
+  header[2] = symbol.stripe_id;
+}
+
+// dst ^= c * symbol, where the symbol is implicitly zero-padded
+void mul_add_symbol(uint8_t * dst, const FecSymbol & symbol, const uint8_t c)
+{
+  uint8_t header[FEC_SYMBOL_HEADER];
+  symbol_header(symbol, header);
+
+  for (size_t i = 0; i < FEC_SYMBOL_HEADER; i++) {
+    dst[i] ^= gf_mul(c, header[i]);
+  }
+
+  gf256_mul_add(dst + FEC_SYMBOL_HEADER,
+                reinterpret_cast<const uint8_t *>(symbol.payload.data()),
+                c, symbol.payload.size());
+}
+
+// invert the n x n matrix 'm' (row-major) by Gauss-Jordan elimination;
+// false if it is singular
+bool invert(vector<uint8_t> & m, const unsigned n)
+{
+  vector<uint8_t> inv(n * n, 0);
+  for (unsigned i = 0; i < n; i++) {
+    inv[i * n + i] = 1;
+  }
+
+  for (unsigned col = 0; col < n; col++) {
+    // find a pivot and move it onto the diagonal
+    unsigned pivot = col;
+    while (pivot < n and m[pivot * n + col] == 0) {
+      pivot++;
+    }
+
+    if (pivot == n) {
+      return false;
+    }
+
+    if (pivot != col) {
+      for (unsigned k = 0; k < n; k++) {
+        swap(m[pivot * n + k], m[col * n + k]);
+        swap(inv[pivot * n + k], inv[col * n + k]);
+      }
+    }
+
+    // scale the pivot row to 1
+    const uint8_t scale = gf_inv(m[col * n + col]);
+    for (unsigned k = 0; k < n; k++) {
+      m[col * n + k] = gf_mul(m[col * n + k], scale);
+      inv[col * n + k] = gf_mul(inv[col * n + k], scale);
+    }
+
+    // eliminate the column from every other row
+    for (unsigned row = 0; row < n; row++) {
+      const uint8_t factor = m[row * n + col];
+      if (row == col or factor == 0) {
+        continue;
+      }
+
+      for (unsigned k = 0; k < n; k++) {
+        m[row * n + k] ^= gf_mul(factor, m[col * n + k]);
+        inv[row * n + k] ^= gf_mul(factor, inv[col * n + k]);
+      }
+    }
+  }
+
+  m = move(inv);
+  return true;
+}
+
+} // namespace
+
+FecMode parse_fec_mode(const string & name)
+{
+  if (name == "off") {
+    return FecMode::OFF;
+  } else if (name == "xor") {
+    return FecMode::XOR;
+  } else if (name == "rs") {
+    return FecMode::RS;
+  }
+
+  throw runtime_error("unknown FEC mode: " + name);
+}
+
+FecParams FecParams::pick(const FecMode mode, const unsigned data_cnt,
+                          const double protection)
+{
+  FecParams params;
+  if (mode == FecMode::OFF or data_cnt == 0 or protection <= 0) {
+    return params;
+  }
+
+  unsigned groups = 0, parity_cnt = 0;
+
+  if (mode == FecMode::XOR) {
+    // a parity fragment for every 1/protection data fragments
+    const unsigned group_size = clamp<unsigned>(lround(1 / protection), 2,
+                                                FEC_MAX_GROUP);
+    groups = (data_cnt + group_size - 1) / group_size;
+    parity_cnt = groups;
+  } else {
+    groups = (data_cnt + FEC_MAX_GROUP - 1) / FEC_MAX_GROUP;
+    const unsigned group_size = (data_cnt + groups - 1) / groups;
+    const unsigned per_group = clamp<unsigned>(ceil(group_size * protection),
+                                               1, FEC_MAX_PARITY);
+    parity_cnt = groups * per_group;
+  }
+
+  // fragment IDs must still fit
+  if (data_cnt + parity_cnt > UINT16_MAX) {
+    return params;
+  }
+
+  params.parity_cnt = parity_cnt;
+  params.groups = groups;
+  return params;
+}
+
+uint8_t fec_coefficient(const unsigned row, const unsigned col)
+{
+  if (row >= FEC_MAX_PARITY or col >= FEC_MAX_GROUP) {
+    throw runtime_error("FEC coefficient out of range");
+  }
+
+  // Cauchy matrix 1 / (x_row + y_col) with x_row = row and y_col following
+  // all x's, each column scaled by (x_0 + y_col) so that row 0 is all ones
+  const uint8_t y = FEC_MAX_PARITY + col;
+  return gf_mul(y, gf_inv(row ^ y));
+}
+
+void gf256_mul_add(uint8_t * dst, const uint8_t * src, const uint8_t c,
+                   const size_t len)
+{
+  if (c == 0 or len == 0) {
+    return;
+  }
+
+  if (c == 1) {
+    for (size_t i = 0; i < len; i++) {
+      dst[i] ^= src[i];
+    }
+    return;
+  }
+
+  kernel().mul_add(dst, src, gf().lo[c], gf().hi[c], len);
+}
+
+const char * gf256_kernel_name()
+{
+  return kernel().name;
+}
+
+vector<string> gf256_kernel_names()
+{
+  vector<string> names;
+  for (const auto & k : supported_kernels()) {
+    names.emplace_back(k.name);
+  }
+  return names;
+}
+
+void gf256_mul_add_with(const string_view kernel_name, uint8_t * dst,
+                        const uint8_t * src, const uint8_t c, const size_t len)
+{
+  for (const auto & k : supported_kernels()) {
+    if (k.name == kernel_name) {
+      // unlike gf256_mul_add, no shortcut for 0 and 1
+      k.mul_add(dst, src, gf().lo[c], gf().hi[c], len);
+      return;
+    }
+  }
+
+  throw runtime_error("gf256_mul_add: unsupported kernel "
+                      + string(kernel_name));
+}
+
+string fec_encode(const vector<FecSymbol> & data, const unsigned row)
+{
+  size_t len = 0;
+  for (const auto & symbol : data) {
+    len = max(len, FEC_SYMBOL_HEADER + symbol.payload.size());
+  }
+
+  string parity(len, 0);
+  uint8_t * const dst = reinterpret_cast<uint8_t *>(parity.data());
+
+  for (size_t col = 0; col < data.size(); col++) {
+    mul_add_symbol(dst, data[col], fec_coefficient(row, col));
+  }
+
+  return parity;
+}
+
+optional<vector<RecoveredSymbol>> fec_decode(
+    const vector<const FecSymbol *> & data,
+    const vector<pair<unsigned, string_view>> & parity)
+{
+  vector<unsigned> lost;
+  for (unsigned col = 0; col < data.size(); col++) {
+    if (not data[col]) {
+      lost.push_back(col);
+    }
+  }
+
+  const unsigned n = lost.size();
+  if (n == 0) {
+    return vector<RecoveredSymbol>();
+  }
+
+  if (parity.size() < n) {
+    return nullopt;
+  }
+
+  // every symbol fits in the parity
+  const size_t len = parity.front().second.size();
+  if (len < FEC_SYMBOL_HEADER) {
+    return nullopt;
+  }
+
+  for (unsigned i = 0; i < n; i++) {
+    if (parity[i].second.size() != len) {
+      return nullopt;
+    }
+  }
+
+  for (const auto * symbol : data) {
+    if (symbol and FEC_SYMBOL_HEADER + symbol->payload.size() > len) {
+      return nullopt;
+    }
+  }
+
+  // take what the received data contributed out of the first n parities,
+  // leaving only the lost symbols' share
+  vector<string> syndromes;
+  for (unsigned i = 0; i < n; i++) {
+    const auto & [row, payload] = parity[i];
+    syndromes.emplace_back(payload);
+    uint8_t * const dst = reinterpret_cast<uint8_t *>(syndromes.back().data());
+
+    for (unsigned col = 0; col < data.size(); col++) {
+      if (data[col]) {
+        mul_add_symbol(dst, *data[col], fec_coefficient(row, col));
+      }
+    }
+  }
+
+  // syndromes = M * lost symbols; solve with the inverse of M
+  vector<uint8_t> m(n * n);
+  for (unsigned i = 0; i < n; i++) {
+    for (unsigned j = 0; j < n; j++) {
+      m[i * n + j] = fec_coefficient(parity[i].first, lost[j]);
+    }
+  }
+
+  if (not invert(m, n)) {
+    return nullopt;
+  }
+
+  vector<RecoveredSymbol> recovered;
+  string symbol(len, 0);
+  uint8_t * const dst = reinterpret_cast<uint8_t *>(symbol.data());
+
+  for (unsigned j = 0; j < n; j++) {
+    fill(symbol.begin(), symbol.end(), 0);
+
+    for (unsigned i = 0; i < n; i++) {
+      gf256_mul_add(dst, reinterpret_cast<const uint8_t *>(syndromes[i].data()),
+                    m[j * n + i], len);
+    }
+
+    const size_t payload_len = (size_t(dst[0]) << 8) | dst[1];
+    if (FEC_SYMBOL_HEADER + payload_len > len) {
+      return nullopt;
+    }
+
+    recovered.push_back({lost[j], dst[2],
+                         symbol.substr(FEC_SYMBOL_HEADER, payload_len)});
+  }
+
+  return recovered;
+}
@@ -0,0 +1,93 @@
+#ifndef FEC_HH
+#define FEC_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Forward error correction for the fragments of a frame: a systematic
+// erasure code over GF(2^8) whose generator is a Cauchy matrix with its
+// columns scaled so that the first parity row is all ones. Any m parity
+// fragments of a group therefore recover any m lost data fragments of it
+// (Reed-Solomon-like, MDS), and a group with a single parity fragment is
+// plain XOR.
+//
+// A frame's data fragments are interleaved into groups (fragment i belongs
+// to group i % groups), so that a burst of losses is spread over them;
+// parity fragment p protects group p % groups, as parity row p / groups.
+// Each data fragment enters the code as a symbol: its payload length (2
+// bytes) and stripe (1 byte), the payload, and zeros up to the length of
+// the group's longest symbol, which is the length of its parity payloads.
+
+static constexpr unsigned FEC_MAX_GROUP = 64;  // data fragments per group
+static constexpr unsigned FEC_MAX_PARITY = 32; // parity fragments per group
+static constexpr size_t FEC_SYMBOL_HEADER = 3; // length and stripe
+
+enum class FecMode : uint8_t {
+  OFF = 0,
+  XOR = 1, // one parity fragment per group; the group size adapts
+  RS = 2,  // groups of up to FEC_MAX_GROUP; the parity count adapts
+};
+
+FecMode parse_fec_mode(const std::string & name);
+
+// parity fragments and groups protecting 'data_cnt' fragments with at least
+// 'protection' (parity over data, in (0, 1]) overhead
+struct FecParams
+{
+  uint16_t parity_cnt {0};
+  uint16_t groups {0};
+
+  static FecParams pick(const FecMode mode, const unsigned data_cnt,
+                        const double protection);
+};
+
+// coefficient of data column 'col' in parity row 'row'
+uint8_t fec_coefficient(const unsigned row, const unsigned col);
+
+// dst[i] ^= c * src[i] in GF(2^8), with the widest SIMD the CPU supports
+void gf256_mul_add(uint8_t * dst, const uint8_t * src, const uint8_t c,
+                   const size_t len);
+
+// name of the multiply-add kernel picked for this CPU
+const char * gf256_kernel_name();
+
+// names of every multiply-add kernel this CPU can run, "scalar" first
+std::vector<std::string> gf256_kernel_names();
+
+// gf256_mul_add with the named kernel instead of the selected one, to check
+// and time the kernels against each other
+void gf256_mul_add_with(const std::string_view kernel_name, uint8_t * dst,
+                        const uint8_t * src, const uint8_t c,
+                        const size_t len);
+
+// a data fragment as seen by the code
+struct FecSymbol
+{
+  std::string_view payload {};
+  uint8_t stripe_id {0};
+};
+
+// parity row 'row' over the data of a group; as long as its longest symbol
+std::string fec_encode(const std::vector<FecSymbol> & data, const unsigned row);
+
+// a lost data fragment rebuilt from the parity
+struct RecoveredSymbol
+{
+  unsigned col {0};
+  uint8_t stripe_id {0};
+  std::string payload {};
+};
+
+// Recover the lost data of a group: 'data' has one entry per column, null
+// if lost, and 'parity' the received (row, payload) pairs. Returns nullopt
+// if there are fewer parity than lost fragments or they are inconsistent.
+std::optional<std::vector<RecoveredSymbol>> fec_decode(
+    const std::vector<const FecSymbol *> & data,
+    const std::vector<std::pair<unsigned, std::string_view>> & parity);
+
+#endif /* FEC_HH */
@@ -0,0 +1,339 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "conversion.hh"
+#include "fec.hh"
+#include "resolution_tiers.hh"
+
+using namespace std;
+using namespace chrono;
+
+namespace {
+
+// around every vector length's tail (16 and 32 bytes), and a fragment's
+constexpr size_t lengths[] = { 0, 1, 7, 15, 16, 17, 31, 32, 33, 63, 65, 1399,
+                               1401, 4097 };
+
+// pointers a vector load from them would straddle
+constexpr size_t src_offset = 1;
+constexpr size_t dst_offset = 3;
+
+// about Datagram::max_payload at the default MTU, less the symbol header
+constexpr size_t FRAGMENT_PAYLOAD = 1400;
+
+vector<uint8_t> random_bytes(const size_t len, mt19937 & rng)
+{
+  uniform_int_distribution<unsigned> byte(0, 255);
+
+  vector<uint8_t> bytes(len);
+  for (auto & b : bytes) {
+    b = byte(rng);
+  }
+  return bytes;
+}
+
+// multiply-add with 'kernel' and compare it with the scalar kernel, for every
+// coefficient and length; print the first mismatch
+bool check_kernel(const string & kernel, mt19937 & rng)
+{
+  for (const size_t len : lengths) {
+    const vector<uint8_t> src = random_bytes(src_offset + len, rng);
+    const vector<uint8_t> dst = random_bytes(dst_offset + len, rng);
+
+    for (unsigned c = 0; c < 256; c++) {
+      vector<uint8_t> expected = dst, actual = dst;
+
+      gf256_mul_add_with("scalar", expected.data() + dst_offset,
+                         src.data() + src_offset, c, len);
+      gf256_mul_add_with(kernel, actual.data() + dst_offset,
+                         src.data() + src_offset, c, len);
+
+      if (actual != expected) {
+        size_t i = 0;
+        while (actual[i] == expected[i]) {
+          i++;
+        }
+
+        cerr << kernel << ": c = " << c << ", length " << len
+             << " differs from scalar at byte " << i - dst_offset << endl;
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+// GB/s of 'kernel' multiplying-adding a fragment at a time
+double kernel_gb_per_s(const string & kernel)
+{
+  constexpr unsigned NUM_RUNS = 200000;
+
+  vector<uint8_t> src(FRAGMENT_PAYLOAD, 0x5A), dst(FRAGMENT_PAYLOAD, 0);
+
+  const auto start = steady_clock::now();
+
+  for (unsigned i = 0; i < NUM_RUNS; i++) {
+    gf256_mul_add_with(kernel, dst.data(), src.data(), 0x8E + i % 64,
+                       src.size());
+  }
+
+  const double elapsed_s = duration<double>(steady_clock::now() - start).count();
+  return NUM_RUNS * FRAGMENT_PAYLOAD / elapsed_s / 1e9;
+}
+
+// a frame's data fragments and their parity, split into groups as the
+// encoder does
+struct ProtectedFrame
+{
+  FecParams fec;
+  vector<string> payloads {};
+  vector<FecSymbol> symbols {};
+  vector<string> parity {};
+
+  ProtectedFrame(const FecMode mode, const double protection,
+                 vector<string> && frame_payloads, const vector<uint8_t> & stripes)
+    : fec(FecParams::pick(mode, frame_payloads.size(), protection)),
+      payloads(move(frame_payloads))
+  {
+    for (size_t i = 0; i < payloads.size(); i++) {
+      symbols.push_back({payloads[i], stripes[i]});
+    }
+
+    vector<vector<FecSymbol>> groups(fec.groups);
+    for (size_t i = 0; i < symbols.size(); i++) {
+      groups[i % fec.groups].push_back(symbols[i]);
+    }
+
+    for (unsigned p = 0; p < fec.parity_cnt; p++) {
+      parity.push_back(fec_encode(groups[p % fec.groups], p / fec.groups));
+    }
+  }
+};
+
+// decode every group of 'frame' as the receiver does, with the data and
+// parity fragments marked in 'lost' (data first) missing; print the first
+// group recovered wrongly, or not recovered although it had enough parity
+bool check_recovery(const ProtectedFrame & frame, const vector<bool> & lost,
+                    const string & label)
+{
+  const unsigned groups = frame.fec.groups;
+  const size_t data_cnt = frame.symbols.size();
+
+  for (unsigned g = 0; g < groups; g++) {
+    vector<const FecSymbol *> data;
+    vector<size_t> frag_ids;
+    unsigned num_lost = 0;
+
+    for (size_t i = g; i < data_cnt; i += groups) {
+      data.push_back(lost[i] ? nullptr : &frame.symbols[i]);
+      frag_ids.push_back(i);
+      num_lost += lost[i];
+    }
+
+    vector<pair<unsigned, string_view>> parity;
+    for (unsigned p = g; p < frame.fec.parity_cnt; p += groups) {
+      if (not lost[data_cnt + p]) {
+        parity.emplace_back(p / groups, frame.parity[p]);
+      }
+    }
+
+    const auto recovered = fec_decode(data, parity);
+    const string group = label + ", group " + to_string(g) + " ("
+                         + to_string(num_lost) + " lost, "
+                         + to_string(parity.size()) + " parity): ";
+
+    if (num_lost > parity.size()) {
+      if (recovered) {
+        cerr << group << "recovered with too little parity" << endl;
+        return false;
+      }
+      continue;
+    }
+
+    if (not recovered) {
+      cerr << group << "not recovered" << endl;
+      return false;
+    }
+
+    if (recovered->size() != num_lost) {
+      cerr << group << recovered->size() << " fragments recovered" << endl;
+      return false;
+    }
+
+    for (const auto & symbol : *recovered) {
+      if (symbol.col >= data.size() or data[symbol.col]) {
+        cerr << group << "recovered column " << symbol.col
+             << ", which was not lost" << endl;
+        return false;
+      }
+
+      const FecSymbol & original = frame.symbols[frag_ids[symbol.col]];
+      if (symbol.payload != original.payload
+          or symbol.stripe_id != original.stripe_id) {
+        cerr << group << "column " << symbol.col << " recovered wrongly"
+             << endl;
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+// protect a random frame, lose random fragments and recover them
+bool round_trip(const FecMode mode, mt19937 & rng)
+{
+  uniform_int_distribution<size_t> frag_count(1, 300);
+  uniform_int_distribution<size_t> payload_len(1, FRAGMENT_PAYLOAD);
+  uniform_int_distribution<unsigned> stripe(0, 255);
+  uniform_real_distribution<double> protection(0.05, 0.5);
+  uniform_real_distribution<double> loss_rate(0.0, 0.3);
+  uniform_real_distribution<double> unit(0.0, 1.0);
+
+  const size_t data_cnt = frag_count(rng);
+
+  // mostly full fragments, as the encoder cuts them, with uneven ones that
+  // the code must pad and strip
+  vector<string> payloads;
+  vector<uint8_t> stripes;
+  for (size_t i = 0; i < data_cnt; i++) {
+    const size_t len = unit(rng) < 0.5 ? FRAGMENT_PAYLOAD : payload_len(rng);
+    const vector<uint8_t> bytes = random_bytes(len, rng);
+    payloads.emplace_back(bytes.begin(), bytes.end());
+    stripes.push_back(stripe(rng));
+  }
+
+  const ProtectedFrame frame(mode, protection(rng), move(payloads), stripes);
+
+  const double rate = loss_rate(rng);
+  vector<bool> lost(data_cnt + frame.fec.parity_cnt);
+  for (size_t i = 0; i < lost.size(); i++) {
+    lost[i] = unit(rng) < rate;
+  }
+
+  const string label = string(mode == FecMode::XOR ? "xor" : "rs") + " "
+                       + to_string(data_cnt) + "+"
+                       + to_string(frame.fec.parity_cnt) + " in "
+                       + to_string(frame.fec.groups) + " group(s)";
+
+  return check_recovery(frame, lost, label);
+}
+
+// ms to protect a frame of 'tier' at its bitrate with RS at the highest
+// protection the encoder uses, and to recover it after losing as many data
+// fragments of every group as it has parity
+pair<double, double> rs_frame_ms(const ResolutionTier & tier,
+                                 const unsigned num_frames)
+{
+  const size_t frame_bytes = tier.bitrate_kbps * 1000 / 8 / tier.fps;
+  const size_t data_cnt = (frame_bytes + FRAGMENT_PAYLOAD - 1) / FRAGMENT_PAYLOAD;
+
+  vector<string> payloads;
+  for (size_t i = 0; i < data_cnt; i++) {
+    payloads.emplace_back(FRAGMENT_PAYLOAD, static_cast<char>(i * 7 / 5));
+  }
+  const vector<uint8_t> stripes(data_cnt, 0);
+
+  const auto start = steady_clock::now();
+
+  optional<ProtectedFrame> frame;
+  for (unsigned n = 0; n < num_frames; n++) {
+    frame.emplace(FecMode::RS, 0.5, vector<string>(payloads), stripes);
+  }
+
+  const auto encoded = steady_clock::now();
+
+  const unsigned groups = frame->fec.groups;
+  vector<bool> lost(data_cnt + frame->fec.parity_cnt, false);
+  for (size_t i = 0; i < data_cnt; i++) {
+    lost[i] = i / groups < frame->fec.parity_cnt / groups;
+  }
+
+  for (unsigned n = 0; n < num_frames; n++) {
+    if (not check_recovery(*frame, lost, "benchmark")) {
+      throw runtime_error("fec_check: benchmark frame not recovered");
+    }
+  }
+
+  const auto decoded = steady_clock::now();
+
+  return { duration<double, milli>(encoded - start).count() / num_frames,
+           duration<double, milli>(decoded - encoded).count() / num_frames };
+}
+
+} // namespace
+
+// compare every GF(2^8) multiply-add kernel this CPU supports with the scalar
+// one, byte for byte; recover randomly lost fragments through XOR and RS
+// parity; and time RS at each resolution tier's bitrate
+int main(int argc, char * argv[])
+{
+  if (argc > 2) {
+    cerr << "Usage: " << argv[0] << " [round trips per mode]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const unsigned num_rounds = argc > 1 ? strict_stoi(argv[1]) : 1000;
+
+  const vector<string> kernels = gf256_kernel_names();
+
+  cout << "Kernels:";
+  for (const auto & kernel : kernels) {
+    cout << " " << kernel;
+  }
+  cout << " (selected: " << gf256_kernel_name() << ")" << endl;
+
+  mt19937 rng(20240501);
+  unsigned num_failed = 0;
+
+  for (const auto & kernel : kernels) {
+    const bool ok = check_kernel(kernel, rng);
+    cout << kernel << ": " << (ok ? "ok" : "FAILED") << ", "
+         << double_to_string(kernel_gb_per_s(kernel)) << " GB/s" << endl;
+
+    if (not ok) {
+      num_failed++;
+    }
+  }
+
+  for (const FecMode mode : { FecMode::XOR, FecMode::RS }) {
+    unsigned num_passed = 0;
+    for (unsigned i = 0; i < num_rounds; i++) {
+      num_passed += round_trip(mode, rng);
+    }
+
+    cout << (mode == FecMode::XOR ? "xor" : "rs") << ": " << num_passed
+         << "/" << num_rounds << " round trips passed" << endl;
+    num_failed += num_rounds - num_passed;
+  }
+
+  // real time if protecting and recovering a frame leaves most of the frame
+  // interval to capture and encode it
+  cout << "resolution,target_fps,bitrate_kbps,fragments,parity,encode_ms,"
+          "decode_ms,frame_ms,real_time" << endl;
+
+  for (const auto & tier : RESOLUTION_TIERS) {
+    const auto [encode_ms, decode_ms] = rs_frame_ms(tier, 50);
+    const double frame_ms = 1000.0 / tier.fps;
+
+    const size_t frame_bytes = tier.bitrate_kbps * 1000 / 8 / tier.fps;
+    const size_t data_cnt = (frame_bytes + FRAGMENT_PAYLOAD - 1)
+                            / FRAGMENT_PAYLOAD;
+
+    cout << tier.width << "x" << tier.height << "," << tier.fps << ","
+         << tier.bitrate_kbps << "," << data_cnt << ","
+         << FecParams::pick(FecMode::RS, data_cnt, 0.5).parity_cnt << ","
+         << double_to_string(encode_ms, 3) << ","
+         << double_to_string(decode_ms, 3) << ","
+         << double_to_string(frame_ms) << ","
+         << (encode_ms + decode_ms < 0.1 * frame_ms ? "yes" : "no") << endl;
+  }
+
+  return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
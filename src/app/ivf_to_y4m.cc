@@ -0,0 +1,74 @@
+extern "C" {
+#include <vpx/vpx_decoder.h>
+#include <vpx/vp8dx.h>
+}
+
+#include <sys/sysinfo.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+
+#include "exception.hh"
+#include "ivf.hh"
+#include "y4m_writer.hh"
+
+using namespace std;
+
+// decodes a VP9 stream recorded by "video_receiver --store" into Y4M,
+// offline and at full speed
+int main(int argc, char * argv[])
+{
+  if (argc != 3) {
+    cerr << "Usage: " << argv[0] << " <input.ivf> <output.y4m>" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const IVFReader ivf(argv[1]);
+  if (ivf.fourcc() != "VP90") {
+    cerr << "Unsupported codec: " << ivf.fourcc() << endl;
+    return EXIT_FAILURE;
+  }
+
+  cerr << "Decoding " << ivf.num_frames() << " frames of " << ivf.width()
+       << "x" << ivf.height() << " at " << ivf.frame_rate() << " fps" << endl;
+
+  const unsigned int max_threads = min(get_nprocs(), 8);
+  vpx_codec_dec_cfg_t cfg {max_threads, ivf.width(), ivf.height()};
+
+  vpx_codec_ctx_t context;
+  check_call(vpx_codec_dec_init(&context, &vpx_codec_vp9_dx_algo, &cfg, 0),
+             VPX_CODEC_OK, "vpx_codec_dec_init");
+
+  size_t num_decoded = 0;
+
+  {
+    // offline: wait for the disk rather than drop frames
+    Y4MWriter y4m(argv[2], ivf.width(), ivf.height(),
+                  max(1L, lround(ivf.frame_rate())), 8, false, 0, false);
+
+    for (size_t i = 0; i < ivf.num_frames(); i++) {
+      const IVFReader::Frame frame = ivf.frame(i);
+
+      if (vpx_codec_decode(&context,
+                           reinterpret_cast<const uint8_t *>(frame.data.data()),
+                           frame.data.size(), nullptr, 1) != VPX_CODEC_OK) {
+        cerr << "Failed to decode frame " << i << " (timestamp "
+             << frame.timestamp << "): " << vpx_codec_error(&context) << endl;
+        continue;
+      }
+
+      vpx_codec_iter_t iter = nullptr;
+      vpx_image * img;
+      while ((img = vpx_codec_get_frame(&context, &iter))) {
+        y4m.write(*img);
+        num_decoded++;
+      }
+    }
+  } // the writer finishes writing before it is destroyed
+
+  check_call(vpx_codec_destroy(&context), VPX_CODEC_OK, "vpx_codec_destroy");
+
+  cerr << "Wrote " << num_decoded << " frames to " << argv[2] << endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,103 @@
+#include <stdexcept>
+
+#include "mjpeg_decoder.hh"
+
+using namespace std;
+
+MJPEGDecoder::MJPEGDecoder()
+{
+  // the destructor does not run if the constructor throws
+  try {
+    const AVCodec * codec = avcodec_find_decoder(AV_CODEC_ID_MJPEG);
+    if (not codec) {
+      throw runtime_error("MJPEGDecoder: libavcodec has no MJPEG decoder");
+    }
+
+    context_ = avcodec_alloc_context3(codec);
+    packet_ = av_packet_alloc();
+    frame_ = av_frame_alloc();
+    if (not context_ or not packet_ or not frame_) {
+      throw runtime_error("MJPEGDecoder: out of memory");
+    }
+
+    // slice threads decode a frame in parallel without adding frames of delay
+    context_->thread_count = 0; // auto
+    context_->thread_type = FF_THREAD_SLICE;
+    context_->flags |= AV_CODEC_FLAG_LOW_DELAY;
+
+    if (avcodec_open2(context_, codec, nullptr) < 0) {
+      throw runtime_error("MJPEGDecoder: avcodec_open2 failed");
+    }
+  } catch (...) {
+    free_contexts();
+    throw;
+  }
+}
+
+MJPEGDecoder::~MJPEGDecoder()
+{
+  free_contexts();
+}
+
+void MJPEGDecoder::free_contexts()
+{
+  // each of these accepts (and leaves behind) null
+  sws_freeContext(sws_ctx_);
+  sws_ctx_ = nullptr;
+  av_frame_free(&frame_);
+  av_packet_free(&packet_);
+  avcodec_free_context(&context_);
+}
+
+void MJPEGDecoder::decode(const string_view jpeg, RawImage & dst)
+{
+  packet_->data = reinterpret_cast<uint8_t *>(const_cast<char *>(jpeg.data()));
+  packet_->size = static_cast<int>(jpeg.size());
+
+  if (avcodec_send_packet(context_, packet_) < 0) {
+    throw runtime_error("MJPEGDecoder: failed to decode a frame");
+  }
+
+  // MJPEG frames are independent, so every packet yields a frame right away
+  if (avcodec_receive_frame(context_, frame_) < 0) {
+    throw runtime_error("MJPEGDecoder: no frame decoded");
+  }
+
+  if (frame_->width != dst.display_width() or
+      frame_->height != dst.display_height()) {
+    av_frame_unref(frame_);
+    throw runtime_error("MJPEGDecoder: image dimensions don't match");
+  }
+
+  const int dst_format = dst.format() == VPX_IMG_FMT_NV12 ? AV_PIX_FMT_NV12
+                                                          : AV_PIX_FMT_YUV420P;
+
+  if (not sws_ctx_ or frame_->format != sws_src_format_ or
+      dst_format != sws_dst_format_ or frame_->width != sws_width_ or
+      frame_->height != sws_height_) {
+    sws_freeContext(sws_ctx_);
+
+    // same size, so only chroma subsampling and range are converted
+    sws_ctx_ = sws_getContext(
+        frame_->width, frame_->height, static_cast<AVPixelFormat>(frame_->format),
+        frame_->width, frame_->height, static_cast<AVPixelFormat>(dst_format),
+        SWS_POINT, nullptr, nullptr, nullptr);
+    if (not sws_ctx_) {
+      av_frame_unref(frame_);
+      throw runtime_error("MJPEGDecoder: sws_getContext failed");
+    }
+
+    sws_src_format_ = frame_->format;
+    sws_dst_format_ = dst_format;
+    sws_width_ = frame_->width;
+    sws_height_ = frame_->height;
+  }
+
+  uint8_t * const dst_planes[] = { dst.y_plane(), dst.u_plane(), dst.v_plane() };
+  const int dst_strides[] = { dst.y_stride(), dst.u_stride(), dst.v_stride() };
+
+  sws_scale(sws_ctx_, frame_->data, frame_->linesize, 0, frame_->height,
+            dst_planes, dst_strides);
+
+  av_frame_unref(frame_);
+}
@@ -0,0 +1,47 @@
+#ifndef MJPEG_DECODER_HH
+#define MJPEG_DECODER_HH
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libswscale/swscale.h"
+}
+
+#include <string_view>
+
+#include "image.hh"
+
+// decompresses the MJPEG frames of a camera with libavcodec into images the
+// encoder takes; used when the camera cannot deliver raw frames fast enough
+class MJPEGDecoder
+{
+public:
+  MJPEGDecoder();
+  ~MJPEGDecoder();
+
+  // decode one JPEG into 'dst' (I420 or NV12 of the same dimensions)
+  void decode(const std::string_view jpeg, RawImage & dst);
+
+  // forbid copying and moving
+  MJPEGDecoder(const MJPEGDecoder & other) = delete;
+  const MJPEGDecoder & operator=(const MJPEGDecoder & other) = delete;
+  MJPEGDecoder(MJPEGDecoder && other) = delete;
+  MJPEGDecoder & operator=(MJPEGDecoder && other) = delete;
+
+private:
+  AVCodecContext * context_ {nullptr};
+  AVPacket * packet_ {nullptr};
+  AVFrame * frame_ {nullptr};
+
+  // converts the decoded (usually full-range 4:2:2) frame into 'dst'; only
+  // rebuilt if the layout of the decoded frames changes
+  SwsContext * sws_ctx_ {nullptr};
+  int sws_src_format_ {-1};
+  int sws_dst_format_ {-1};
+  int sws_width_ {0};
+  int sws_height_ {0};
+
+  // free whatever has been allocated of the above
+  void free_contexts();
+};
+
+#endif /* MJPEG_DECODER_HH */
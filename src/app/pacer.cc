@@ -0,0 +1,60 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "pacer.hh"
+
+using namespace std;
+
+Pacer::Pacer(const double rate_kbps, const size_t burst_bytes)
+  : rate_bytes_per_us_(), burst_bytes_(burst_bytes), tokens_(burst_bytes)
+{
+  if (burst_bytes == 0) {
+    throw runtime_error("Pacer: burst must be positive");
+  }
+
+  set_rate(rate_kbps);
+}
+
+void Pacer::set_rate(const double rate_kbps)
+{
+  if (rate_kbps <= 0) {
+    throw runtime_error("Pacer: rate must be positive");
+  }
+
+  // kbps = 1000 bits per second = 1/8000 bytes per microsecond
+  rate_bytes_per_us_ = rate_kbps / 8000;
+}
+
+void Pacer::refill(const uint64_t now_us)
+{
+  if (last_refill_us_ != 0 and now_us > last_refill_us_) {
+    tokens_ = min(burst_bytes_,
+                  tokens_ + (now_us - last_refill_us_) * rate_bytes_per_us_);
+  }
+
+  last_refill_us_ = max(last_refill_us_, now_us);
+}
+
+uint64_t Pacer::wait_us(const size_t size, const uint64_t now_us,
+                        const size_t pending)
+{
+  refill(now_us);
+
+  // as if 'pending' had been charged by on_sent
+  const double tokens = max(-burst_bytes_, tokens_ - pending);
+
+  // a datagram larger than the burst only needs a full bucket
+  const double needed = min<double>(size, burst_bytes_);
+  if (tokens >= needed) {
+    return 0;
+  }
+
+  return ceil((needed - tokens) / rate_bytes_per_us_);
+}
+
+void Pacer::on_sent(const size_t size, const uint64_t now_us)
+{
+  refill(now_us);
+  tokens_ = max(-burst_bytes_, tokens_ - size);
+}
@@ -0,0 +1,40 @@
+#ifndef PACER_HH
+#define PACER_HH
+
+#include <cstddef>
+#include <cstdint>
+
+// Token bucket that spreads datagrams out at a pacing rate instead of
+// letting a whole frame (or a key frame of hundreds of KB) leave at line
+// rate and overflow shallow router buffers. Tokens (bytes) accrue at the
+// pacing rate up to 'burst_bytes', which is how much may still leave
+// back-to-back after an idle period.
+class Pacer
+{
+public:
+  Pacer(const double rate_kbps, const size_t burst_bytes);
+
+  void set_rate(const double rate_kbps);
+  double rate_kbps() const { return rate_bytes_per_us_ * 8000; }
+
+  // microseconds until a datagram of 'size' bytes may be sent; 0 if now.
+  // 'pending' bytes are about to be sent ahead of it and are not charged
+  // yet (see on_sent)
+  uint64_t wait_us(const size_t size, const uint64_t now_us,
+                   const size_t pending = 0);
+
+  // 'size' bytes were sent at 'now_us'; retransmissions, which are sent
+  // without waiting, may overdraw the bucket by up to one burst, to be
+  // paid back by the datagrams after them
+  void on_sent(const size_t size, const uint64_t now_us);
+
+private:
+  double rate_bytes_per_us_;
+  double burst_bytes_;
+  double tokens_;
+  uint64_t last_refill_us_ {0};
+
+  void refill(const uint64_t now_us);
+};
+
+#endif /* PACER_HH */
@@ -1,5 +1,6 @@
 #include <stdexcept>
 #include "protocol.hh"
+#include "fec.hh"
 #include "serialization.hh"
 
 using namespace std;
@@ -8,11 +9,36 @@ Datagram::Datagram(const uint32_t _frame_id,
                    const FrameType _frame_type,
                    const uint16_t _frag_id,
                    const uint16_t _frag_cnt,
-                   const string_view _payload)
+                   const uint64_t _capture_ts,
+                   const string_view _payload,
+                   const uint8_t _stripe_id,
+                   const uint8_t _stripe_cnt)
   : frame_id(_frame_id), frame_type(_frame_type),
-    frag_id(_frag_id), frag_cnt(_frag_cnt), payload(_payload)
+    frag_id(_frag_id), frag_cnt(_frag_cnt), capture_ts(_capture_ts),
+    stripe_id(_stripe_id), stripe_cnt(_stripe_cnt), payload(_payload)
 {}
 
+StripeRows stripe_rows(const uint16_t height, const unsigned count,
+                       const unsigned index)
+{
+  if (count == 0 or count > MAX_STRIPES or index >= count) {
+    throw runtime_error("invalid stripe " + to_string(index) + " of "
+                        + to_string(count));
+  }
+
+  // whole macroblocks in every stripe but the last
+  const unsigned stripe_height = height / count / 16 * 16;
+  if (stripe_height == 0) {
+    throw runtime_error(to_string(height) + " rows cannot be split into "
+                        + to_string(count) + " stripes");
+  }
+
+  const unsigned y = index * stripe_height;
+  return { static_cast<uint16_t>(y),
+           static_cast<uint16_t>(index == count - 1 ? height - y
+                                                    : stripe_height) };
+}
+
 size_t Datagram::max_payload = 1500 - 28 - Datagram::HEADER_SIZE;
 
 void Datagram::set_mtu(const size_t mtu)
@@ -37,9 +63,27 @@ bool Datagram::parse_from_string(const string & binary)
   frag_id = parser.read_uint16();
   frag_cnt = parser.read_uint16();
   send_ts = parser.read_uint64();
+  capture_ts = parser.read_uint64();
+  stripe_id = parser.read_uint8();
+  stripe_cnt = parser.read_uint8();
+  fec_cnt = parser.read_uint16();
+  fec_groups = parser.read_uint16();
   payload = parser.read_string();
 
-  return true;
+  // a fragment must belong to one of the frame's stripes
+  if (stripe_cnt == 0 or stripe_cnt > MAX_STRIPES or stripe_id >= stripe_cnt) {
+    return false;
+  }
+
+  if (fec_cnt == 0) {
+    return fec_groups == 0 and frag_id < frag_cnt;
+  }
+
+  // every group must be within what the code can protect
+  return fec_groups > 0 and fec_groups <= frag_cnt and
+         frag_id < unsigned(frag_cnt) + fec_cnt and
+         (frag_cnt + fec_groups - 1u) / fec_groups <= FEC_MAX_GROUP and
+         (fec_cnt + fec_groups - 1u) / fec_groups <= FEC_MAX_PARITY;
 }
 
 string Datagram::serialize_to_string() const
@@ -47,12 +91,27 @@ string Datagram::serialize_to_string() const
   string binary;
   binary.reserve(HEADER_SIZE + payload.size());
 
+  binary += serialize_header();
+  binary += payload;
+
+  return binary;
+}
+
+string Datagram::serialize_header() const
+{
+  string binary;
+  binary.reserve(HEADER_SIZE);
+
   binary += put_number(frame_id);
   binary += put_number(static_cast<uint8_t>(frame_type));
   binary += put_number(frag_id);
   binary += put_number(frag_cnt);
   binary += put_number(send_ts);
-  binary += payload;
+  binary += put_number(capture_ts);
+  binary += put_number(stripe_id);
+  binary += put_number(stripe_cnt);
+  binary += put_number(fec_cnt);
+  binary += put_number(fec_groups);
 
   return binary;
 }
@@ -81,6 +140,7 @@ shared_ptr<Msg> Msg::parse_from_string(const string & binary)
     ret->frame_id = parser.read_uint32();
     ret->frag_id = parser.read_uint16();
     ret->send_ts = parser.read_uint64();
+    ret->recv_ts = parser.read_uint64();
     ret->carry_info = parser.read_uint8();
     ret->actual_bitrate = parser.read_uint32();
     return ret;
@@ -98,15 +158,17 @@ shared_ptr<Msg> Msg::parse_from_string(const string & binary)
   }
 }
 
-AckMsg::AckMsg(const Datagram & datagram, uint8_t carry_info, uint32_t actual_bitrate)
+AckMsg::AckMsg(const Datagram & datagram, const uint64_t _recv_ts,
+               uint8_t carry_info, uint32_t actual_bitrate)
   : Msg(Type::ACK), frame_id(datagram.frame_id), frag_id(datagram.frag_id),
-    send_ts(datagram.send_ts), carry_info(carry_info), actual_bitrate(actual_bitrate)
+    send_ts(datagram.send_ts), recv_ts(_recv_ts),
+    carry_info(carry_info), actual_bitrate(actual_bitrate)
 {}
 
 size_t AckMsg::serialized_size() const
 {
   return Msg::serialized_size() + sizeof(uint16_t) + sizeof(uint32_t)
-         + sizeof(uint64_t) + sizeof(uint8_t) + sizeof(uint32_t);
+         + 2 * sizeof(uint64_t) + sizeof(uint8_t) + sizeof(uint32_t);
 }
 
 string AckMsg::serialize_to_string() const
@@ -118,6 +180,7 @@ string AckMsg::serialize_to_string() const
   binary += put_number(frame_id);
   binary += put_number(frag_id);
   binary += put_number(send_ts);
+  binary += put_number(recv_ts);
   binary += put_number(carry_info);
   binary += put_number(actual_bitrate);
 
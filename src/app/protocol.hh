@@ -1,6 +1,7 @@
 #ifndef PROTOCOL_HH
 #define PROTOCOL_HH
 
+#include <cstdint>
 #include <string>
 #include <memory>
 #include <utility>
@@ -14,6 +15,23 @@ enum class FrameType : uint8_t {
 // uses (frame_id, frag_id) as sequence number
 using SeqNum = std::pair<uint32_t, uint16_t>;
 
+// A frame may be split into horizontal stripes that are encoded (and
+// decoded) independently, each by its own VP9 context on its own core.
+// Every stripe but the last is a multiple of 16 rows (whole macroblocks);
+// the last one takes the remaining rows.
+static constexpr unsigned MAX_STRIPES = 16;
+
+struct StripeRows
+{
+  uint16_t y {0};      // first row
+  uint16_t height {0}; // number of rows
+};
+
+// rows of stripe 'index' when a frame 'height' rows tall is split into
+// 'count' stripes; throws if the stripes would be too thin
+StripeRows stripe_rows(const uint16_t height, const unsigned count,
+                       const unsigned index);
+
 struct Datagram
 {
   Datagram() {}
@@ -21,14 +39,22 @@ struct Datagram
            const FrameType _frame_type,
            const uint16_t _frag_id,
            const uint16_t _frag_cnt,
-           const std::string_view _payload);
+           const uint64_t _capture_ts,
+           const std::string_view _payload,
+           const uint8_t _stripe_id = 0,
+           const uint8_t _stripe_cnt = 1);
 
   uint32_t frame_id {};    // frame ID (1)
   FrameType frame_type {}; // frame type (2)
   uint16_t frag_id {};     // fragment ID in this frame (3)
   uint16_t frag_cnt {};    // total fragments in this frame (4)
   uint64_t send_ts {};     // timestamp (us) when the datagram is sent (5)
-  std::string payload {};  // payload (6)
+  uint64_t capture_ts {};  // timestamp (us) when the frame was captured (6)
+  uint8_t stripe_id {};    // stripe of the frame in the payload (7)
+  uint8_t stripe_cnt {1};  // total stripes in this frame (8)
+  uint16_t fec_cnt {};     // parity fragments after the frag_cnt data ones (9)
+  uint16_t fec_groups {};  // groups the data fragments are protected in (10)
+  std::string payload {};  // payload (11)
 
   // retransmission-related
   unsigned int num_rtx {0};
@@ -36,17 +62,24 @@ struct Datagram
 
   // header size after serialization
   static constexpr size_t HEADER_SIZE = sizeof(uint32_t) +
-      sizeof(FrameType) + 2 * sizeof(uint16_t) + sizeof(uint64_t);
+      sizeof(FrameType) + 4 * sizeof(uint16_t) + 2 * sizeof(uint64_t) +
+      2 * sizeof(uint8_t);
 
   // maximum size for 'payload' (initialized in .cc and modified by set_mtu())
   static size_t max_payload;
   static void set_mtu(const size_t mtu);
 
+  // a parity fragment (see fec.hh) rather than compressed frame data
+  bool is_parity() const { return frag_id >= frag_cnt; }
+
   // construct this datagram by parsing binary string on wire
   bool parse_from_string(const std::string & binary);
 
   // serialize this datagram to binary string on wire
   std::string serialize_to_string() const;
+
+  // only the header, to be sent followed by 'payload' (see send_batch())
+  std::string serialize_header() const;
 };
 
 struct Msg
@@ -76,11 +109,13 @@ struct AckMsg : Msg
   // construct an AckMsg
   AckMsg() : Msg(Type::ACK) {}
   // AckMsg(const Datagram & datagram);
-  AckMsg(const Datagram & datagram, uint8_t carry_info=0, uint32_t actual_bitrate=0);
+  AckMsg(const Datagram & datagram, const uint64_t _recv_ts,
+         uint8_t carry_info=0, uint32_t actual_bitrate=0);
 
   uint32_t frame_id {}; // frame ID
   uint16_t frag_id {};  // fragment ID in this frame
   uint64_t send_ts {};  // timestamp (us) on sender when the datagram was sent
+  uint64_t recv_ts {};  // timestamp (us) on receiver when the datagram arrived
 
   // transmit calculated bitrate back to sender
   uint8_t carry_info {0};
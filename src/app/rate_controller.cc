@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include "rate_controller.hh"
+
+using namespace std;
+
+unique_ptr<RateController> RateController::make(const string & name,
+                                                const unsigned int initial_kbps,
+                                                const unsigned int min_kbps,
+                                                const unsigned int max_kbps)
+{
+  if (name == "fixed") {
+    return make_unique<FixedRateController>(initial_kbps);
+  } else if (name == "delay") {
+    return make_unique<DelayRateController>(initial_kbps, min_kbps, max_kbps);
+  } else if (name == "gcc") {
+    return make_unique<GccRateController>(initial_kbps, min_kbps, max_kbps);
+  }
+
+  throw runtime_error("unknown rate controller: " + name);
+}
+
+DelayRateController::DelayRateController(const unsigned int initial_kbps,
+                                         const unsigned int min_kbps,
+                                         const unsigned int max_kbps)
+  : target_kbps_(initial_kbps), min_kbps_(min_kbps), max_kbps_(max_kbps)
+{
+  if (min_kbps == 0 or min_kbps > initial_kbps or initial_kbps > max_kbps) {
+    throw runtime_error("DelayRateController: need 0 < min <= initial <= max");
+  }
+}
+
+void DelayRateController::on_goodput(const double goodput_kbps)
+{
+  goodput_kbps_ = goodput_kbps;
+}
+
+unsigned int DelayRateController::min_rtt_us(const vector<unsigned int> & samples,
+                                             const double interval_ms)
+{
+  for (auto & [age_ms, rtt_us] : min_rtts_) {
+    age_ms += interval_ms;
+  }
+
+  while (not min_rtts_.empty() and min_rtts_.front().first > MIN_RTT_WINDOW_MS) {
+    min_rtts_.pop_front();
+  }
+
+  if (not samples.empty()) {
+    min_rtts_.emplace_back(0.0, *min_element(samples.begin(), samples.end()));
+  }
+
+  unsigned int min_rtt = numeric_limits<unsigned int>::max();
+  for (const auto & [age_ms, rtt_us] : min_rtts_) {
+    min_rtt = min(min_rtt, rtt_us);
+  }
+
+  return min_rtt;
+}
+
+unsigned int DelayRateController::update(const AckFeedback & feedback,
+                                         const double interval_ms)
+{
+  const unsigned int min_rtt = min_rtt_us(feedback.rtt_samples_us, interval_ms);
+
+  // nothing was acked: no evidence either way
+  if (feedback.rtt_samples_us.empty() or interval_ms <= 0) {
+    return lround(target_kbps_);
+  }
+
+  vector<unsigned int> samples = feedback.rtt_samples_us;
+  auto median = samples.begin() + samples.size() / 2;
+  nth_element(samples.begin(), median, samples.end());
+
+  const double queuing_us = double(*median) - min_rtt;
+
+  // tolerate more delay on long paths, where jitter grows too
+  const double high_us = max(20000.0, min_rtt / 2.0);
+  const double low_us = max(5000.0, min_rtt / 8.0);
+
+  // what got through in this interval (ACKs) and the last second (receiver)
+  double delivered_kbps = feedback.acked_bytes * 8 / interval_ms;
+  if (goodput_kbps_) {
+    delivered_kbps = max(delivered_kbps, *goodput_kbps_);
+  }
+
+  const bool retransmitting = feedback.num_rtx > RTX_FRACTION * feedback.num_acks;
+
+  if (queuing_us > high_us or retransmitting) {
+    // back off below the delivered rate to drain the queue, but do not let
+    // one short interval collapse the target
+    const double base = min(target_kbps_, max(delivered_kbps, target_kbps_ / 2));
+    target_kbps_ = max(min_kbps_, BACKOFF * base);
+    hold_intervals_ = HOLD_INTERVALS;
+  } else if (hold_intervals_ > 0) {
+    hold_intervals_--;
+  } else if (queuing_us < low_us and delivered_kbps >= 0.8 * target_kbps_) {
+    // the encoder fills the target and the path keeps up: probe upwards
+    target_kbps_ = min(max_kbps_, target_kbps_ + max(PROBE_GAIN * target_kbps_,
+                                                     MIN_PROBE_KBPS));
+  }
+
+  return lround(target_kbps_);
+}
+
+GccRateController::GccRateController(const unsigned int initial_kbps,
+                                     const unsigned int min_kbps,
+                                     const unsigned int max_kbps)
+  : target_kbps_(initial_kbps), min_kbps_(min_kbps), max_kbps_(max_kbps)
+{
+  if (min_kbps == 0 or min_kbps > initial_kbps or initial_kbps > max_kbps) {
+    throw runtime_error("GccRateController: need 0 < min <= initial <= max");
+  }
+}
+
+void GccRateController::add_received(const vector<PacketArrival> & arrivals)
+{
+  for (const auto & p : arrivals) {
+    received_.emplace_back(p.recv_ts, p.size);
+    received_bytes_ += p.size;
+    avg_packet_bits_ = 0.9 * avg_packet_bits_ + 0.1 * p.size * 8;
+  }
+
+  if (received_.empty()) {
+    return;
+  }
+
+  const uint64_t newest = max_element(received_.begin(), received_.end())->first;
+  while (not received_.empty() and received_.front().first + RATE_WINDOW_US < newest) {
+    received_bytes_ -= received_.front().second;
+    received_.pop_front();
+  }
+}
+
+optional<double> GccRateController::incoming_kbps() const
+{
+  if (received_.size() < 2) {
+    return nullopt;
+  }
+
+  const auto [oldest, newest] = minmax_element(received_.begin(), received_.end());
+  const double span_ms = max((newest->first - oldest->first) / 1000.0, 50.0);
+
+  return received_bytes_ * 8 / span_ms;
+}
+
+void GccRateController::update_link_capacity(const double incoming_kbps)
+{
+  if (not link_capacity_kbps_) {
+    link_capacity_kbps_ = incoming_kbps;
+    return;
+  }
+
+  const double alpha = 0.05;
+  link_capacity_kbps_ = (1 - alpha) * *link_capacity_kbps_ + alpha * incoming_kbps;
+
+  // variance normalized by the estimate, kept within sane bounds
+  const double norm = max(*link_capacity_kbps_, 1.0);
+  const double err = *link_capacity_kbps_ - incoming_kbps;
+  link_capacity_var_ = (1 - alpha) * link_capacity_var_ + alpha * err * err / norm;
+  link_capacity_var_ = clamp(link_capacity_var_, 0.4, 2.5);
+}
+
+unsigned int GccRateController::update(const AckFeedback & feedback,
+                                       const double interval_ms)
+{
+  if (interval_ms <= 0) {
+    return lround(target_kbps_);
+  }
+
+  add_received(feedback.arrivals);
+  const BandwidthUsage usage = trendline_.add(feedback.arrivals);
+  const optional<double> incoming = incoming_kbps();
+
+  if (not feedback.rtt_samples_us.empty()) {
+    vector<unsigned int> samples = feedback.rtt_samples_us;
+    auto median = samples.begin() + samples.size() / 2;
+    nth_element(samples.begin(), median, samples.end());
+    rtt_ms_ = *median / 1000.0;
+  }
+
+  // the signal moves the state machine
+  if (usage == BandwidthUsage::OVERUSE) {
+    state_ = State::DECREASE;
+  } else if (usage == BandwidthUsage::UNDERUSE) {
+    state_ = State::HOLD;
+  } else if (state_ == State::HOLD) {
+    state_ = State::INCREASE;
+  }
+
+  // the link capacity estimate is stale once the incoming rate moves away
+  if (incoming and link_capacity_kbps_) {
+    const double std_dev = sqrt(link_capacity_var_ * *link_capacity_kbps_);
+    if (*incoming > *link_capacity_kbps_ + 3 * std_dev) {
+      link_capacity_kbps_.reset();
+    }
+  }
+
+  switch (state_) {
+    case State::INCREASE: {
+      const double prev_kbps = target_kbps_;
+
+      if (link_capacity_kbps_) {
+        // near the capacity: about one datagram per response time
+        const double response_ms = 100 + rtt_ms_;
+        target_kbps_ += max(avg_packet_bits_ / response_ms, 1.0)
+                        * interval_ms / response_ms;
+      } else {
+        target_kbps_ *= pow(INCREASE_PER_SECOND, min(interval_ms / 1000, 1.0));
+      }
+
+      // do not grow far beyond what actually gets through
+      if (incoming) {
+        const double limit = 1.5 * *incoming + 10;
+        if (target_kbps_ > limit) {
+          target_kbps_ = max(prev_kbps, limit);
+        }
+      }
+      break;
+    }
+
+    case State::DECREASE:
+      if (incoming) {
+        target_kbps_ = min(target_kbps_, BETA * *incoming);
+        update_link_capacity(*incoming);
+      } else {
+        target_kbps_ *= BETA;
+      }
+
+      // wait for the queue to drain before increasing again
+      state_ = State::HOLD;
+      break;
+
+    case State::HOLD:
+      break;
+  }
+
+  target_kbps_ = clamp(target_kbps_, min_kbps_, max_kbps_);
+  return lround(target_kbps_);
+}
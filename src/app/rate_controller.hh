@@ -0,0 +1,160 @@
+#ifndef RATE_CONTROLLER_HH
+#define RATE_CONTROLLER_HH
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "delay_gradient.hh"
+
+// what the sender learned from ACKs since the last update
+struct AckFeedback
+{
+  std::vector<unsigned int> rtt_samples_us {}; // one per ACK
+  uint64_t acked_bytes {0};    // payload of newly acked datagrams
+  unsigned int num_acks {0};   // newly acked data datagrams (no parity)
+  unsigned int num_rtx {0};    // datagrams queued for retransmission
+  std::vector<PacketArrival> arrivals {}; // newly acked datagrams
+};
+
+// Adapts the encoder's target bitrate to the network. The sender calls
+// update() every interval with the ACK feedback of that interval and
+// applies the returned bitrate; the receiver's goodput reports arrive in
+// between. Implementations are picked by name with make().
+class RateController
+{
+public:
+  virtual ~RateController() {}
+
+  // target bitrate (kbps) for the next interval, given the feedback of
+  // the last 'interval_ms'
+  virtual unsigned int update(const AckFeedback & feedback,
+                              const double interval_ms) = 0;
+
+  // goodput (kbps) the receiver measured over its last second
+  virtual void on_goodput(const double goodput_kbps) { (void) goodput_kbps; }
+
+  virtual std::string name() const = 0;
+
+  // "fixed" keeps 'initial_kbps' (CBR), "delay" backs off on queuing
+  // delay (DelayRateController) and "gcc" on the one-way delay gradient
+  // (GccRateController); throws on anything else
+  static std::unique_ptr<RateController> make(const std::string & name,
+                                              const unsigned int initial_kbps,
+                                              const unsigned int min_kbps,
+                                              const unsigned int max_kbps);
+};
+
+// the target bitrate never changes
+class FixedRateController : public RateController
+{
+public:
+  FixedRateController(const unsigned int bitrate_kbps)
+    : bitrate_kbps_(bitrate_kbps) {}
+
+  unsigned int update(const AckFeedback &, const double) override
+  { return bitrate_kbps_; }
+
+  std::string name() const override { return "fixed"; }
+
+private:
+  unsigned int bitrate_kbps_;
+};
+
+// AIMD on queuing delay: the median RTT of an interval over the minimum RTT
+// of the last 10 seconds is the delay queued on the path. Backs off to
+// below the delivered rate as soon as the queue builds up (or datagrams
+// are retransmitted), rather than waiting for losses, and probes upwards
+// while the queue stays empty and the encoder actually fills the target.
+class DelayRateController : public RateController
+{
+public:
+  DelayRateController(const unsigned int initial_kbps,
+                      const unsigned int min_kbps, const unsigned int max_kbps);
+
+  unsigned int update(const AckFeedback & feedback,
+                      const double interval_ms) override;
+  void on_goodput(const double goodput_kbps) override;
+  std::string name() const override { return "delay"; }
+
+private:
+  double target_kbps_;
+  double min_kbps_;
+  double max_kbps_;
+
+  // receiver's latest goodput report
+  std::optional<double> goodput_kbps_ {};
+
+  // minimum RTT of each recent interval, with its age in ms
+  std::deque<std::pair<double, unsigned int>> min_rtts_ {};
+
+  // intervals left without increases after a backoff
+  unsigned int hold_intervals_ {0};
+
+  static constexpr double MIN_RTT_WINDOW_MS = 10000;
+  static constexpr double BACKOFF = 0.85;
+  static constexpr double PROBE_GAIN = 0.05;
+  static constexpr double MIN_PROBE_KBPS = 100;
+  static constexpr double RTX_FRACTION = 0.02; // of the ACKs
+  static constexpr unsigned int HOLD_INTERVALS = 3;
+
+  // minimum RTT over the window, including this interval's samples
+  unsigned int min_rtt_us(const std::vector<unsigned int> & samples,
+                          const double interval_ms);
+};
+
+// Google Congestion Control's delay-based controller: the trendline of
+// one-way delay deltas (TrendlineEstimator) drives an AIMD state machine.
+// Overuse cuts the target to 85% of the rate the receiver actually got;
+// underuse holds it while the queue drains; otherwise the target grows by
+// 8% per second, or by about one datagram per RTT once it is close to the
+// rate at which overuse was last detected (the link capacity estimate).
+class GccRateController : public RateController
+{
+public:
+  GccRateController(const unsigned int initial_kbps,
+                    const unsigned int min_kbps, const unsigned int max_kbps);
+
+  unsigned int update(const AckFeedback & feedback,
+                      const double interval_ms) override;
+  std::string name() const override { return "gcc"; }
+
+  BandwidthUsage usage() const { return trendline_.state(); }
+
+  // receive rate (kbps) over the last half second, by the receiver's clock
+  std::optional<double> incoming_kbps() const;
+
+private:
+  enum class State { HOLD, INCREASE, DECREASE };
+
+  double target_kbps_;
+  double min_kbps_;
+  double max_kbps_;
+
+  TrendlineEstimator trendline_ {};
+  State state_ {State::INCREASE};
+
+  // (recv_ts, bytes) of the datagrams acked in the last RATE_WINDOW_US
+  std::deque<std::pair<uint64_t, size_t>> received_ {};
+  uint64_t received_bytes_ {0};
+
+  // average and variance of the incoming rate at overuse, normalized by it
+  std::optional<double> link_capacity_kbps_ {};
+  double link_capacity_var_ {0.4};
+
+  double rtt_ms_ {100.0};
+  double avg_packet_bits_ {8000.0};
+
+  static constexpr uint64_t RATE_WINDOW_US = 500000;
+  static constexpr double BETA = 0.85;
+  static constexpr double INCREASE_PER_SECOND = 1.08;
+
+  void add_received(const std::vector<PacketArrival> & arrivals);
+  void update_link_capacity(const double incoming_kbps);
+};
+
+#endif /* RATE_CONTROLLER_HH */
@@ -0,0 +1,19 @@
+#ifndef RESOLUTION_TIERS_HH
+#define RESOLUTION_TIERS_HH
+
+#include <cstdint>
+
+// the sender's resolution tiers, at their highest frame rate and the top
+// of their practical bitrate range (see README)
+struct ResolutionTier { uint16_t width, height, fps; unsigned bitrate_kbps; };
+
+inline constexpr ResolutionTier RESOLUTION_TIERS[] = {
+  { 1280,  720, 120, 12000 },
+  { 1920, 1080,  60, 12000 },
+  { 2000, 1500,  50, 14000 },
+  { 3840, 2160,  20, 24000 },
+  { 4000, 3000,  14, 24000 },
+  { 8000, 6000,   3, 40000 },
+};
+
+#endif /* RESOLUTION_TIERS_HH */
@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "speed_controller.hh"
+
+using namespace std;
+
+SpeedController::SpeedController(const uint16_t frame_rate,
+                                 const double budget_fraction,
+                                 const int cpu_used, const int max_cpu_used)
+  : frame_interval_ms_(1000.0 / max<uint16_t>(frame_rate, 1)),
+    budget_fraction_(budget_fraction),
+    min_cpu_used_(cpu_used), max_cpu_used_(max(cpu_used, max_cpu_used)),
+    cpu_used_(cpu_used),
+    // about half a second of frames, but enough for a percentile
+    window_size_(max<size_t>(frame_rate / 2, 8))
+{
+  if (budget_fraction <= 0) {
+    throw runtime_error("SpeedController: budget must be positive");
+  }
+
+  window_.reserve(window_size_);
+}
+
+bool SpeedController::add_sample(const double encode_time_ms)
+{
+  window_.push_back(encode_time_ms);
+  if (window_.size() < window_size_) {
+    return false;
+  }
+
+  auto p95 = window_.begin() + window_.size() * 95 / 100;
+  nth_element(window_.begin(), p95, window_.end());
+  last_p95_ms_ = *p95;
+  window_.clear();
+
+  const double budget = budget_ms(frame_skip_);
+
+  if (last_p95_ms_ > budget) {
+    calm_windows_ = 0;
+
+    // speed up, by two presets if far over budget
+    if (cpu_used_ < max_cpu_used_) {
+      cpu_used_ = min(max_cpu_used_,
+                      cpu_used_ + (last_p95_ms_ > 1.5 * budget ? 2 : 1));
+      return true;
+    }
+
+    // already at the fastest preset: encode fewer frames
+    if (frame_skip_ < MAX_FRAME_SKIP) {
+      frame_skip_++;
+      return true;
+    }
+
+    return false;
+  }
+
+  // well under the budget of the next slower setting
+  const bool calm = frame_skip_ > 1
+                    ? last_p95_ms_ < RELAX_FRACTION * budget_ms(frame_skip_ - 1)
+                    : last_p95_ms_ < RELAX_FRACTION * budget;
+
+  if (not calm) {
+    calm_windows_ = 0;
+    return false;
+  }
+
+  if (++calm_windows_ < CALM_WINDOWS) {
+    return false;
+  }
+
+  calm_windows_ = 0;
+
+  // restore the frame rate first, then quality
+  if (frame_skip_ > 1) {
+    frame_skip_--;
+    return true;
+  }
+
+  if (cpu_used_ > min_cpu_used_) {
+    cpu_used_--;
+    return true;
+  }
+
+  return false;
+}
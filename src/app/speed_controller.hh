@@ -0,0 +1,61 @@
+#ifndef SPEED_CONTROLLER_HH
+#define SPEED_CONTROLLER_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Keeps encoding real time when scene complexity spikes. Over every window
+// of frames, the 95th percentile encoding time is compared with a budget,
+// a fraction of the frame interval: over budget, the encoder switches to a
+// faster speed preset (cpu_used), and once the fastest preset is not fast
+// enough, only every 2nd, 3rd or 4th frame is encoded. Going back towards
+// the starting preset takes several windows well under budget, so that
+// the settings do not oscillate.
+class SpeedController
+{
+public:
+  // starts at (and never goes slower than) preset 'cpu_used'; faster
+  // presets go up to 'max_cpu_used'
+  SpeedController(const uint16_t frame_rate, const double budget_fraction,
+                  const int cpu_used, const int max_cpu_used);
+
+  // add the encoding time of a frame; true if cpu_used() or frame_skip()
+  // changed at the end of a window
+  bool add_sample(const double encode_time_ms);
+
+  // speed preset to encode with
+  int cpu_used() const { return cpu_used_; }
+
+  // encode every frame_skip()-th frame only
+  unsigned frame_skip() const { return frame_skip_; }
+
+  // 95th percentile encoding time of the last complete window
+  double last_p95_ms() const { return last_p95_ms_; }
+
+  static constexpr unsigned MAX_FRAME_SKIP = 4;
+
+private:
+  double frame_interval_ms_;
+  double budget_fraction_;
+  int min_cpu_used_;
+  int max_cpu_used_;
+
+  int cpu_used_;
+  unsigned frame_skip_ {1};
+
+  std::vector<double> window_ {};
+  size_t window_size_;
+  unsigned calm_windows_ {0}; // consecutive windows well under budget
+  double last_p95_ms_ {0.0};
+
+  // windows this far under budget count towards slowing down again
+  static constexpr double RELAX_FRACTION = 0.6;
+  static constexpr unsigned CALM_WINDOWS = 3;
+
+  // encoding time budget when encoding every 'frame_skip'-th frame
+  double budget_ms(const unsigned frame_skip) const
+  { return budget_fraction_ * frame_interval_ms_ * frame_skip; }
+};
+
+#endif /* SPEED_CONTROLLER_HH */
@@ -0,0 +1,150 @@
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "conversion.hh"
+#include "spsc_ring.hh"
+
+using namespace std;
+
+namespace {
+
+// left in 'item' by calls that must not write it
+constexpr uint64_t UNTOUCHED = UINT64_MAX;
+
+// small rings are full (and so race drop_oldest against pop) most often
+constexpr size_t depths[] = { 1, 2, 3, 8 };
+
+struct Result
+{
+  vector<uint64_t> popped {};
+  vector<uint64_t> dropped {};
+  uint64_t clobbered_pops {0};  // pop() returned false but wrote 'item'
+  uint64_t clobbered_drops {0}; // drop_oldest() returned false but wrote it
+};
+
+// the producer pushes 1, 2, ..., 'num_items' and, whenever the ring is full,
+// takes back the oldest item as the capture thread does under
+// --ring-policy oldest; the consumer pops as fast as it can
+Result run(const size_t depth, const uint64_t num_items)
+{
+  SPSCRing<uint64_t> ring(depth);
+  Result result;
+  atomic<bool> started {false};
+  atomic<bool> done {false};
+
+  thread consumer([&]() {
+    started = true;
+
+    while (true) {
+      // read before popping, so nothing pushed before 'done' is missed
+      const bool finished = done;
+
+      uint64_t item = UNTOUCHED;
+      if (ring.pop(item)) {
+        result.popped.push_back(item);
+      } else if (item != UNTOUCHED) {
+        result.clobbered_pops++;
+      } else if (finished) {
+        break;
+      }
+    }
+  });
+
+  while (not started) {}
+
+  for (uint64_t i = 1; i <= num_items; i++) {
+    // vary the producer's pace, so that the ring is sometimes full and
+    // sometimes empty and both ends race for the last item
+    for (volatile uint64_t spin = 0; spin < (i * 7919) % 97; spin++) {}
+
+    while (not ring.push(i)) {
+      uint64_t item = UNTOUCHED;
+      if (ring.drop_oldest(item)) {
+        result.dropped.push_back(item);
+      } else if (item != UNTOUCHED) {
+        result.clobbered_drops++;
+      }
+    }
+  }
+
+  done = true;
+  consumer.join();
+
+  return result;
+}
+
+// every item was either popped or dropped, exactly once and in order
+string verify(const Result & result, const uint64_t num_items)
+{
+  if (result.clobbered_pops > 0) {
+    return to_string(result.clobbered_pops)
+           + " failed pop() calls overwrote the item";
+  }
+
+  if (result.clobbered_drops > 0) {
+    return to_string(result.clobbered_drops)
+           + " failed drop_oldest() calls overwrote the item";
+  }
+
+  vector<uint8_t> seen(num_items + 1, 0);
+
+  for (const auto * items : { &result.popped, &result.dropped }) {
+    uint64_t last = 0;
+
+    for (const uint64_t item : *items) {
+      if (item == 0 or item > num_items) {
+        return "unknown item " + to_string(item);
+      }
+
+      if (item <= last) {
+        return "item " + to_string(item) + " after " + to_string(last);
+      }
+
+      if (seen[item]++) {
+        return "item " + to_string(item) + " both popped and dropped";
+      }
+
+      last = item;
+    }
+  }
+
+  const uint64_t num_seen = result.popped.size() + result.dropped.size();
+  if (num_seen != num_items) {
+    return to_string(num_items - num_seen) + " items lost";
+  }
+
+  return {};
+}
+
+} // namespace
+
+// race push and drop_oldest on one thread against pop on another, and check
+// that every item comes out exactly once
+int main(int argc, char * argv[])
+{
+  if (argc > 2) {
+    cerr << "Usage: " << argv[0] << " [items per run]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const uint64_t num_items = argc > 1 ? strict_stoll(argv[1]) : 5000000;
+  unsigned num_failed = 0;
+
+  for (const size_t depth : depths) {
+    const Result result = run(depth, num_items);
+    const string error = verify(result, num_items);
+
+    cout << "depth " << depth << ": " << result.popped.size() << " popped, "
+         << result.dropped.size() << " dropped: "
+         << (error.empty() ? "ok" : error) << endl;
+
+    if (not error.empty()) {
+      num_failed++;
+    }
+  }
+
+  return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
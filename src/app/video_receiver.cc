@@ -11,6 +11,7 @@
 #include "sdl.hh"
 #include "protocol.hh"
 #include "decoder.hh"
+#include "timestamp.hh"
 
 using namespace std;
 using namespace chrono;
@@ -101,7 +102,7 @@ int main(int argc, char * argv[])
 
   // ===== Argument parsing =====
   if (argc < 3) {
-    cerr << "Usage: " << argv[0] << " <host> <port> [--cbr bitrate] [--lazy level] [--fps rate] [--output file] [--verbose]\n";
+    cerr << "Usage: " << argv[0] << " <host> <port> [--cbr bitrate] [--lazy level] [--fps rate] [--output file] [--verbose] [--y4m-direct] [--y4m-prealloc MB] [--store file.ivf] [--segment-mb MB] [--segment-sec sec] [--disk-budget-mb MB]\n";
     return EXIT_FAILURE;
   }
 
@@ -112,11 +113,21 @@ int main(int argc, char * argv[])
 
   unsigned int target_bitrate = 0; // kbps
   int lazy_level = 0;
+  bool y4m_direct_io = false;
+  size_t y4m_prealloc_mb = 0;
+  string store_path;
+  SegmentLimits segments;
 
   optind = 3;
   const option cmd_line_opts[] = {
     {"cbr",  required_argument, nullptr, 'C'},
     {"lazy", required_argument, nullptr, 'L'},
+    {"y4m-direct", no_argument, nullptr, 'D'},
+    {"y4m-prealloc", required_argument, nullptr, 'A'},
+    {"store", required_argument, nullptr, 'S'},
+    {"segment-mb", required_argument, nullptr, 'M'},
+    {"segment-sec", required_argument, nullptr, 'T'},
+    {"disk-budget-mb", required_argument, nullptr, 'B'},
     {nullptr, 0, nullptr, 0},
   };
 
@@ -131,6 +142,24 @@ int main(int argc, char * argv[])
       case 'L':
         lazy_level = strict_stoi(optarg);
         break;
+      case 'D':
+        y4m_direct_io = true;
+        break;
+      case 'A':
+        y4m_prealloc_mb = strict_stoi(optarg);
+        break;
+      case 'S':
+        store_path = optarg;
+        break;
+      case 'M':
+        segments.max_bytes = strict_stoll(optarg) * 1024 * 1024;
+        break;
+      case 'T':
+        segments.max_seconds = strict_stoi(optarg);
+        break;
+      case 'B':
+        segments.budget_bytes = strict_stoll(optarg) * 1024 * 1024;
+        break;
       default:
         cerr << "Invalid option.\n";
         return EXIT_FAILURE;
@@ -142,6 +171,11 @@ int main(int argc, char * argv[])
     return EXIT_FAILURE;
   }
 
+  if (segments.budget_bytes > 0 and not segments.rotating()) {
+    cerr << "--disk-budget-mb requires --segment-mb or --segment-sec.\n";
+    return EXIT_FAILURE;
+  }
+
   Address peer_addr{host, port};
   cerr << "Peer address: " << peer_addr.str() << endl;
 
@@ -172,14 +206,21 @@ int main(int argc, char * argv[])
   }
 
   // initialize decoder
-  Decoder decoder(width, height, lazy_level, frame_rate, output_path);
+  Decoder decoder(width, height, lazy_level, frame_rate, output_path,
+                  y4m_direct_io, y4m_prealloc_mb * 1024 * 1024, segments);
   decoder.set_verbose(verbose);
+  if (not store_path.empty()) {
+    decoder.store_to(store_path);
+  }
 
   // main loop
   while (true) {
     // parse a datagram received from sender
+    const string raw_datagram = udp_sock.recv().value();
+    const uint64_t recv_ts = timestamp_us(); // for the sender's delay gradient
+
     Datagram datagram;
-    if (not datagram.parse_from_string(udp_sock.recv().value())) {
+    if (not datagram.parse_from_string(raw_datagram)) {
       throw runtime_error("failed to parse a datagram");
     }
 
@@ -192,7 +233,7 @@ int main(int argc, char * argv[])
 
     // send an ACK back to sender
     // AckMsg ack(datagram);
-    AckMsg ack(datagram, carry_info, actual_bitrate);
+    AckMsg ack(datagram, recv_ts, carry_info, actual_bitrate);
     udp_sock.send(ack.serialize_to_string());
 
     if (verbose) {
@@ -203,6 +244,15 @@ int main(int argc, char * argv[])
     // process the received datagram in the decoder
     decoder.add_datagram(move(datagram));
 
+    // acknowledge fragments rebuilt from parity so that the sender does not
+    // retransmit them; with no send_ts to echo, they yield no RTT sample
+    for (const auto & [frame_id, frag_id] : decoder.take_recovered()) {
+      AckMsg recovered_ack;
+      recovered_ack.frame_id = frame_id;
+      recovered_ack.frag_id = frag_id;
+      udp_sock.send(recovered_ack.serialize_to_string());
+    }
+
     // check if the expected frame(s) is complete
     while (decoder.next_frame_complete()) {
       // depending on the lazy level, might decode and display the next frame
@@ -7,14 +7,20 @@
 #include <chrono>
 #include <csignal>
 #include <atomic>
+#include <thread>
+#include <vector>
 
 #include "conversion.hh"
 #include "timerfd.hh"
 #include "udp_socket.hh"
 #include "poller.hh"
 #include "yuv4mpeg.hh"
+#include "test_pattern.hh"
+#include "split.hh"
 #include "protocol.hh"
 #include "encoder.hh"
+#include "rate_controller.hh"
+#include "pacer.hh"
 #include "timestamp.hh"
 #include "capture.hh"
 
@@ -25,17 +31,51 @@ using namespace chrono;
 
 // global variables in an unnamed namespace
 namespace {
-  constexpr unsigned int BILLION = 1000 * 1000 * 1000;
+  constexpr unsigned int RATE_CONTROL_INTERVAL_MS = 200;
+  constexpr size_t MAX_SEND_BATCH = 256; // datagrams per send_batch()
+  constexpr int DEFAULT_ENCODE_BUDGET_PCT = 80; // of the frame interval
 }
 
 void print_usage(const string & program_name)
 {
   cerr <<
-  "Usage: " << program_name << " [options] port y4m\n\n"
+  "Usage: " << program_name << " port -w width -h height -r fps [options]\n\n"
   "Options:\n"
-  "--mtu <MTU>                MTU for deciding UDP payload size\n"
-  "-o, --output <file>        file to output performance results to\n"
-  "-v, --verbose              enable more logging for debugging"
+  "-w, --width <width>          frame width\n"
+  "-h, --height <height>        frame height\n"
+  "-r, --fps <FPS>              frame rate\n"
+  "-t, --convert-threads <n>    bands to convert frames in (default: by resolution)\n"
+  "-p, --preview-fps <FPS>      local preview rate; 0: headless (default: 30)\n"
+  "-n, --preview-every <n>      preview every n-th frame (default: 1)\n"
+  "-f, --pixel-format <format>  auto, i420, nv12, mjpeg or yuyv (default: auto)\n"
+  "--ring-policy <policy>       frame dropped when the capture ring is full\n"
+  "                             newest: the new frame (default)\n"
+  "                             oldest: the oldest queued frame\n"
+  "                             latest: all but the new frame (a mailbox)\n"
+  "--latency-budget <ms>        video the capture ring may hold (default: 200)\n"
+  "--max-age <ms>               skip frames older than this; 0: never (default)\n"
+  "--huge-pages                 back the capture ring with huge pages\n"
+  "--v4l2-io <method>           mmap (default), userptr or dmabuf\n"
+  "--v4l2-buffers <n>           V4L2 buffers (default: by frame size and rate)\n"
+  "--source <source>            camera (default), pattern[:motion[:complexity]]\n"
+  "                             or a .y4m file to replay\n"
+  "--unpaced                    read pattern or file frames as fast as possible\n"
+  "--stripes <n>                stripes encoded in parallel (default: 1)\n"
+  "--cpu-used <n>               VP9 speed preset (default: by resolution and fps)\n"
+  "--enc-threads <n>            encoder threads (default: by resolution and cores)\n"
+  "--tile-columns <log2>        encoder tile columns (default: by threads)\n"
+  "--tile-rows <log2>           encoder tile rows (default: by resolution)\n"
+  "--row-mt <0|1>               row multi-threading (default: by threads)\n"
+  "--calibrate                  pick the speed preset by encoding test frames\n"
+  "--encode-budget <percent>    share of the frame interval encoding may take;\n"
+  "                             0 pins the speed preset (default: 80)\n"
+  "--abr <controller>           fixed (default), delay or gcc\n"
+  "--min-bitrate <kbps>         lowest target (default: a tenth of the initial)\n"
+  "--max-bitrate <kbps>         highest target (default: twice the initial)\n"
+  "--pacing <gain>              pacing rate over the target bitrate; 0: unpaced\n"
+  "                             (default: 2)\n"
+  "--pace-burst <KB>            may leave back-to-back after idling (default: 16)\n"
+  "--fec <mode>                 off (default), xor or rs parity fragments"
   << endl;
 }
 
@@ -94,21 +134,106 @@ bool validate_resolution_and_fps(int width, int height, int fps) {
   return false;
 }
 
+// "camera" (nullptr), "pattern[:motion[:complexity]]" or a Y4M file to
+// replay in a loop; throws if the source cannot be opened
+unique_ptr<VideoInput> make_source(const string & spec,
+                                   const uint16_t width, const uint16_t height)
+{
+  if (spec == "camera") {
+    return nullptr;
+  }
+
+  if (spec.substr(0, 7) == "pattern") {
+    const vector<string> & args = split(spec, ":");
+    const unsigned motion = args.size() > 1 ? strict_stoi(args[1]) : 4;
+    const unsigned complexity = args.size() > 2 ? strict_stoi(args[2]) : 50;
+    return make_unique<TestPattern>(width, height, motion, complexity);
+  }
+
+  auto y4m = make_unique<YUV4MPEG>(spec, width, height, true /* loop */);
+  cerr << "Replaying " << y4m->num_frames() << " frames from " << spec
+       << " (recorded at " << y4m->frame_rate() << " fps)" << endl;
+  return y4m;
+}
+
 void handle_sigint(int)
 {
   keep_running = false;
 }
 
+// encoder thread: encode every frame as soon as the capture thread
+// publishes it; the poll timeout doubles as a watchdog on the camera
+void encode_loop(FrameRing & frame_ring, Encoder & encoder)
+{
+  constexpr int WATCHDOG_MS = 1000;
+  uint64_t last_frame_ms = timestamp_ms();
+
+  auto encode_ready_frames = [&]() {
+    YUV420PFrame * frame;
+    while ((frame = frame_ring.next()) != nullptr) {
+      // compress the captured image in place and packetize it; the frame
+      // goes back to the capture thread afterwards
+      encoder.compress_frame(*frame->image);
+      frame_ring.release(frame);
+
+      last_frame_ms = timestamp_ms();
+    }
+  };
+
+  Poller poller;
+  poller.register_event(frame_ring.notifier(), Poller::In,
+    [&]()
+    {
+      frame_ring.notifier().read_count();
+      encode_ready_frames();
+    }
+  );
+
+  while (keep_running) {
+    poller.poll(WATCHDOG_MS);
+
+    // picks up any frame whose wakeup was somehow missed
+    encode_ready_frames();
+
+    const uint64_t stalled_ms = timestamp_ms() - last_frame_ms;
+    if (stalled_ms >= WATCHDOG_MS) {
+      cerr << "Warning: no frame from the camera for " << stalled_ms << " ms" << endl;
+    }
+  }
+}
+
 
 // ************************** Main: get frames from buffer ***********************************
 int main(int argc, char * argv[])
 {
   string output_path;
   bool verbose = false;
+  int convert_threads = 0; // pick by resolution
+  int preview_fps = 30;    // 0 runs headless
+  int preview_every = 1;
+  uint32_t pixel_format = 0; // negotiated with the camera
+  AdmissionPolicy ring_policy = AdmissionPolicy::DropNewest;
+  int latency_budget_ms = DEFAULT_LATENCY_BUDGET_MS;
+  bool huge_pages = false;
+  int max_age_ms = 0; // no age bound
+  V4L2IO v4l2_io = V4L2IO::MMap;
+  int v4l2_buffers = 0; // picked by frame size and rate
+  string source_spec = "camera";
+  bool paced = true;
+  int stripes = 1; // encoded independently and in parallel
+  EncoderProfile encoder_profile; // picked by resolution, fps and cores
+  bool calibrate = false;
+  int encode_budget_pct = DEFAULT_ENCODE_BUDGET_PCT; // 0 pins the preset
+  string abr = "fixed";       // rate controller
+  int min_bitrate = 0;        // kbps; 0 picks a tenth of the initial bitrate
+  int max_bitrate = 0;        // kbps; 0 picks twice the initial bitrate
+  double pacing_gain = 2.0;   // pacing rate over the target bitrate; 0 disables
+  int pace_burst_kb = 16;     // sent back-to-back after an idle period
+  string fec = "off";         // parity fragments per frame
 
   // ===== Argument parsing =====
   if (argc < 6) {
-    cerr << "Usage: " << argv[0] << " <port> -w <width> -h <height> -r <fps>\n";
+    print_usage(argv[0]);
     return EXIT_FAILURE;
   }
 
@@ -125,10 +250,36 @@ int main(int argc, char * argv[])
     {"width",  required_argument, nullptr, 'w'},
     {"height", required_argument, nullptr, 'h'},
     {"fps",    required_argument, nullptr, 'r'},
+    {"convert-threads", required_argument, nullptr, 't'},
+    {"preview-fps", required_argument, nullptr, 'p'},
+    {"preview-every", required_argument, nullptr, 'n'},
+    {"pixel-format", required_argument, nullptr, 'f'},
+    {"ring-policy", required_argument, nullptr, 'P'},
+    {"latency-budget", required_argument, nullptr, 'B'},
+    {"huge-pages", no_argument, nullptr, 'H'},
+    {"max-age", required_argument, nullptr, 'A'},
+    {"v4l2-io", required_argument, nullptr, 'I'},
+    {"v4l2-buffers", required_argument, nullptr, 'Q'},
+    {"source", required_argument, nullptr, 'S'},
+    {"unpaced", no_argument, nullptr, 'U'},
+    {"stripes", required_argument, nullptr, 'N'},
+    {"cpu-used", required_argument, nullptr, 'C'},
+    {"enc-threads", required_argument, nullptr, 'T'},
+    {"tile-columns", required_argument, nullptr, 'L'},
+    {"tile-rows", required_argument, nullptr, 'R'},
+    {"row-mt", required_argument, nullptr, 'M'},
+    {"calibrate", no_argument, nullptr, 'K'},
+    {"encode-budget", required_argument, nullptr, 'E'},
+    {"abr", required_argument, nullptr, 'X'},
+    {"min-bitrate", required_argument, nullptr, 'Y'},
+    {"max-bitrate", required_argument, nullptr, 'Z'},
+    {"pacing", required_argument, nullptr, 'G'},
+    {"pace-burst", required_argument, nullptr, 'J'},
+    {"fec", required_argument, nullptr, 'F'},
     {nullptr,  0,                 nullptr,  0 }
   };
 
-  while ((opt = getopt_long(argc, argv, "w:h:r:", cmd_line_opts, nullptr)) != -1) {
+  while ((opt = getopt_long(argc, argv, "w:h:r:t:p:n:f:", cmd_line_opts, nullptr)) != -1) {
     switch (opt) {
       case 'w':
         width = atoi(optarg);
@@ -139,8 +290,101 @@ int main(int argc, char * argv[])
       case 'r':
         fps = atoi(optarg);
         break;
+      case 't':
+        convert_threads = atoi(optarg);
+        break;
+      case 'p':
+        preview_fps = atoi(optarg);
+        break;
+      case 'n':
+        preview_every = atoi(optarg);
+        break;
+      case 'f':
+        try {
+          pixel_format = parse_pixel_format(optarg);
+        } catch (const exception & e) {
+          cerr << e.what() << endl;
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'P':
+        try {
+          ring_policy = parse_admission_policy(optarg);
+        } catch (const exception & e) {
+          cerr << e.what() << endl;
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'B':
+        latency_budget_ms = atoi(optarg);
+        break;
+      case 'H':
+        huge_pages = true;
+        break;
+      case 'A':
+        max_age_ms = atoi(optarg);
+        break;
+      case 'I':
+        try {
+          v4l2_io = parse_v4l2_io(optarg);
+        } catch (const exception & e) {
+          cerr << e.what() << endl;
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'Q':
+        v4l2_buffers = atoi(optarg);
+        break;
+      case 'S':
+        source_spec = optarg;
+        break;
+      case 'U':
+        paced = false;
+        break;
+      case 'N':
+        stripes = atoi(optarg);
+        break;
+      case 'C':
+        encoder_profile.cpu_used = atoi(optarg);
+        break;
+      case 'T':
+        encoder_profile.threads = atoi(optarg);
+        break;
+      case 'L':
+        encoder_profile.tile_columns = atoi(optarg);
+        break;
+      case 'R':
+        encoder_profile.tile_rows = atoi(optarg);
+        break;
+      case 'M':
+        encoder_profile.row_mt = atoi(optarg) ? 1 : 0;
+        break;
+      case 'K':
+        calibrate = true;
+        break;
+      case 'E':
+        encode_budget_pct = atoi(optarg);
+        break;
+      case 'X':
+        abr = optarg;
+        break;
+      case 'Y':
+        min_bitrate = atoi(optarg);
+        break;
+      case 'Z':
+        max_bitrate = atoi(optarg);
+        break;
+      case 'G':
+        pacing_gain = atof(optarg);
+        break;
+      case 'J':
+        pace_burst_kb = atoi(optarg);
+        break;
+      case 'F':
+        fec = optarg;
+        break;
       default:
-        cerr << "Usage: " << argv[0] << " <port> -w <width> -h <height> -r <fps>\n";
+        print_usage(argv[0]);
         return EXIT_FAILURE;
     }
   }
@@ -150,22 +394,66 @@ int main(int argc, char * argv[])
     return EXIT_FAILURE;
   }
 
+  if (latency_budget_ms <= 0 || max_age_ms < 0) {
+    cerr << "Invalid input: latency budget must be > 0 and max age >= 0\n";
+    return EXIT_FAILURE;
+  }
+
+  if (v4l2_buffers < 0) {
+    cerr << "Invalid input: V4L2 buffers must be >= 0\n";
+    return EXIT_FAILURE;
+  }
+
+  if (stripes < 1 || stripes > static_cast<int>(MAX_STRIPES) || height / stripes < 16) {
+    cerr << "Invalid input: stripes must be 1 to " << MAX_STRIPES
+         << " and at least 16 rows each\n";
+    return EXIT_FAILURE;
+  }
+
+  if (encoder_profile.threads == 0 || encoder_profile.tile_columns > 6 ||
+      encoder_profile.tile_rows > 2 || encoder_profile.cpu_used > EncoderProfile::MAX_CPU_USED) {
+    cerr << "Invalid input: encoder threads must be > 0, tile columns <= 6, "
+         << "tile rows <= 2 and cpu used <= " << EncoderProfile::MAX_CPU_USED << "\n";
+    return EXIT_FAILURE;
+  }
+
+  if (min_bitrate < 0 || max_bitrate < 0) {
+    cerr << "Invalid input: bitrate bounds must be >= 0\n";
+    return EXIT_FAILURE;
+  }
+
+  if (encode_budget_pct < 0) {
+    cerr << "Invalid input: encode budget must be >= 0\n";
+    return EXIT_FAILURE;
+  }
+
+  if (preview_fps < 0 || preview_every <= 0) {
+    cerr << "Invalid input: preview fps must be >= 0 and preview every > 0\n";
+    return EXIT_FAILURE;
+  }
+
   cerr << "Input: Port: " << port << ", Width: " << width
        << ", Height: " << height << ", FPS: " << fps << endl;
 
-  if (!validate_resolution_and_fps(width, height, fps)) {
+  // ===== Open the frame source =====
+  // the camera is opened by the capture thread; other sources are not
+  // bound by its resolution and frame rate limits
+  unique_ptr<VideoInput> source;
+  try {
+    source = make_source(source_spec, width, height);
+  } catch (const exception & e) {
+    cerr << "Cannot open source " << source_spec << ": " << e.what() << endl;
     return EXIT_FAILURE;
   }
 
-  // ===== Initialize shared ring buffer =====
-  yuv_frame_size = width * height * 3 / 2;
-  for (int i = 0; i < FRAME_RING_SIZE; ++i) {
-    frame_ring[i].data = (uint8_t *)malloc(yuv_frame_size);
-    frame_ring[i].size = 0;
-    frame_ring[i].ready = false;
-    pthread_mutex_init(&frame_ring[i].lock, nullptr);
+  if (!source && !validate_resolution_and_fps(width, height, fps)) {
+    return EXIT_FAILURE;
   }
-  // cerr << "Initialized shared frame ring buffer with size: " << FRAME_RING_SIZE << endl;
+
+  // ===== Initialize shared frame ring =====
+  // frames queued for the encoder are bounded by the latency budget
+  const size_t ring_depth = frames_for_latency_budget(latency_budget_ms, fps);
+  FrameRing frame_ring(ring_depth, width, height, ring_policy, max_age_ms, huge_pages);
 
   UDPSocket udp_sock;
   udp_sock.bind({"0", port});
@@ -189,76 +477,168 @@ int main(int argc, char * argv[])
   // set UDP socket to non-blocking now
   udp_sock.set_blocking(false);
 
-  // allocate a raw image
-  RawImage raw_img(width, height);
+  // pick the slowest speed preset that keeps up, before frames arrive; it
+  // has to meet the same budget the speed controller enforces afterwards
+  const double encode_budget = (encode_budget_pct > 0 ? encode_budget_pct
+                                : DEFAULT_ENCODE_BUDGET_PCT) / 100.0;
+  if (calibrate) {
+    encoder_profile = Encoder::calibrate(width, height, fps, target_bitrate,
+                                         stripes, encoder_profile,
+                                         encode_budget);
+  }
 
   // initialize the encoder
-  Encoder encoder(width, height, fps, output_path);
+  Encoder encoder(width, height, fps, output_path, stripes, encoder_profile);
   encoder.set_target_bitrate(target_bitrate);
   encoder.set_verbose(verbose);
+  if (encode_budget_pct > 0) {
+    encoder.control_speed(encode_budget);
+  }
+
+  try {
+    encoder.enable_fec(parse_fec_mode(fec));
+  } catch (const exception & e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  // adapts the target bitrate to ACK feedback, starting from the requested one
+  unique_ptr<RateController> rate_controller;
+  try {
+    rate_controller = RateController::make(
+        abr, target_bitrate,
+        min_bitrate > 0 ? min_bitrate : max(1u, target_bitrate / 10),
+        max_bitrate > 0 ? max_bitrate : 2 * target_bitrate);
+  } catch (const exception & e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  unsigned int current_bitrate = target_bitrate;
+
+  // spreads fresh datagrams out at a multiple of the target bitrate
+  unique_ptr<Pacer> pacer;
+  if (pacing_gain > 0) {
+    if (pace_burst_kb <= 0) {
+      cerr << "Invalid input: --pace-burst must be > 0" << endl;
+      return EXIT_FAILURE;
+    }
+    pacer = make_unique<Pacer>(pacing_gain * target_bitrate, pace_burst_kb * 1024);
+  }
 
   // ===== Launch capture thread =====
-  auto *cap_params = new CaptureParams{width, height, fps};
+  auto *cap_params = new CaptureParams{width, height, fps, &frame_ring, convert_threads,
+                                       preview_fps, preview_every, pixel_format,
+                                       v4l2_io, static_cast<unsigned>(v4l2_buffers),
+                                       source.get(), paced};
 
   pthread_t cap_tid;
-  pthread_create(&cap_tid, nullptr, capture_streaming_loop, cap_params);
+  pthread_create(&cap_tid, nullptr,
+                 source ? capture_source_loop : capture_streaming_loop, cap_params);
   // cerr << "Launched capture thread." << endl;
 
   Poller poller;
 
-  // create a periodic timer with the same period as the frame interval
-  Timerfd fps_timer;
-  const timespec frame_interval {0, static_cast<long>(BILLION / fps)};
-  fps_timer.set_time(frame_interval, frame_interval);
-  // cerr << "Frame timer set for interval: " << frame_interval.tv_sec << "s " << frame_interval.tv_nsec << "ns" << endl;
-
-  // read a raw frame when the periodic timer fires
-  poller.register_event(fps_timer, Poller::In,[&]() {
-    
-      const auto num_exp = fps_timer.read_expirations();
-      if (num_exp > 1) {
-        cerr << "Warning: skipping " << num_exp - 1 << " raw frames" << endl;
-      }
-
-      // Read frame from ring buffer
-      pthread_mutex_lock(&frame_ring_mutex);
-      while (!frame_ring[frame_ring_tail].ready) {
-        pthread_cond_wait(&frame_available, &frame_ring_mutex);
-      }
+  // ===== Launch encoder thread =====
+  thread encoder_thread([&]() {
+    try {
+      encode_loop(frame_ring, encoder);
+    } catch (const exception & e) {
+      cerr << "Encoder thread: " << e.what() << endl;
+      keep_running = false;
+    }
+  });
 
-      pthread_mutex_lock(&frame_ring[frame_ring_tail].lock);
-      raw_img.copy_from_ringbuffer(frame_ring[frame_ring_tail].data, frame_ring[frame_ring_tail].size);
-      frame_ring[frame_ring_tail].ready = false;
-      pthread_mutex_unlock(&frame_ring[frame_ring_tail].lock);
+  // packetized frames are ready to be sent
+  poller.register_event(encoder.encoded_notifier(), Poller::In,
+    [&]()
+    {
+      encoder.collect_encoded_frames();
 
-      frame_ring_tail = (frame_ring_tail + 1) % FRAME_RING_SIZE;
-      pthread_mutex_unlock(&frame_ring_mutex);
+      // interested in socket being writable if there are datagrams to send
+      if (not encoder.send_buf().empty()) {
+        poller.activate(udp_sock, Poller::Out);
+      }
+    }
+  );
 
-      // cerr << "Read raw frame from ring buffer: index=" << frame_ring_tail << endl;
+  // fires when the pacer has tokens for the next datagram again
+  Timerfd pace_timer;
 
-      // compress 'raw_img' into frame 'frame_id' and packetize it
-      encoder.compress_frame(raw_img);
+  poller.register_event(pace_timer, Poller::In,
+    [&]()
+    {
+      if (pace_timer.read_expirations() == 0) {
+        return;
+      }
 
-      // interested in socket being writable if there are datagrams to send
       if (not encoder.send_buf().empty()) {
         poller.activate(udp_sock, Poller::Out);
       }
     }
   );
 
+  // headers of the datagrams being sent, and the datagrams as header and
+  // payload pieces; kept across calls to reuse their memory
+  vector<string> batch_headers;
+  vector<UDPSocket::Gather> batch;
+
   // when UDP socket is writable
   poller.register_event(udp_sock, Poller::Out,
     [&]()
     {
       deque<Datagram> & send_buf = encoder.send_buf();
+      bool pacing = false;  // waiting for the pacer rather than the socket
+      bool blocked = false; // EWOULDBLOCK
+
+      while (not send_buf.empty() and not pacing and not blocked) {
+        const uint64_t now = timestamp_us();
+        batch_headers.clear();
+        size_t batch_bytes = 0;
+
+        // take as many datagrams from the front as the pacer allows; they
+        // are only charged to it once they are actually sent
+        for (auto & datagram : send_buf) {
+          if (batch_headers.size() == MAX_SEND_BATCH) {
+            break;
+          }
 
-      while (not send_buf.empty()) {
-        auto & datagram = send_buf.front();
+          const size_t wire_size = Datagram::HEADER_SIZE + datagram.payload.size();
+
+          // retransmissions (queued in front) do not wait for the pacer
+          if (pacer and datagram.num_rtx == 0) {
+            const uint64_t wait_us = pacer->wait_us(wire_size, now, batch_bytes);
+            if (wait_us > 0) {
+              const timespec wait {static_cast<time_t>(wait_us / 1000000),
+                                   static_cast<long>(wait_us % 1000000 * 1000)};
+              pace_timer.set_time(wait, {0, 0});
+              pacing = true;
+              break;
+            }
+          }
+
+          // timestamp the sending time before sending
+          datagram.send_ts = now;
+          batch_headers.push_back(datagram.serialize_header());
+          batch_bytes += wire_size;
+        }
+
+        if (batch_headers.empty()) {
+          break;
+        }
+
+        batch.clear();
+        for (size_t i = 0; i < batch_headers.size(); i++) {
+          batch.push_back({batch_headers[i], send_buf[i].payload});
+        }
+
+        // the whole batch in one or a few syscalls
+        const size_t num_sent = udp_sock.send_batch(batch);
+        size_t sent_bytes = 0;
 
-        // timestamp the sending time before sending
-        datagram.send_ts = timestamp_us();
+        for (size_t i = 0; i < num_sent; i++) {
+          auto & datagram = send_buf.front();
+          sent_bytes += Datagram::HEADER_SIZE + datagram.payload.size();
 
-        if (udp_sock.send(datagram.serialize_to_string())) {
           if (verbose) {
             cerr << "Sent datagram: frame_id=" << datagram.frame_id
                  << " frag_id=" << datagram.frag_id
@@ -266,20 +646,31 @@ int main(int argc, char * argv[])
                  << " rtx=" << datagram.num_rtx << endl;
           }
 
-          // move the sent datagram to unacked if not a retransmission
-          if (datagram.num_rtx == 0) {
+          // move the sent datagram to unacked if not a retransmission;
+          // parity is never retransmitted
+          if (datagram.num_rtx == 0 and not datagram.is_parity()) {
             encoder.add_unacked(move(datagram));
           }
 
           send_buf.pop_front();
-        } else { // EWOULDBLOCK; try again later
-          datagram.send_ts = 0; // since it wasn't sent successfully
-          break;
+        }
+
+        // datagrams left behind by EWOULDBLOCK have not used any tokens
+        if (pacer) {
+          pacer->on_sent(sent_bytes, now);
+        }
+
+        if (num_sent < batch.size()) { // EWOULDBLOCK; try again later
+          for (size_t i = 0; i < batch.size() - num_sent; i++) {
+            send_buf[i].send_ts = 0; // since it wasn't sent successfully
+          }
+          blocked = true;
         }
       }
 
       // not interested in socket being writable if no datagrams to send
-      if (send_buf.empty()) {
+      // (or none until 'pace_timer' fires)
+      if (send_buf.empty() or pacing) {
         poller.deactivate(udp_sock, Poller::Out);
       }
     }
@@ -311,7 +702,7 @@ int main(int argc, char * argv[])
 
         if (ack->carry_info == 1){
           cerr << "[Feedback] Bitrate feedback (kbps): " << static_cast<double>(ack->actual_bitrate)/100.0 << endl;
-          // encoder.set_target_bitrate(ack->actual_bitrate);
+          rate_controller->on_goodput(ack->actual_bitrate / 100.0);
         }
 
         // RTT estimation, retransmission, etc.
@@ -325,6 +716,42 @@ int main(int argc, char * argv[])
     }
   );
 
+  // update the target bitrate from the ACKs of every interval
+  Timerfd rate_timer;
+  const timespec rate_interval {0, RATE_CONTROL_INTERVAL_MS * 1000 * 1000};
+  rate_timer.set_time(rate_interval, rate_interval);
+
+  poller.register_event(rate_timer, Poller::In,
+    [&]()
+    {
+      const auto expirations = rate_timer.read_expirations();
+      if (expirations == 0) {
+        return;
+      }
+
+      const unsigned int bitrate = rate_controller->update(
+          encoder.take_ack_feedback(), expirations * RATE_CONTROL_INTERVAL_MS);
+
+      if (bitrate != current_bitrate) {
+        encoder.set_target_bitrate(bitrate);
+        current_bitrate = bitrate;
+
+        if (pacer) {
+          pacer->set_rate(pacing_gain * bitrate);
+        }
+
+        if (verbose) {
+          cerr << "Rate control (" << rate_controller->name()
+               << "): target bitrate " << bitrate << " kbps";
+          if (const auto gcc = dynamic_cast<GccRateController *>(rate_controller.get())) {
+            cerr << ", " << to_string(gcc->usage());
+          }
+          cerr << endl;
+        }
+      }
+    }
+  );
+
   // create a periodic timer for outputting stats every second
   Timerfd stats_timer;
   const timespec stats_interval {1, 0};
@@ -339,6 +766,9 @@ int main(int argc, char * argv[])
 
       // output stats every second
       encoder.output_periodic_stats();
+      frame_ring.output_periodic_stats();
+      cerr << "  - Target bitrate (kbps): " << current_bitrate
+           << " (" << rate_controller->name() << ")" << endl;
     }
   );
 
@@ -348,5 +778,14 @@ int main(int argc, char * argv[])
     poller.poll(-1);
   }
 
+  // the I/O loop no longer collects encoded frames, so the encoder thread
+  // must not wait for it
+  encoder.stop();
+  encoder_thread.join();
+
+  // stop the capture thread before the ring and source it feeds go away
+  run = 0;
+  pthread_join(cap_tid, nullptr);
+
   return EXIT_SUCCESS;
 }
\ No newline at end of file
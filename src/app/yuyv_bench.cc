@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "conversion.hh"
+#include "image.hh"
+#include "resolution_tiers.hh"
+#include "yuyv.hh"
+
+using namespace std;
+using namespace chrono;
+
+namespace {
+
+// convert a YUYV frame to I420 'num_frames' times with 'kernel' and return
+// the frames per second it converted
+double convert_fps(const string & kernel, const ResolutionTier & tier,
+                   const unsigned num_frames)
+{
+  const size_t stride = 2 * tier.width;
+  vector<uint8_t> src(stride * tier.height);
+
+  // a smooth gradient; the kernels do not branch on pixel values
+  for (size_t i = 0; i < src.size(); i++) {
+    src[i] = static_cast<uint8_t>(i * 7 / 5);
+  }
+
+  RawImage raw_img(tier.width, tier.height);
+
+  // warm up the caches and page in the destination
+  yuyv_to_i420_with(kernel, src.data(), stride, raw_img);
+
+  const auto start = steady_clock::now();
+
+  for (unsigned i = 0; i < num_frames; i++) {
+    yuyv_to_i420_with(kernel, src.data(), stride, raw_img);
+  }
+
+  const double elapsed_s = duration<double>(steady_clock::now() - start).count();
+  return num_frames / elapsed_s;
+}
+
+} // namespace
+
+// frames per second and input bandwidth of every YUYV to I420 kernel this
+// CPU supports on one core, for each resolution tier
+int main(int argc, char * argv[])
+{
+  if (argc > 2) {
+    cerr << "Usage: " << argv[0] << " [frames per run]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const unsigned num_frames = argc > 1 ? strict_stoi(argv[1]) : 100;
+
+  cout << "resolution,target_fps,kernel,fps,MB/s,real_time" << endl;
+
+  for (const auto & tier : RESOLUTION_TIERS) {
+    for (const auto & kernel : yuyv_kernel_names()) {
+      const double fps = convert_fps(kernel, tier, num_frames);
+      const double mb_per_s = fps * 2.0 * tier.width * tier.height / 1e6;
+
+      cout << tier.width << "x" << tier.height << "," << tier.fps << ","
+           << kernel << "," << double_to_string(fps) << ","
+           << double_to_string(mb_per_s) << ","
+           << (fps >= tier.fps ? "yes" : "no") << endl;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
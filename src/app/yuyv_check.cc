@@ -0,0 +1,185 @@
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "image.hh"
+#include "yuyv.hh"
+
+using namespace std;
+
+namespace {
+
+// poisons the planes so that rows a band must not write stand out
+constexpr uint8_t UNTOUCHED = 0xA5;
+
+// widths around every vector length's tail (16, 32 and 64 pixels), and
+// heights with a lone last row
+constexpr unsigned widths[] = { 2, 4, 30, 32, 34, 62, 64, 66, 94, 126, 128,
+                                130, 190, 642, 1280 };
+constexpr unsigned heights[] = { 1, 2, 3, 4, 5, 7, 16, 17, 33, 67 };
+constexpr unsigned band_counts[] = { 1, 2, 3, 4, 7 };
+
+// a YUYV image of random pixels whose rows are padded by an odd number of
+// bytes, so that no row but the first is aligned
+struct YuyvImage
+{
+  unsigned width, height;
+  size_t stride;
+  vector<uint8_t> data;
+
+  YuyvImage(const unsigned w, const unsigned h, mt19937 & rng)
+    : width(w), height(h), stride(2 * w + 7), data(stride * h)
+  {
+    uniform_int_distribution<unsigned> byte(0, 255);
+    for (auto & b : data) {
+      b = byte(rng);
+    }
+  }
+};
+
+void poison(RawImage & img)
+{
+  const unsigned chroma_height = (img.display_height() + 1) / 2;
+
+  memset(img.y_plane(), UNTOUCHED, img.y_stride() * img.display_height());
+  memset(img.u_plane(), UNTOUCHED, img.u_stride() * chroma_height);
+  memset(img.v_plane(), UNTOUCHED, img.v_stride() * chroma_height);
+}
+
+// first plane and row where 'a' and 'b' differ over rows [row_begin,
+// row_end) of the image, or the empty string
+string compare(const RawImage & a, const RawImage & b,
+               const unsigned row_begin, const unsigned row_end)
+{
+  const unsigned width = a.display_width();
+
+  for (unsigned row = row_begin; row < row_end; row++) {
+    if (memcmp(a.y_plane() + row * a.y_stride(),
+               b.y_plane() + row * b.y_stride(), width) != 0) {
+      return "Y row " + to_string(row);
+    }
+  }
+
+  // a lone last luma row has a chroma row of its own
+  for (unsigned row = (row_begin + 1) / 2; row < (row_end + 1) / 2; row++) {
+    if (memcmp(a.u_plane() + row * a.u_stride(),
+               b.u_plane() + row * b.u_stride(), width / 2) != 0) {
+      return "U row " + to_string(row);
+    }
+
+    if (memcmp(a.v_plane() + row * a.v_stride(),
+               b.v_plane() + row * b.v_stride(), width / 2) != 0) {
+      return "V row " + to_string(row);
+    }
+  }
+
+  return {};
+}
+
+// same row split as the capture thread's conversion bands
+unsigned band_row(const unsigned k, const unsigned num_bands,
+                  const unsigned height)
+{
+  return k == num_bands ? height : k * (height / 2) / num_bands * 2;
+}
+
+// convert 'src' with 'kernel' in 'num_bands' bands and compare it with
+// 'expected'; also check that converting each band alone leaves every
+// other row untouched
+bool check(const string & kernel, const YuyvImage & src,
+           const unsigned num_bands, const RawImage & expected)
+{
+  const string label = kernel + " " + to_string(src.width) + "x"
+                       + to_string(src.height) + " in "
+                       + to_string(num_bands) + " band(s): ";
+
+  RawImage banded(src.width, src.height);
+  poison(banded);
+
+  RawImage untouched(src.width, src.height);
+  poison(untouched);
+
+  for (unsigned k = 0; k < num_bands; k++) {
+    const unsigned begin = band_row(k, num_bands, src.height);
+    const unsigned end = band_row(k + 1, num_bands, src.height);
+
+    // row_end = 0 would mean the whole image
+    if (begin == end) {
+      continue;
+    }
+
+    yuyv_to_i420_with(kernel, src.data.data(), src.stride, banded, begin, end);
+
+    RawImage alone(src.width, src.height);
+    poison(alone);
+    yuyv_to_i420_with(kernel, src.data.data(), src.stride, alone, begin, end);
+
+    const string inside = compare(alone, expected, begin, end);
+    const string before = compare(alone, untouched, 0, begin);
+    const string after = compare(alone, untouched, end, src.height);
+
+    if (not inside.empty() or not before.empty() or not after.empty()) {
+      cerr << label << "band [" << begin << ", " << end << ") wrong at "
+           << (not inside.empty() ? inside
+               : "untouched " + (before.empty() ? after : before)) << endl;
+      return false;
+    }
+  }
+
+  const string mismatch = compare(banded, expected, 0, src.height);
+  if (not mismatch.empty()) {
+    cerr << label << "differs from scalar at " << mismatch << endl;
+    return false;
+  }
+
+  return true;
+}
+
+} // namespace
+
+// compare every YUYV to I420 kernel this CPU supports with the scalar one,
+// byte for byte, over awkward sizes and conversion bands
+int main(int argc, char * argv[])
+{
+  if (argc > 1) {
+    cerr << "Usage: " << argv[0] << endl;
+    return EXIT_FAILURE;
+  }
+
+  const vector<string> kernels = yuyv_kernel_names();
+
+  cout << "Kernels:";
+  for (const auto & kernel : kernels) {
+    cout << " " << kernel;
+  }
+  cout << " (selected: " << yuyv_kernel_name() << ")" << endl;
+
+  mt19937 rng(20240501);
+  unsigned num_checks = 0, num_failed = 0;
+
+  for (const unsigned width : widths) {
+    for (const unsigned height : heights) {
+      const YuyvImage src(width, height, rng);
+
+      RawImage expected(width, height);
+      poison(expected);
+      yuyv_to_i420_with("scalar", src.data.data(), src.stride, expected);
+
+      for (const auto & kernel : kernels) {
+        for (const unsigned num_bands : band_counts) {
+          num_checks++;
+          if (not check(kernel, src, num_bands, expected)) {
+            num_failed++;
+          }
+        }
+      }
+    }
+  }
+
+  cout << num_checks - num_failed << "/" << num_checks << " checks passed"
+       << endl;
+
+  return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,32 @@
+#include "eventfd.hh"
+#include "exception.hh"
+
+using namespace std;
+
+Eventfd::Eventfd(int flags)
+  : FileDescriptor(check_syscall(eventfd(0, flags)))
+{}
+
+void Eventfd::signal(const uint64_t count)
+{
+  if (check_syscall(::write(fd_num(), &count, sizeof(count)))
+      != sizeof(count)) {
+    throw runtime_error("write error in eventfd");
+  }
+}
+
+uint64_t Eventfd::read_count()
+{
+  uint64_t count = 0;
+
+  const ssize_t bytes_read = ::read(fd_num(), &count, sizeof(count));
+  if (bytes_read < 0 and errno == EAGAIN) {
+    return 0; // counter is zero in non-blocking mode
+  }
+
+  if (check_syscall(bytes_read) != sizeof(count)) {
+    throw runtime_error("read error in eventfd");
+  }
+
+  return count;
+}
@@ -0,0 +1,20 @@
+#ifndef EVENTFD_HH
+#define EVENTFD_HH
+
+#include <sys/eventfd.h>
+
+#include "file_descriptor.hh"
+
+class Eventfd : public FileDescriptor
+{
+public:
+  Eventfd(int flags = EFD_NONBLOCK);
+
+  // add 'count' to the counter, making the fd readable
+  void signal(const uint64_t count = 1);
+
+  // read and reset the counter; 0 indicates it had not been signalled
+  uint64_t read_count();
+};
+
+#endif /* EVENTFD_HH */
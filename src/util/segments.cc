@@ -0,0 +1,82 @@
+#include <unistd.h>
+#include <cstdio>
+#include <iostream>
+
+#include "segments.hh"
+
+using namespace std;
+using namespace chrono;
+
+SegmentRotator::SegmentRotator(const string & path,
+                               const SegmentLimits & limits)
+  : stem_(path), extension_(), limits_(limits),
+    started_(steady_clock::now())
+{
+  // split off the extension unless the last dot is part of a directory
+  const size_t dot = path.rfind('.');
+  const size_t slash = path.rfind('/');
+  if (dot != string::npos and (slash == string::npos or dot > slash)) {
+    stem_ = path.substr(0, dot);
+    extension_ = path.substr(dot);
+  }
+
+  current_ = limits_.rotating() ? segment_path(0) : path;
+}
+
+string SegmentRotator::segment_path(const unsigned index) const
+{
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), "_%04u", index);
+  return stem_ + suffix + extension_;
+}
+
+bool SegmentRotator::due(const uint64_t bytes) const
+{
+  if (limits_.max_bytes > 0 and bytes >= limits_.max_bytes) {
+    return true;
+  }
+
+  return limits_.max_seconds > 0 and
+         steady_clock::now() - started_ >= seconds(limits_.max_seconds);
+}
+
+const string & SegmentRotator::rotate(const uint64_t bytes)
+{
+  closed_.emplace_back(current_, bytes);
+  closed_bytes_ += bytes;
+
+  // leave room for the next segment, assuming it grows as large as this one,
+  // but always keep the segment just closed: with a budget below two
+  // segments, the recording would otherwise never outlive the one being
+  // written
+  while (limits_.budget_bytes > 0 and closed_.size() > 1 and
+         closed_bytes_ + bytes > limits_.budget_bytes) {
+    evict_oldest();
+  }
+
+  current_ = segment_path(++index_);
+  started_ = steady_clock::now();
+
+  return current_;
+}
+
+bool SegmentRotator::evict_oldest()
+{
+  if (closed_.empty()) {
+    return false;
+  }
+
+  const auto & [oldest, size] = closed_.front();
+
+  if (unlink(oldest.c_str()) < 0) {
+    perror(("unlink " + oldest).c_str());
+  }
+  unlink((oldest + ".idx").c_str()); // not every recording has an index
+
+  cerr << "Deleted segment " << oldest << " to make room on disk" << endl;
+
+  closed_bytes_ -= size;
+  closed_.pop_front();
+
+  return true;
+}
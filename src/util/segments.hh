@@ -0,0 +1,64 @@
+#ifndef SEGMENTS_HH
+#define SEGMENTS_HH
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+
+// when a recording moves on to a new segment and how much it may keep;
+// all zeros records a single unbounded file
+struct SegmentLimits
+{
+  uint64_t max_bytes {0};    // rotate once a segment reaches this size
+  unsigned max_seconds {0};  // rotate once a segment spans this long
+  uint64_t budget_bytes {0}; // delete the oldest segments beyond this total
+
+  bool rotating() const { return max_bytes > 0 or max_seconds > 0; }
+};
+
+// Names the segments of a recording at 'path' ("dir/name.ext" becomes
+// "dir/name_0000.ext", "dir/name_0001.ext", ...; without rotation the only
+// segment is 'path' itself), decides when the current one is due, and
+// deletes the oldest closed segments, with their ".idx" files, once they
+// would take up more than the budget. Writers rotate only where a
+// segment can start (e.g., on a key frame).
+class SegmentRotator
+{
+public:
+  SegmentRotator(const std::string & path, const SegmentLimits & limits);
+
+  // path of the segment being written
+  const std::string & current() const { return current_; }
+
+  // whether the current segment, 'bytes' long so far, should be closed
+  bool due(const uint64_t bytes) const;
+
+  // close the current segment at its final size 'bytes' and return the
+  // path of the next one
+  const std::string & rotate(const uint64_t bytes);
+
+  // delete the oldest closed segment now (e.g., when the disk runs low);
+  // false if there is none
+  bool evict_oldest();
+
+  const SegmentLimits & limits() const { return limits_; }
+
+private:
+  std::string stem_;
+  std::string extension_;
+  SegmentLimits limits_;
+
+  unsigned index_ {0};
+  std::string current_ {};
+  std::chrono::steady_clock::time_point started_;
+
+  // closed segments, oldest first, and their total size
+  std::deque<std::pair<std::string, uint64_t>> closed_ {};
+  uint64_t closed_bytes_ {0};
+
+  std::string segment_path(const unsigned index) const;
+};
+
+#endif /* SEGMENTS_HH */
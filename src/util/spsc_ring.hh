@@ -0,0 +1,134 @@
+#ifndef SPSC_RING_HH
+#define SPSC_RING_HH
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+// bounded lock-free queue between exactly one producer thread and one
+// consumer thread; a slot is published with a release store of the index
+// that covers it and observed with an acquire load, so neither side ever
+// takes a lock or makes a syscall. The producer may also take back the
+// oldest item to make room (drop_oldest); since both ends can then advance
+// the tail, the tail moves by compare-and-swap and slots are atomic
+template<typename T>
+class SPSCRing
+{
+  static_assert(std::is_trivially_copyable<T>::value,
+                "SPSCRing: T must be trivially copyable");
+
+public:
+  explicit SPSCRing(const size_t capacity)
+    : capacity_(capacity), slots_(std::make_unique<std::atomic<T>[]>(capacity))
+  {
+    if (capacity == 0) {
+      throw std::runtime_error("SPSCRing: capacity must be positive");
+    }
+  }
+
+  // producer only: enqueue 'item'; return false if the ring is full
+  bool push(const T & item)
+  {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+
+    if (head - cached_tail_ >= capacity_) {
+      // refresh the (possibly stale) view of the consumer's progress
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head - cached_tail_ >= capacity_) {
+        return false;
+      }
+    }
+
+    slots_[head % capacity_].store(item, std::memory_order_relaxed);
+    head_.store(head + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  // consumer only: dequeue into 'item'; return false if the ring is empty
+  bool pop(T & item)
+  {
+    uint64_t tail = tail_.load(std::memory_order_acquire);
+
+    while (true) {
+      // the producer may have dropped items past the cached head
+      if (tail >= cached_head_) {
+        // refresh the (possibly stale) view of the producer's progress
+        cached_head_ = head_.load(std::memory_order_acquire);
+        if (tail >= cached_head_) {
+          return false;
+        }
+      }
+
+      // the slot is read before the tail is claimed; if the producer
+      // dropped it in the meantime, the claim fails and 'tail' is reloaded.
+      // 'item' is only written once the claim succeeds
+      const T claimed = slots_[tail % capacity_].load(std::memory_order_relaxed);
+      if (tail_.compare_exchange_weak(tail, tail + 1,
+                                      std::memory_order_acq_rel,
+                                      std::memory_order_acquire)) {
+        item = claimed;
+        return true;
+      }
+    }
+  }
+
+  // producer only: dequeue the oldest item into 'item', racing the consumer
+  // for it; return false, with 'item' untouched, if the ring is empty or
+  // the consumer took the last item first
+  bool drop_oldest(T & item)
+  {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t tail = tail_.load(std::memory_order_acquire);
+
+    while (tail != head) {
+      // the slot may belong to the consumer by the time the claim fails
+      const T claimed = slots_[tail % capacity_].load(std::memory_order_relaxed);
+      if (tail_.compare_exchange_weak(tail, tail + 1,
+                                      std::memory_order_acq_rel,
+                                      std::memory_order_acquire)) {
+        item = claimed;
+        cached_tail_ = tail + 1;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // a snapshot only; either side may move on right after it is taken
+  size_t size() const
+  {
+    const uint64_t tail = tail_.load(std::memory_order_acquire);
+    return head_.load(std::memory_order_acquire) - tail;
+  }
+
+  bool empty() const { return size() == 0; }
+  size_t capacity() const { return capacity_; }
+
+  // forbid copying and moving
+  SPSCRing(const SPSCRing & other) = delete;
+  const SPSCRing & operator=(const SPSCRing & other) = delete;
+  SPSCRing(SPSCRing && other) = delete;
+  SPSCRing & operator=(SPSCRing && other) = delete;
+
+private:
+  static constexpr size_t CACHE_LINE = 64;
+
+  // written by the producer only
+  alignas(CACHE_LINE) std::atomic<uint64_t> head_ {0};
+  uint64_t cached_tail_ {0};
+
+  // written by the consumer (and by the producer in drop_oldest)
+  alignas(CACHE_LINE) std::atomic<uint64_t> tail_ {0};
+  uint64_t cached_head_ {0};
+
+  // read-mostly; kept off the two index cache lines above
+  alignas(CACHE_LINE) const size_t capacity_;
+  std::unique_ptr<std::atomic<T>[]> slots_;
+};
+
+#endif /* SPSC_RING_HH */
@@ -1,3 +1,6 @@
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <cstring>
 #include <vector>
 #include <stdexcept>
 
@@ -45,6 +48,142 @@ bool UDPSocket::sendto(const Address & dst_addr, const string_view data)
   return check_bytes_sent(bytes_sent, data.size());
 }
 
+void UDPSocket::prepare_batch(const vector<Gather> & datagrams,
+                              const size_t first)
+{
+  msgs_.clear();
+  iovs_.clear();
+  msg_datagrams_.clear();
+  msg_bytes_.clear();
+  msg_iovs_.clear();
+
+  // iovecs first, since 'msgs_' points into them once they stop growing
+  size_t i = first;
+  while (i < datagrams.size() and msg_datagrams_.size() < MAX_BATCH) {
+    const size_t segment_size = datagrams[i].size();
+    if (segment_size == 0) {
+      throw runtime_error("attempted to send empty data");
+    }
+
+    if (segment_size > MAX_GSO_BYTES) {
+      throw runtime_error("UDPSocket: datagram too large");
+    }
+
+    // with GSO, a run of datagrams as large as the first, except that the
+    // last one may be shorter
+    size_t j = i, bytes = 0;
+    const size_t iovs_before = iovs_.size();
+    do {
+      const size_t size = datagrams[j].size();
+      if (size == 0 or size > segment_size or bytes + size > MAX_GSO_BYTES) {
+        break;
+      }
+
+      for (const auto piece : { datagrams[j].header, datagrams[j].payload }) {
+        if (not piece.empty()) {
+          iovs_.push_back({const_cast<char *>(piece.data()), piece.size()});
+        }
+      }
+
+      bytes += size;
+      j++;
+
+      if (size < segment_size) {
+        break;
+      }
+    } while (*gso_ and j < datagrams.size() and j - i < MAX_GSO_SEGMENTS);
+
+    msg_datagrams_.push_back(j - i);
+    msg_bytes_.push_back(bytes);
+    msg_iovs_.push_back(iovs_.size() - iovs_before);
+    i = j;
+  }
+
+  controls_.resize(msg_datagrams_.size());
+  msgs_.resize(msg_datagrams_.size());
+
+  size_t iov_index = 0, datagram_index = first;
+  for (size_t m = 0; m < msgs_.size(); m++) {
+    msghdr & hdr = msgs_[m].msg_hdr;
+    hdr = {};
+    msgs_[m].msg_len = 0;
+
+    hdr.msg_iov = &iovs_[iov_index];
+    hdr.msg_iovlen = msg_iovs_[m];
+    iov_index += msg_iovs_[m];
+
+#ifdef UDP_SEGMENT
+    // tell the kernel where to split a run
+    if (msg_datagrams_[m] > 1) {
+      hdr.msg_control = controls_[m].buf;
+      hdr.msg_controllen = sizeof(controls_[m].buf);
+
+      cmsghdr * cmsg = CMSG_FIRSTHDR(&hdr);
+      cmsg->cmsg_level = SOL_UDP;
+      cmsg->cmsg_type = UDP_SEGMENT;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+
+      const uint16_t segment_size = datagrams[datagram_index].size();
+      memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+    }
+#endif
+
+    datagram_index += msg_datagrams_[m];
+  }
+}
+
+size_t UDPSocket::send_batch(const vector<Gather> & datagrams)
+{
+  if (not gso_) {
+#ifdef UDP_SEGMENT
+    // supported since Linux 4.18
+    int segment_size = 0;
+    socklen_t len = sizeof(segment_size);
+    gso_ = ::getsockopt(fd_num(), SOL_UDP, UDP_SEGMENT,
+                        &segment_size, &len) == 0;
+#else
+    gso_ = false;
+#endif
+  }
+
+  size_t num_sent = 0;
+
+  while (num_sent < datagrams.size()) {
+    prepare_batch(datagrams, num_sent);
+
+    const int num_msgs = ::sendmmsg(fd_num(), msgs_.data(), msgs_.size(), 0);
+
+    if (num_msgs < 0) {
+      if (errno == EWOULDBLOCK) {
+        return num_sent;
+      }
+
+      // the route's device cannot segment (e.g., no checksum offload)
+      if (*gso_ and (errno == EIO or errno == EINVAL)) {
+        gso_ = false;
+        continue;
+      }
+
+      throw unix_error("UDPSocket:send_batch()");
+    }
+
+    for (int m = 0; m < num_msgs; m++) {
+      if (msgs_[m].msg_len != msg_bytes_[m]) {
+        throw runtime_error("UDPSocket failed to deliver target number of bytes");
+      }
+
+      num_sent += msg_datagrams_[m];
+    }
+
+    // the socket buffer filled up
+    if (static_cast<size_t>(num_msgs) < msgs_.size()) {
+      return num_sent;
+    }
+  }
+
+  return num_sent;
+}
+
 bool UDPSocket::check_bytes_received(const ssize_t bytes_received) const
 {
   if (bytes_received < 0) {
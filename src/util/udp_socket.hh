@@ -1,10 +1,12 @@
 #ifndef UDP_SOCKET_HH
 #define UDP_SOCKET_HH
 
+#include <sys/socket.h>
 #include <string>
 #include <string_view>
 #include <utility>
 #include <optional>
+#include <vector>
 
 #include "socket.hh"
 #include "address.hh"
@@ -20,6 +22,25 @@ public:
   bool send(const std::string_view data);
   bool sendto(const Address & dst_addr, const std::string_view data);
 
+  // a datagram in two pieces (e.g., header and payload) that are sent back
+  // to back without being concatenated first
+  struct Gather
+  {
+    std::string_view header {};
+    std::string_view payload {};
+
+    size_t size() const { return header.size() + payload.size(); }
+  };
+
+  // send 'datagrams' in order to the connected address in as few syscalls
+  // as possible: one sendmmsg() for up to MAX_BATCH messages, where each
+  // message is, with UDP GSO (UDP_SEGMENT) where the kernel supports it, a
+  // run of equally sized datagrams that the kernel (or NIC) splits up;
+  // return how many datagrams were sent before EWOULDBLOCK
+  size_t send_batch(const std::vector<Gather> & datagrams);
+
+  static constexpr size_t MAX_BATCH = 64; // messages per sendmmsg()
+
   // receive a datagram (*supposedly* from a connected address)
   // return nullopt to indicate EWOULDBLOCK in nonblocking I/O mode
   std::optional<std::string> recv();
@@ -32,6 +53,28 @@ private:
   bool check_bytes_received(const ssize_t bytes_received) const;
 
   static constexpr size_t UDP_MTU = 65536; // bytes
+
+  // a run of datagrams sent as one GSO message is limited by the kernel
+  static constexpr size_t MAX_GSO_SEGMENTS = 64;
+  static constexpr size_t MAX_GSO_BYTES = 65507;
+
+  // whether UDP GSO works on this socket; probed on first use
+  std::optional<bool> gso_ {};
+
+  // reused by send_batch() to avoid allocations
+  struct GsoControl
+  {
+    alignas(cmsghdr) char buf[CMSG_SPACE(sizeof(uint16_t))];
+  };
+  std::vector<mmsghdr> msgs_ {};
+  std::vector<iovec> iovs_ {};
+  std::vector<GsoControl> controls_ {};
+  std::vector<size_t> msg_datagrams_ {}; // datagrams in each message
+  std::vector<size_t> msg_bytes_ {};
+  std::vector<size_t> msg_iovs_ {};
+
+  // the messages (and their datagram runs) for datagrams[first...]
+  void prepare_batch(const std::vector<Gather> & datagrams, const size_t first);
 };
 
 #endif /* UDP_SOCKET_HH */
@@ -0,0 +1,93 @@
+#include "worker_pool.hh"
+
+using namespace std;
+
+WorkerPool::WorkerPool(const size_t num_workers)
+{
+  workers_.reserve(num_workers);
+  for (size_t i = 0; i < num_workers; i++) {
+    workers_.emplace_back(&WorkerPool::worker_main, this);
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    lock_guard<mutex> lock(mtx_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+
+  for (auto & worker : workers_) {
+    worker.join();
+  }
+}
+
+void WorkerPool::run(const size_t num_tasks, const Task & task)
+{
+  if (num_tasks == 0) {
+    return;
+  }
+
+  unique_lock<mutex> lock(mtx_);
+  task_ = &task;
+  num_tasks_ = num_tasks;
+  next_task_ = 0;
+  unfinished_ = num_tasks;
+  error_ = nullptr;
+  const uint64_t batch = ++batch_;
+
+  if (not workers_.empty()) {
+    work_cv_.notify_all();
+  }
+
+  // the caller works on the batch too, then waits for the stragglers
+  work_on(lock, batch);
+  done_cv_.wait(lock, [this] { return unfinished_ == 0; });
+
+  task_ = nullptr;
+  if (error_) {
+    rethrow_exception(error_);
+  }
+}
+
+void WorkerPool::work_on(unique_lock<mutex> & lock, const uint64_t batch)
+{
+  while (batch_ == batch and next_task_ < num_tasks_) {
+    const size_t task_index = next_task_++;
+    const Task & task = *task_;
+
+    lock.unlock();
+    exception_ptr error;
+    try {
+      task(task_index);
+    } catch (...) {
+      error = current_exception();
+    }
+    lock.lock();
+
+    if (error and not error_) {
+      error_ = error;
+    }
+
+    if (--unfinished_ == 0) {
+      done_cv_.notify_all();
+    }
+  }
+}
+
+void WorkerPool::worker_main()
+{
+  unique_lock<mutex> lock(mtx_);
+  uint64_t last_batch = batch_;
+
+  while (true) {
+    work_cv_.wait(lock, [&] { return stop_ or batch_ != last_batch; });
+    if (stop_) {
+      return;
+    }
+
+    last_batch = batch_;
+    work_on(lock, last_batch);
+  }
+}
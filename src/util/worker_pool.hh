@@ -0,0 +1,58 @@
+#ifndef WORKER_POOL_HH
+#define WORKER_POOL_HH
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// persistent threads that work through batches of indexed tasks; the thread
+// calling run() takes part in the batch and returns once every task is done
+class WorkerPool
+{
+public:
+  using Task = std::function<void(const size_t task_index)>;
+
+  // spawn 'num_workers' threads in addition to the calling thread
+  explicit WorkerPool(const size_t num_workers);
+  ~WorkerPool();
+
+  // number of threads working on a batch, including the caller
+  size_t concurrency() const { return workers_.size() + 1; }
+
+  // run task(0), ..., task(num_tasks - 1) in parallel and wait for all;
+  // rethrows the first exception thrown by any of the tasks
+  void run(const size_t num_tasks, const Task & task);
+
+  // forbid copying and moving
+  WorkerPool(const WorkerPool & other) = delete;
+  const WorkerPool & operator=(const WorkerPool & other) = delete;
+  WorkerPool(WorkerPool && other) = delete;
+  WorkerPool & operator=(WorkerPool && other) = delete;
+
+private:
+  std::vector<std::thread> workers_ {};
+
+  // current batch; tasks are claimed under the lock so that a straggler
+  // can never pick up an index that belongs to the next batch
+  std::mutex mtx_ {};
+  std::condition_variable work_cv_ {};
+  std::condition_variable done_cv_ {};
+  const Task * task_ {nullptr};
+  size_t num_tasks_ {0};
+  size_t next_task_ {0};
+  size_t unfinished_ {0};
+  uint64_t batch_ {0};
+  std::exception_ptr error_ {};
+  bool stop_ {false};
+
+  // claim and run tasks of batch 'batch' until none is left
+  void work_on(std::unique_lock<std::mutex> & lock, const uint64_t batch);
+
+  void worker_main();
+};
+
+#endif /* WORKER_POOL_HH */
@@ -2,6 +2,7 @@
 #include <stdexcept>
 
 #include "image.hh"
+#include "yuyv.hh"
 
 using namespace std;
 
@@ -25,17 +26,47 @@ RawImage::RawImage(vpx_image_t * const vpx_img)
     throw runtime_error("RawImage: unable to construct from a null vpx_img");
   }
 
-  if (vpx_img->fmt != VPX_IMG_FMT_I420) {
-    throw runtime_error("RawImage: only supports I420");
+  if (vpx_img->fmt != VPX_IMG_FMT_I420 and vpx_img->fmt != VPX_IMG_FMT_NV12) {
+    throw runtime_error("RawImage: only supports I420 and NV12");
   }
 
   display_width_ = vpx_img->d_w;
   display_height_ = vpx_img->d_h;
 }
 
+// constructor that owns a vpx_image wrapped around external memory
+RawImage::RawImage(const uint16_t display_width, const uint16_t display_height,
+                   uint8_t * const buffer, const vpx_img_fmt_t format)
+  : vpx_img_(nullptr),
+    own_vpx_img_(true),
+    display_width_(display_width),
+    display_height_(display_height)
+{
+  if (format != VPX_IMG_FMT_I420 and format != VPX_IMG_FMT_NV12) {
+    throw runtime_error("RawImage: only supports I420 and NV12");
+  }
+
+  vpx_img_ = vpx_img_wrap(nullptr, format, display_width, display_height,
+                          1, buffer);
+  if (not vpx_img_) {
+    throw runtime_error("RawImage: unable to wrap buffer");
+  }
+}
+
+size_t RawImage::buffer_size(const uint16_t display_width,
+                             const uint16_t display_height)
+{
+  // vpx_img_wrap rounds both dimensions up to even for 4:2:0, which takes
+  // the same space in I420 and NV12
+  const size_t w = (display_width + 1) & ~1;
+  const size_t h = (display_height + 1) & ~1;
+  return w * h * 3 / 2;
+}
+
 RawImage::~RawImage()
 {
-  // free vpx_image only if the class owns it
+  // free vpx_image only if the class owns it (the planes of a wrapped
+  // image are not freed)
   if (own_vpx_img_) {
     vpx_img_free(vpx_img_);
   }
@@ -48,50 +79,8 @@ void RawImage::copy_from_yuyv(const string_view src)
     throw runtime_error("RawImage: invalid YUYV size");
   }
 
-  uint8_t * dst_y = y_plane();
-  uint8_t * dst_u = u_plane();
-  uint8_t * dst_v = v_plane();
-
-  // copy Y plane
-  const uint8_t * p = reinterpret_cast<const uint8_t *>(src.data());
-  for (unsigned i = 0; i < y_size(); i++, p += 2) {
-    *dst_y++ = *p;
-  }
-
-  // copy U and V planes
-  p = reinterpret_cast<const uint8_t *>(src.data());
-  for (unsigned i = 0; i < display_height_ / 2; i++, p += 2 * display_width_) {
-    for (unsigned j = 0; j < display_width_ / 2; j++, p += 4) {
-      *dst_u++ = p[1];
-      *dst_v++ = p[3];
-    }
-  }
-}
-
-void RawImage::copy_from_ringbuffer(const uint8_t* src_data, size_t size) {
-  const size_t expected_size = y_size() + 2 * uv_size(); // Y + U + V
-  if (size != expected_size) {
-    throw std::runtime_error("RawImage::copy_from_ringbuffer: invalid frame size");
-  }
-
-  const uint8_t* src_y = src_data;
-  const uint8_t* src_u = src_y + y_size();
-  const uint8_t* src_v = src_u + uv_size();
-
-  // Copy Y plane
-  for (uint16_t row = 0; row < display_height_; ++row) {
-    std::memcpy(y_plane() + row * y_stride(), src_y + row * display_width_, display_width_);
-  }
-
-  // Copy U plane
-  for (uint16_t row = 0; row < display_height_ / 2; ++row) {
-    std::memcpy(u_plane() + row * u_stride(), src_u + row * display_width_ / 2, display_width_ / 2);
-  }
-
-  // Copy V plane
-  for (uint16_t row = 0; row < display_height_ / 2; ++row) {
-    std::memcpy(v_plane() + row * v_stride(), src_v + row * display_width_ / 2, display_width_ / 2);
-  }
+  yuyv_to_i420(reinterpret_cast<const uint8_t *>(src.data()),
+               2 * display_width_, *this);
 }
 
 void RawImage::copy_y_from(const string_view src)
@@ -8,7 +8,9 @@ extern "C" {
 #include <cstdint>
 #include <string_view>
 
-// wrapper class for vpx_image of format I420
+// wrapper class for vpx_image of format I420 (or NV12, which libvpx also
+// encodes directly; its interleaved chroma is at u_plane() with v_plane()
+// one byte further)
 class RawImage
 {
 public:
@@ -18,12 +20,25 @@ public:
   // hold a non-owning pointer to an existing vpx_image
   RawImage(vpx_image_t * const vpx_img);
 
+  // wrap planes of 'format' (I420 or NV12) around 'buffer' (at least
+  // buffer_size() bytes), which must outlive the image
+  RawImage(const uint16_t display_width, const uint16_t display_height,
+           uint8_t * const buffer,
+           const vpx_img_fmt_t format = VPX_IMG_FMT_I420);
+
+  // bytes needed to hold an I420 (or NV12) image of the given dimensions
+  static size_t buffer_size(const uint16_t display_width,
+                            const uint16_t display_height);
+
   // free the vpx_image only if the class owns it
   ~RawImage();
 
   // return the underlying vpx_image
   vpx_image * get_vpx_image() const { return vpx_img_; }
 
+  // VPX_IMG_FMT_I420 or VPX_IMG_FMT_NV12
+  vpx_img_fmt_t format() const { return vpx_img_->fmt; }
+
   // image dimensions
   uint16_t display_width() const { return display_width_; }
   uint16_t display_height() const { return display_height_; }
@@ -37,22 +52,23 @@ public:
   uint8_t * u_plane() const { return vpx_img_->planes[VPX_PLANE_U]; }
   uint8_t * v_plane() const { return vpx_img_->planes[VPX_PLANE_V]; }
 
+  // wall-clock time (us) the image was captured at; 0 if unknown
+  uint64_t capture_ts() const { return capture_ts_; }
+  void set_capture_ts(const uint64_t capture_ts) { capture_ts_ = capture_ts; }
+
   // stride between rows for each plane
   int y_stride() const { return vpx_img_->stride[VPX_PLANE_Y]; }
   int u_stride() const { return vpx_img_->stride[VPX_PLANE_U]; }
   int v_stride() const { return vpx_img_->stride[VPX_PLANE_V]; }
 
-  // copy image data from a YUYV-formatted buffer
+  // copy image data from a YUYV-formatted buffer (I420 only)
   void copy_from_yuyv(const std::string_view src);
 
-  // copy plane data from a buffer
+  // copy plane data from a buffer (I420 only)
   void copy_y_from(const std::string_view src);
   void copy_u_from(const std::string_view src);
   void copy_v_from(const std::string_view src);
 
-  // Copy image data from the shared ring buffer
-  void copy_from_ringbuffer(const uint8_t* src, size_t size);
-
   // forbid copy and move operators
   RawImage(const RawImage & other) = delete;
   const RawImage & operator=(const RawImage & other) = delete;
@@ -69,6 +85,9 @@ private:
   // image display dimensions
   uint16_t display_width_;
   uint16_t display_height_;
+
+  // capture timestamp carried along with the pixels
+  uint64_t capture_ts_ {0};
 };
 
 #endif /* IMAGE_HH */
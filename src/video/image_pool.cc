@@ -0,0 +1,88 @@
+#include <unistd.h>
+#include <iostream>
+#include <stdexcept>
+
+#include "image_pool.hh"
+
+using namespace std;
+
+namespace {
+
+// default huge page size on x86-64 and on 4K-page arm64 kernels (Jetson)
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+size_t round_up(const size_t length, const size_t alignment)
+{
+  return (length + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+ImagePool::ImagePool(const uint16_t width, const uint16_t height,
+                     const size_t capacity, const bool huge_pages)
+  : width_(width), height_(height), capacity_(capacity),
+    huge_pages_(huge_pages)
+{
+  if (capacity == 0) {
+    throw runtime_error("ImagePool: capacity must be positive");
+  }
+
+  mappings_.reserve(capacity);
+  images_.reserve(capacity);
+}
+
+MMap ImagePool::map_image(const size_t length)
+{
+  constexpr int prot = PROT_READ | PROT_WRITE;
+  constexpr int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+  if (huge_pages_ and try_hugetlb_) {
+    try {
+      MMap mapping(round_up(length, HUGE_PAGE_SIZE), prot,
+                   flags | MAP_HUGETLB, -1, 0);
+      using_hugetlb_ = true;
+      return mapping;
+    } catch (const exception &) {
+      // no huge pages reserved (vm.nr_hugepages); fall back to THP
+      cerr << "ImagePool: MAP_HUGETLB failed, using transparent huge pages"
+           << endl;
+      try_hugetlb_ = false;
+    }
+  }
+
+  MMap mapping(round_up(length, sysconf(_SC_PAGESIZE)), prot, flags, -1, 0);
+
+  // only a hint; ignored if THP is disabled
+  if (huge_pages_) {
+    madvise(mapping.addr(), mapping.length(), MADV_HUGEPAGE);
+  }
+
+  return mapping;
+}
+
+void ImagePool::set_format(const vpx_img_fmt_t format)
+{
+  if (not images_.empty()) {
+    throw runtime_error("ImagePool: cannot change the format of allocated images");
+  }
+
+  format_ = format;
+}
+
+RawImage * ImagePool::allocate()
+{
+  if (images_.size() == capacity_) {
+    return nullptr;
+  }
+
+  mappings_.emplace_back(map_image(RawImage::buffer_size(width_, height_)));
+  MMap & mapping = mappings_.back();
+
+  images_.emplace_back(make_unique<RawImage>(width_, height_, mapping.addr(),
+                                             format_));
+
+  bytes_mapped_ += mapping.length();
+  num_allocated_++;
+
+  return images_.back().get();
+}
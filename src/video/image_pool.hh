@@ -0,0 +1,70 @@
+#ifndef IMAGE_POOL_HH
+#define IMAGE_POOL_HH
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "image.hh"
+#include "mmap.hh"
+
+// I420 images of a fixed size backed by page-aligned anonymous mappings,
+// created on demand up to 'capacity' and freed only with the pool, so
+// memory follows the number of frames actually in flight; with
+// 'huge_pages', each image is mapped with MAP_HUGETLB if the system has
+// huge pages reserved, or else advised for transparent huge pages
+class ImagePool
+{
+public:
+  ImagePool(const uint16_t width, const uint16_t height,
+            const size_t capacity, const bool huge_pages = false);
+
+  // format of the images to allocate (I420 by default); only allowed
+  // before the first allocate()
+  void set_format(const vpx_img_fmt_t format);
+
+  // map a new image; nullptr once 'capacity' images exist. Must always be
+  // called from the same thread; the accessors below are safe from any.
+  RawImage * allocate();
+
+  size_t capacity() const { return capacity_; }
+  size_t num_allocated() const { return num_allocated_.load(); }
+
+  // total bytes mapped for image data; images are never unmapped before
+  // the pool is destroyed, so this is also the peak
+  size_t bytes_mapped() const { return bytes_mapped_.load(); }
+
+  // whether any image is backed by MAP_HUGETLB pages
+  bool using_hugetlb() const { return using_hugetlb_.load(); }
+
+  // forbid copying and moving
+  ImagePool(const ImagePool & other) = delete;
+  const ImagePool & operator=(const ImagePool & other) = delete;
+  ImagePool(ImagePool && other) = delete;
+  ImagePool & operator=(ImagePool && other) = delete;
+
+private:
+  uint16_t width_;
+  uint16_t height_;
+  size_t capacity_;
+  bool huge_pages_;
+  vpx_img_fmt_t format_ {VPX_IMG_FMT_I420};
+
+  // reserved up front so that allocate() never moves existing elements;
+  // images are declared after their mappings so they are destroyed first
+  std::vector<MMap> mappings_ {};
+  std::vector<std::unique_ptr<RawImage>> images_ {};
+
+  std::atomic<size_t> num_allocated_ {0};
+  std::atomic<size_t> bytes_mapped_ {0};
+  std::atomic<bool> using_hugetlb_ {false};
+
+  // give up on MAP_HUGETLB after the first failure
+  bool try_hugetlb_ {true};
+
+  MMap map_image(const size_t length);
+};
+
+#endif /* IMAGE_POOL_HH */
@@ -0,0 +1,218 @@
+#include <sys/uio.h>
+#include <endian.h>
+#include <cstring>
+#include <iostream>
+
+#include "ivf.hh"
+#include "exception.hh"
+
+using namespace std;
+
+namespace {
+
+constexpr size_t FILE_HEADER_SIZE = 32;
+constexpr size_t FRAME_HEADER_SIZE = 12;
+constexpr off_t FRAME_COUNT_OFFSET = 24;
+
+void put_le16(uint8_t * dst, const uint16_t value)
+{
+  const uint16_t le = htole16(value);
+  memcpy(dst, &le, sizeof(le));
+}
+
+void put_le32(uint8_t * dst, const uint32_t value)
+{
+  const uint32_t le = htole32(value);
+  memcpy(dst, &le, sizeof(le));
+}
+
+void put_le64(uint8_t * dst, const uint64_t value)
+{
+  const uint64_t le = htole64(value);
+  memcpy(dst, &le, sizeof(le));
+}
+
+uint16_t get_le16(const uint8_t * src)
+{
+  uint16_t le;
+  memcpy(&le, src, sizeof(le));
+  return le16toh(le);
+}
+
+uint32_t get_le32(const uint8_t * src)
+{
+  uint32_t le;
+  memcpy(&le, src, sizeof(le));
+  return le32toh(le);
+}
+
+uint64_t get_le64(const uint8_t * src)
+{
+  uint64_t le;
+  memcpy(&le, src, sizeof(le));
+  return le64toh(le);
+}
+
+} // namespace
+
+IVFWriter::IVFWriter(const string & path, const string & fourcc,
+                     const uint16_t width, const uint16_t height,
+                     const unsigned frame_rate, const SegmentLimits & segments)
+  : fourcc_(fourcc), width_(width), height_(height), frame_rate_(frame_rate),
+    segments_(path, segments)
+{
+  if (fourcc.size() != 4) {
+    throw runtime_error("IVFWriter: invalid fourcc " + fourcc);
+  }
+
+  open_segment();
+}
+
+IVFWriter::~IVFWriter()
+{
+  try {
+    update_frame_count();
+  } catch (const exception & e) {
+    cerr << "IVFWriter: " << e.what() << endl;
+  }
+}
+
+void IVFWriter::open_segment()
+{
+  const string & path = segments_.current();
+
+  fd_.emplace(check_syscall(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644),
+                            "open " + path));
+  index_fd_.emplace(check_syscall(open((path + ".idx").c_str(),
+                                       O_WRONLY | O_CREAT | O_TRUNC, 0644),
+                                  "open " + path + ".idx"));
+
+  uint8_t header[FILE_HEADER_SIZE] {};
+  memcpy(header, "DKIF", 4);
+  put_le16(header + 4, 0);                  // version
+  put_le16(header + 6, FILE_HEADER_SIZE);   // header size
+  memcpy(header + 8, fourcc_.data(), 4);
+  put_le16(header + 12, width_);
+  put_le16(header + 14, height_);
+  put_le32(header + 16, frame_rate_);       // time base denominator
+  put_le32(header + 20, 1);                 // time base numerator
+  put_le32(header + 24, 0);                 // frame count
+
+  fd_->write_all({reinterpret_cast<const char *>(header), sizeof(header)});
+  file_size_ = sizeof(header);
+  num_frames_ = 0;
+
+  index_fd_->write_all("frame,timestamp,offset,key,capture_ts\n");
+}
+
+void IVFWriter::write_frame(const vector<string_view> & parts,
+                            const uint64_t timestamp, const bool key_frame,
+                            const uint64_t capture_ts)
+{
+  // a segment can only start on a key frame
+  if (key_frame and num_frames_ > 0 and segments_.due(file_size_)) {
+    update_frame_count();
+    segments_.rotate(file_size_);
+    open_segment();
+  }
+
+  size_t frame_size = 0;
+  for (const auto & part : parts) {
+    frame_size += part.size();
+  }
+
+  uint8_t header[FRAME_HEADER_SIZE];
+  put_le32(header, frame_size);
+  put_le64(header + 4, timestamp);
+
+  // the frame header and all parts in one system call
+  vector<iovec> iov;
+  iov.reserve(parts.size() + 1);
+  iov.push_back({header, sizeof(header)});
+  for (const auto & part : parts) {
+    iov.push_back({const_cast<char *>(part.data()), part.size()});
+  }
+
+  iovec * vec = iov.data();
+  size_t count = iov.size();
+  while (count > 0) {
+    size_t written = check_syscall(::writev(fd_->fd_num(), vec, count), "writev");
+
+    while (count > 0 and written >= vec->iov_len) {
+      written -= vec->iov_len;
+      vec++;
+      count--;
+    }
+
+    if (count > 0) {
+      vec->iov_base = static_cast<uint8_t *>(vec->iov_base) + written;
+      vec->iov_len -= written;
+    }
+  }
+
+  index_fd_->write_all(to_string(num_frames_) + "," + to_string(timestamp)
+                       + "," + to_string(file_size_) + ","
+                       + (key_frame ? "1," : "0,") + to_string(capture_ts)
+                       + "\n");
+
+  file_size_ += sizeof(header) + frame_size;
+  num_frames_++;
+
+  if (key_frame) {
+    update_frame_count();
+  }
+}
+
+void IVFWriter::update_frame_count()
+{
+  uint8_t count[4];
+  put_le32(count, num_frames_);
+  check_syscall(pwrite(fd_->fd_num(), count, sizeof(count), FRAME_COUNT_OFFSET),
+                "pwrite");
+}
+
+IVFReader::IVFReader(const string & path)
+  : fd_(check_syscall(open(path.c_str(), O_RDONLY), "open " + path)),
+    mapping_(fd_.file_size(), PROT_READ, MAP_PRIVATE, fd_.fd_num(), 0)
+{
+  const uint8_t * const data = mapping_.addr();
+  const size_t file_size = mapping_.length();
+
+  if (file_size < FILE_HEADER_SIZE or memcmp(data, "DKIF", 4) != 0) {
+    throw runtime_error("invalid IVF file signature");
+  }
+
+  const size_t header_size = get_le16(data + 6);
+  fourcc_.assign(reinterpret_cast<const char *>(data + 8), 4);
+  width_ = get_le16(data + 12);
+  height_ = get_le16(data + 14);
+
+  const uint32_t rate = get_le32(data + 16);
+  const uint32_t scale = get_le32(data + 20);
+  if (scale > 0) {
+    frame_rate_ = double(rate) / scale;
+  }
+
+  // index the frames
+  size_t offset = max(header_size, FILE_HEADER_SIZE);
+  while (offset + FRAME_HEADER_SIZE <= file_size) {
+    const size_t frame_size = get_le32(data + offset);
+    if (file_size - offset - FRAME_HEADER_SIZE < frame_size) {
+      cerr << "IVFReader: ignoring a truncated frame at the end of "
+           << path << endl;
+      break;
+    }
+
+    frame_offsets_.push_back(offset);
+    offset += FRAME_HEADER_SIZE + frame_size;
+  }
+}
+
+IVFReader::Frame IVFReader::frame(const size_t index) const
+{
+  const uint8_t * const header = mapping_.addr() + frame_offsets_.at(index);
+
+  return { { reinterpret_cast<const char *>(header + FRAME_HEADER_SIZE),
+             get_le32(header) },
+           get_le64(header + 4) };
+}
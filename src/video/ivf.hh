@@ -0,0 +1,106 @@
+#ifndef IVF_HH
+#define IVF_HH
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "file_descriptor.hh"
+#include "mmap.hh"
+#include "segments.hh"
+
+// IVF: a 32-byte file header followed by frames, each prefixed with its
+// size and a timestamp (all little-endian); the container libvpx's tools
+// read and write
+
+// Records compressed frames into an IVF file. Timestamps are in units of
+// 1/frame_rate seconds. Every frame is also listed in "<path>.idx", one
+// "frame number,timestamp,byte offset,key,capture timestamp" line each, so
+// a recording can be cut or sought into without scanning the whole file.
+// The frame count in the header is kept up to date at every key frame,
+// so a recording that is killed mid-way is still readable. With segment
+// limits, the recording is split into files that each start on a key
+// frame, have their own index, and are deleted oldest first to stay
+// within the disk budget.
+class IVFWriter
+{
+public:
+  IVFWriter(const std::string & path, const std::string & fourcc,
+            const uint16_t width, const uint16_t height,
+            const unsigned frame_rate, const SegmentLimits & segments = {});
+  ~IVFWriter();
+
+  // append the frame whose data is the concatenation of 'parts'
+  void write_frame(const std::vector<std::string_view> & parts,
+                   const uint64_t timestamp, const bool key_frame,
+                   const uint64_t capture_ts = 0);
+
+  // frames in the current segment
+  uint32_t num_frames() const { return num_frames_; }
+
+  // forbid copying and moving
+  IVFWriter(const IVFWriter & other) = delete;
+  const IVFWriter & operator=(const IVFWriter & other) = delete;
+  IVFWriter(IVFWriter && other) = delete;
+  IVFWriter & operator=(IVFWriter && other) = delete;
+
+private:
+  std::string fourcc_;
+  uint16_t width_;
+  uint16_t height_;
+  unsigned frame_rate_;
+
+  SegmentRotator segments_;
+  std::optional<FileDescriptor> fd_ {};
+  std::optional<FileDescriptor> index_fd_ {};
+  uint64_t file_size_ {0};
+  uint32_t num_frames_ {0};
+
+  // create segments_.current() and write its header
+  void open_segment();
+
+  // rewrite the frame count in the header
+  void update_frame_count();
+};
+
+// Reads an IVF file through a read-only mapping, with its frames indexed
+// on construction for random access.
+class IVFReader
+{
+public:
+  struct Frame
+  {
+    std::string_view data; // zero-copy, valid while the reader exists
+    uint64_t timestamp;
+  };
+
+  IVFReader(const std::string & path);
+
+  // header fields
+  std::string fourcc() const { return fourcc_; }
+  uint16_t width() const { return width_; }
+  uint16_t height() const { return height_; }
+  double frame_rate() const { return frame_rate_; }
+
+  // frames actually present (the header's count may be stale)
+  size_t num_frames() const { return frame_offsets_.size(); }
+
+  // frame 'index' (< num_frames()); throws if out of range
+  Frame frame(const size_t index) const;
+
+private:
+  FileDescriptor fd_;
+  MMap mapping_;
+
+  std::string fourcc_ {};
+  uint16_t width_ {0};
+  uint16_t height_ {0};
+  double frame_rate_ {0};
+
+  // where each frame's 12-byte header starts
+  std::vector<size_t> frame_offsets_ {};
+};
+
+#endif /* IVF_HH */
@@ -0,0 +1,106 @@
+extern "C" {
+#include <linux/videodev2.h>
+}
+
+#include <cstring>
+#include <stdexcept>
+
+#include "pixel_format.hh"
+
+using namespace std;
+
+string fourcc_to_string(const uint32_t fourcc)
+{
+  string ret;
+  for (unsigned i = 0; i < 4; i++) {
+    ret += static_cast<char>((fourcc >> (8 * i)) & 0xFF);
+  }
+  return ret;
+}
+
+void copy_planar_420(const uint8_t * src, const size_t src_stride,
+                     const uint32_t src_fourcc, RawImage & dst,
+                     const unsigned row_begin, const unsigned row_end)
+{
+  const unsigned width = dst.display_width();
+  const unsigned height = dst.display_height();
+  const unsigned end = row_end == 0 ? height : min(row_end, height);
+
+  if (src_fourcc != V4L2_PIX_FMT_YUV420 and src_fourcc != V4L2_PIX_FMT_NV12) {
+    throw runtime_error("copy_planar_420: unsupported source format "
+                        + fourcc_to_string(src_fourcc));
+  }
+
+  if (row_begin % 2 != 0) {
+    throw runtime_error("copy_planar_420: bands must start on an even row");
+  }
+
+  // luma
+  for (unsigned row = row_begin; row < end; row++) {
+    memcpy(dst.y_plane() + row * dst.y_stride(), src + row * src_stride, width);
+  }
+
+  // chroma: V4L2 stores it right below the luma plane, at half the stride
+  // per plane for YU12 and at the full stride (interleaved) for NV12
+  const bool src_nv12 = src_fourcc == V4L2_PIX_FMT_NV12;
+  const bool dst_nv12 = dst.format() == VPX_IMG_FMT_NV12;
+  const unsigned chroma_width = (width + 1) / 2;
+  const unsigned chroma_height = (height + 1) / 2;
+
+  const uint8_t * src_u = src + src_stride * height;
+  const size_t src_chroma_stride = src_nv12 ? src_stride : src_stride / 2;
+  const uint8_t * src_v = src_nv12 ? src_u + 1
+                                   : src_u + src_chroma_stride * chroma_height;
+
+  for (unsigned row = row_begin / 2; row < (end + 1) / 2; row++) {
+    const uint8_t * su = src_u + row * src_chroma_stride;
+    const uint8_t * sv = src_v + row * src_chroma_stride;
+    uint8_t * du = dst.u_plane() + row * dst.u_stride();
+    uint8_t * dv = dst.v_plane() + row * dst.v_stride();
+
+    if (src_nv12 and dst_nv12) {
+      memcpy(du, su, 2 * chroma_width);
+    } else if (not src_nv12 and not dst_nv12) {
+      memcpy(du, su, chroma_width);
+      memcpy(dv, sv, chroma_width);
+    } else if (src_nv12) { // deinterleave
+      for (unsigned x = 0; x < chroma_width; x++) {
+        du[x] = su[2 * x];
+        dv[x] = su[2 * x + 1];
+      }
+    } else { // interleave
+      for (unsigned x = 0; x < chroma_width; x++) {
+        du[2 * x] = su[x];
+        du[2 * x + 1] = sv[x];
+      }
+    }
+  }
+}
+
+void image_to_rgb565_scaled(const RawImage & src, uint8_t * dst,
+                            const size_t dst_stride,
+                            const unsigned dst_width,
+                            const unsigned dst_height)
+{
+  const unsigned src_width = src.display_width();
+  const unsigned src_height = src.display_height();
+
+  // distance between the chroma samples of neighbouring pixel pairs
+  const unsigned chroma_step = src.format() == VPX_IMG_FMT_NV12 ? 2 : 1;
+
+  for (unsigned dy = 0; dy < dst_height; dy++) {
+    const unsigned sy = size_t(dy) * src_height / dst_height;
+    const uint8_t * y_row = src.y_plane() + sy * src.y_stride();
+    const uint8_t * u_row = src.u_plane() + sy / 2 * src.u_stride();
+    const uint8_t * v_row = src.v_plane() + sy / 2 * src.v_stride();
+    uint8_t * dst_row = dst + dy * dst_stride;
+
+    for (unsigned dx = 0; dx < dst_width; dx++) {
+      const unsigned sx = size_t(dx) * src_width / dst_width;
+      const unsigned cx = sx / 2 * chroma_step;
+
+      const uint16_t rgb565 = yuv_to_rgb565(y_row[sx], u_row[cx], v_row[cx]);
+      memcpy(dst_row + 2 * dx, &rgb565, sizeof(rgb565));
+    }
+  }
+}
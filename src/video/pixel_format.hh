@@ -0,0 +1,47 @@
+#ifndef PIXEL_FORMAT_HH
+#define PIXEL_FORMAT_HH
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "image.hh"
+
+// printable V4L2 fourcc, e.g., "NV12"
+std::string fourcc_to_string(const uint32_t fourcc);
+
+// copy rows [row_begin, row_end) of a planar 4:2:0 frame as laid out by
+// V4L2 (YU12 or NV12, chroma right below luma, luma rows 'src_stride' bytes
+// apart) into 'dst', interleaving or deinterleaving chroma if 'dst' is in
+// the other layout; row_begin must be even, and row_end = 0 means all rows
+void copy_planar_420(const uint8_t * src, const size_t src_stride,
+                     const uint32_t src_fourcc, RawImage & dst,
+                     const unsigned row_begin = 0, const unsigned row_end = 0);
+
+// nearest-neighbour downscale of an I420 or NV12 image fused with BT.601
+// conversion to RGB565
+void image_to_rgb565_scaled(const RawImage & src, uint8_t * dst,
+                            const size_t dst_stride,
+                            const unsigned dst_width,
+                            const unsigned dst_height);
+
+// BT.601 limited-range YUV to RGB565 in fixed point
+inline uint16_t yuv_to_rgb565(const int y, const int u, const int v)
+{
+  auto clamp8 = [](const int value) {
+    return static_cast<unsigned>(std::min(std::max(value, 0), 255));
+  };
+
+  const int c = 298 * (y - 16);
+  const int d = u - 128;
+  const int e = v - 128;
+
+  const unsigned r = clamp8((c + 409 * e + 128) >> 8);
+  const unsigned g = clamp8((c - 100 * d - 208 * e + 128) >> 8);
+  const unsigned b = clamp8((c + 516 * d + 128) >> 8);
+
+  return static_cast<uint16_t>(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+}
+
+#endif /* PIXEL_FORMAT_HH */
@@ -0,0 +1,124 @@
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "test_pattern.hh"
+
+using namespace std;
+
+namespace {
+
+// xorshift32: a fixed seed gives the same texture everywhere
+uint32_t next_random(uint32_t & state)
+{
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+uint8_t clamp8(const double value)
+{
+  return static_cast<uint8_t>(min(max(value, 0.0), 255.0));
+}
+
+// copy 'width' bytes of a row that starts 'offset' bytes in, wrapping
+// around to its beginning
+void copy_wrapped(uint8_t * dst, const uint8_t * src_row,
+                  const size_t width, const size_t offset)
+{
+  memcpy(dst, src_row + offset, width - offset);
+  memcpy(dst + width - offset, src_row, offset);
+}
+
+} // namespace
+
+TestPattern::TestPattern(const uint16_t display_width,
+                         const uint16_t display_height,
+                         const unsigned motion, const unsigned complexity)
+  : display_width_(display_width), display_height_(display_height),
+    motion_(motion)
+{
+  if (display_width % 2 or display_height % 2) {
+    throw runtime_error("TestPattern: dimensions must be even");
+  }
+
+  if (complexity > 100) {
+    throw runtime_error("TestPattern: complexity must be within 0-100");
+  }
+
+  const size_t width = display_width;
+  const size_t height = display_height;
+  const double detail = complexity / 100.0;
+  uint32_t seed = 0x2545F491;
+
+  // luma: large soft blobs over a diagonal ramp, plus noise
+  y_.resize(width * height);
+  for (size_t row = 0; row < height; row++) {
+    for (size_t col = 0; col < width; col++) {
+      const double smooth = 64 + 64.0 * (row + col) / (width + height)
+                            + 48 * sin(col * 0.02) * cos(row * 0.03);
+      const double noise = int(next_random(seed) & 0xFF) - 128;
+      y_[row * width + col] = clamp8(smooth + detail * noise);
+    }
+  }
+
+  // chroma: slow color gradients with a little noise
+  u_.resize(width / 2 * height / 2);
+  v_.resize(width / 2 * height / 2);
+  for (size_t row = 0; row < height / 2; row++) {
+    for (size_t col = 0; col < width / 2; col++) {
+      const double noise = int(next_random(seed) & 0x3F) - 32;
+      u_[row * width / 2 + col] = clamp8(128 + 60 * sin(col * 0.01)
+                                         + detail * noise);
+      v_[row * width / 2 + col] = clamp8(128 + 60 * cos(row * 0.015)
+                                         - detail * noise);
+    }
+  }
+
+  uv_.resize(u_.size() * 2);
+  for (size_t i = 0; i < u_.size(); i++) {
+    uv_[2 * i] = u_[i];
+    uv_[2 * i + 1] = v_[i];
+  }
+}
+
+bool TestPattern::read_frame(RawImage & raw_img)
+{
+  if (raw_img.display_width() != display_width_ or
+      raw_img.display_height() != display_height_) {
+    throw runtime_error("TestPattern: image dimensions don't match");
+  }
+
+  const size_t width = display_width_;
+  const size_t height = display_height_;
+
+  // pan diagonally by whole chroma samples so that chroma stays aligned
+  const size_t shift = frame_count_ * motion_ / 2 * 2;
+  const size_t x_offset = shift % width;
+  const size_t y_offset = shift / 2 % height / 2 * 2;
+
+  for (size_t row = 0; row < height; row++) {
+    copy_wrapped(raw_img.y_plane() + row * raw_img.y_stride(),
+                 &y_[(row + y_offset) % height * width], width, x_offset);
+  }
+
+  const size_t chroma_width = width / 2;
+  const bool nv12 = raw_img.format() == VPX_IMG_FMT_NV12;
+
+  for (size_t row = 0; row < height / 2; row++) {
+    const size_t src_row = (row + y_offset / 2) % (height / 2) * chroma_width;
+    uint8_t * dst_u = raw_img.u_plane() + row * raw_img.u_stride();
+    uint8_t * dst_v = raw_img.v_plane() + row * raw_img.v_stride();
+
+    if (nv12) {
+      copy_wrapped(dst_u, &uv_[2 * src_row], width, x_offset);
+    } else {
+      copy_wrapped(dst_u, &u_[src_row], chroma_width, x_offset / 2);
+      copy_wrapped(dst_v, &v_[src_row], chroma_width, x_offset / 2);
+    }
+  }
+
+  frame_count_++;
+  return true;
+}
@@ -0,0 +1,43 @@
+#ifndef TEST_PATTERN_HH
+#define TEST_PATTERN_HH
+
+#include <cstdint>
+#include <vector>
+
+#include "video_input.hh"
+
+// Synthetic frames for benchmarking without a camera: a fixed texture,
+// generated once, that pans across the frame with wraparound. 'motion' is
+// the pan in pixels per frame and 'complexity' (0-100) the share of
+// random detail on top of smooth gradients, which drives the bitrate the
+// encoder needs. The frames only depend on the parameters and the frame
+// number, so runs are reproducible across machines.
+class TestPattern : public VideoInput
+{
+public:
+  TestPattern(const uint16_t display_width, const uint16_t display_height,
+              const unsigned motion = 4, const unsigned complexity = 50);
+
+  // render the next frame into raw_img (I420 or NV12); never runs out
+  bool read_frame(RawImage & raw_img) override;
+
+  // accessors
+  uint16_t display_width() const override { return display_width_; }
+  uint16_t display_height() const override { return display_height_; }
+  uint64_t frame_count() const { return frame_count_; }
+
+private:
+  uint16_t display_width_;
+  uint16_t display_height_;
+  unsigned motion_;
+
+  // I420 planes of the texture, and its chroma interleaved for NV12
+  std::vector<uint8_t> y_ {};
+  std::vector<uint8_t> u_ {};
+  std::vector<uint8_t> v_ {};
+  std::vector<uint8_t> uv_ {};
+
+  uint64_t frame_count_ {0};
+};
+
+#endif /* TEST_PATTERN_HH */
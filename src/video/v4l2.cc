@@ -2,15 +2,120 @@
 #include <cassert>
 #include <cstring>
 #include <iostream>
+#include <algorithm>
+#include <optional>
 
 #include "v4l2.hh"
 #include "exception.hh"
+#include "pixel_format.hh"
 
 using namespace std;
 
+namespace {
+
+// whether the device offers 'fourcc' at width x height; assumes so if the
+// driver does not enumerate frame sizes (S_FMT will tell)
+bool offers_size(const int fd, const uint32_t fourcc,
+                 const uint16_t width, const uint16_t height)
+{
+  v4l2_frmsizeenum size {};
+  size.pixel_format = fourcc;
+
+  for (size.index = 0; ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &size) == 0;
+       size.index++) {
+    if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+      if (size.discrete.width == width and size.discrete.height == height) {
+        return true;
+      }
+    } else { // stepwise or continuous
+      const auto & range = size.stepwise;
+      return width >= range.min_width and width <= range.max_width and
+             height >= range.min_height and height <= range.max_height;
+    }
+  }
+
+  return size.index == 0;
+}
+
+// highest frame rate the device offers for 'fourcc' at width x height;
+// 0 if the driver does not enumerate frame intervals
+double max_frame_rate(const int fd, const uint32_t fourcc,
+                      const uint16_t width, const uint16_t height)
+{
+  v4l2_frmivalenum ival {};
+  ival.pixel_format = fourcc;
+  ival.width = width;
+  ival.height = height;
+
+  double max_fps = 0;
+  for (ival.index = 0; ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &ival) == 0;
+       ival.index++) {
+    // for stepwise/continuous intervals, 'min' is the shortest interval
+    const v4l2_fract & interval = ival.type == V4L2_FRMIVAL_TYPE_DISCRETE
+                                  ? ival.discrete : ival.stepwise.min;
+    if (interval.numerator > 0) {
+      max_fps = max(max_fps, double(interval.denominator) / interval.numerator);
+    }
+
+    if (ival.type != V4L2_FRMIVAL_TYPE_DISCRETE) {
+      break;
+    }
+  }
+
+  return max_fps;
+}
+
+} // namespace
+
+uint32_t negotiate_pixel_format(const int fd,
+                                const uint16_t width, const uint16_t height,
+                                const unsigned fps,
+                                const vector<uint32_t> & preferred)
+{
+  // formats the device offers
+  vector<uint32_t> offered;
+  v4l2_fmtdesc desc {};
+  desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+  for (desc.index = 0; ioctl(fd, VIDIOC_ENUM_FMT, &desc) == 0; desc.index++) {
+    offered.push_back(desc.pixelformat);
+  }
+
+  optional<uint32_t> fallback;
+
+  for (const uint32_t fourcc : preferred) {
+    if (find(offered.begin(), offered.end(), fourcc) == offered.end() or
+        not offers_size(fd, fourcc, width, height)) {
+      continue;
+    }
+
+    // e.g., raw formats over USB 2.0 only reach a fraction of the rate
+    const double max_fps = max_frame_rate(fd, fourcc, width, height);
+    if (fps == 0 or max_fps == 0 or max_fps >= fps) {
+      return fourcc;
+    }
+
+    cerr << "Pixel format " << fourcc_to_string(fourcc) << " only reaches "
+         << max_fps << " fps at " << width << "x" << height << endl;
+
+    if (not fallback) {
+      fallback = fourcc;
+    }
+  }
+
+  if (fallback) {
+    return *fallback;
+  }
+
+  throw runtime_error("video device offers none of the supported pixel "
+                      "formats at " + to_string(width) + "x" + to_string(height));
+}
+
 VideoDevice::VideoDevice(const string & video_device_path,
                          const uint16_t display_width,
-                         const uint16_t display_height)
+                         const uint16_t display_height,
+                         const V4L2IO io,
+                         const size_t num_buffers)
   : fd_(check_syscall(open(video_device_path.c_str(), O_RDWR))),
     display_width_(display_width),
     display_height_(display_height)
@@ -28,62 +133,30 @@ VideoDevice::VideoDevice(const string & video_device_path,
   }
 
   // set pixel format and resolution
+  pixel_format_ = negotiate_pixel_format(fd_.fd_num(), display_width,
+                                         display_height, 0, preferred_formats);
+
   v4l2_format fmt {};
   fmt.type = buffer_type;
-  fmt.fmt.pix.pixelformat = pixel_format;
+  fmt.fmt.pix.pixelformat = pixel_format_;
   fmt.fmt.pix.width = display_width;
   fmt.fmt.pix.height = display_height;
   check_syscall(ioctl(fd_.fd_num(), VIDIOC_S_FMT, &fmt));
 
-  if (fmt.fmt.pix.pixelformat != pixel_format) {
-    throw runtime_error("cannot set pixel format to be YUYV");
+  if (fmt.fmt.pix.pixelformat != pixel_format_) {
+    throw runtime_error("cannot set pixel format to be "
+                        + fourcc_to_string(pixel_format_));
   }
+  bytes_per_line_ = fmt.fmt.pix.bytesperline;
 
   if (fmt.fmt.pix.width != display_width or
       fmt.fmt.pix.height != display_height) {
     throw runtime_error("cannot set video resolution as specified");
   }
 
-  // inform the device about the buffers about to be allocated
-  v4l2_requestbuffers buf_req {};
-  buf_req.type = buffer_type;
-  buf_req.memory = V4L2_MEMORY_MMAP;
-  buf_req.count = NUM_BUFFERS;
-  check_syscall(ioctl(fd_.fd_num(), VIDIOC_REQBUFS, &buf_req));
-
-  if (buf_req.count != NUM_BUFFERS) {
-    cerr << "Warning: requested " << NUM_BUFFERS << " V4L2 buffers but only "
-         << buf_req.count << " were approved" << endl;
-  }
-
-  buf_mem_.reserve(buf_req.count);
-  for (size_t i = 0; i < buf_req.count; i++) {
-    memset(&buf_info_, 0, sizeof(buf_info_));
-    buf_info_.index = i;
-    buf_info_.type = buffer_type;
-    buf_info_.memory = V4L2_MEMORY_MMAP;
-
-    // allocate buffer
-    check_syscall(ioctl(fd_.fd_num(), VIDIOC_QUERYBUF, &buf_info_));
-
-    // mmap buffer
-    buf_mem_.emplace_back(
-      buf_info_.length, PROT_READ | PROT_WRITE, MAP_SHARED,
-      fd_.fd_num(), buf_info_.m.offset);
-
-    // enqueue buffer
-    check_syscall(ioctl(fd_.fd_num(), VIDIOC_QBUF, &buf_info_));
-  }
-
-  // activate streaming
-  check_syscall(ioctl(fd_.fd_num(), VIDIOC_STREAMON, &buffer_type));
-}
-
-VideoDevice::~VideoDevice()
-{
-  if (ioctl(fd_.fd_num(), VIDIOC_STREAMOFF, &buffer_type) < 0) {
-    cerr << "VideoDevice: unable to deactivate streaming" << endl;
-  }
+  // allocate, map and enqueue the buffers, then activate streaming
+  buffers_ = make_unique<V4L2Buffers>(fd_.fd_num(), io, num_buffers);
+  buffers_->stream_on();
 }
 
 void VideoDevice::set_blocking(const bool blocking)
@@ -98,26 +171,26 @@ bool VideoDevice::read_frame(RawImage & raw_img)
     throw runtime_error("VideoDevice: image dimensions don't match");
   }
 
-  memset(&buf_info_, 0, sizeof(buf_info_));
-  buf_info_.type = buffer_type;
-  buf_info_.memory = V4L2_MEMORY_MMAP;
-
   // try to dequeue a frame
-  if (ioctl(fd_.fd_num(), VIDIOC_DQBUF, &buf_info_) < 0) {
+  if (not buffers_->dequeue(buf_info_)) {
     return false;
   }
 
   // convert pixel format
-  const MMap & frame_buf = buf_mem_.at(buf_info_.index);
-
-  // frame_buf.size() is actually greater than the expected YUYV size
-  raw_img.copy_from_yuyv({
-    reinterpret_cast<const char *>(frame_buf.addr()),
-    static_cast<size_t>(display_width_ * display_height_ * 2)
-  });
+  const uint8_t * frame_buf = buffers_->data(buf_info_.index);
+
+  if (pixel_format_ == V4L2_PIX_FMT_YUYV) {
+    // the buffer is actually greater than the expected YUYV size
+    raw_img.copy_from_yuyv({
+      reinterpret_cast<const char *>(frame_buf),
+      static_cast<size_t>(display_width_ * display_height_ * 2)
+    });
+  } else {
+    copy_planar_420(frame_buf, bytes_per_line_, pixel_format_, raw_img);
+  }
 
   // enqueue the buffer back
-  check_syscall(ioctl(fd_.fd_num(), VIDIOC_QBUF, &buf_info_));
+  buffers_->requeue(buf_info_);
 
   return true;
 }
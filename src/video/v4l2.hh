@@ -5,20 +5,32 @@ extern "C" {
 #include <linux/videodev2.h>
 }
 
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "file_descriptor.hh"
-#include "mmap.hh"
+#include "v4l2_buffers.hh"
 #include "video_input.hh"
 
+// the first of 'preferred' (V4L2 fourccs, most preferred first) that the
+// device behind 'fd' offers at width x height and at least 'fps' frames
+// per second (0 for any rate); if none reaches 'fps', the first offered at
+// that size at all. Throws if the device offers none of them.
+uint32_t negotiate_pixel_format(const int fd,
+                                const uint16_t width, const uint16_t height,
+                                const unsigned fps,
+                                const std::vector<uint32_t> & preferred);
+
 class VideoDevice : public VideoInput
 {
 public:
+  // 'num_buffers' = 0 picks the queue depth by frame size
   VideoDevice(const std::string & video_device_path,
               const uint16_t display_width,
-              const uint16_t display_height);
-  ~VideoDevice();
+              const uint16_t display_height,
+              const V4L2IO io = V4L2IO::MMap,
+              const size_t num_buffers = 0);
 
   // video device defaults to blocking mode
   void set_blocking(const bool blocking);
@@ -30,19 +42,25 @@ public:
   FileDescriptor & fd() { return fd_; }
   uint16_t display_width() const override { return display_width_; }
   uint16_t display_height() const override { return display_height_; }
+  uint32_t pixel_format() const { return pixel_format_; }
 
 private:
   FileDescriptor fd_;
   uint16_t display_width_;
   uint16_t display_height_;
 
+  // negotiated from 'preferred_formats' and the stride of its (first) plane
+  uint32_t pixel_format_ {0};
+  uint32_t bytes_per_line_ {0};
+
   v4l2_buffer buf_info_ {}; // allocate a buffer info to reuse
-  std::vector<MMap> buf_mem_ {}; // memory region for V4L2 buffers
+  std::unique_ptr<V4L2Buffers> buffers_ {}; // stops streaming before fd_ closes
 
-  // constants
-  static constexpr uint32_t pixel_format = V4L2_PIX_FMT_YUYV;
+  // constants; 4:2:0 formats are copied as is, YUYV is converted
+  static inline const std::vector<uint32_t> preferred_formats {
+    V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_YUYV
+  };
   static constexpr uint32_t buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  static constexpr size_t NUM_BUFFERS = 4;
 };
 
 #endif /* V4L2_HH */
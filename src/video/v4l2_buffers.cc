@@ -0,0 +1,189 @@
+#include <sys/ioctl.h>
+#include <cerrno>
+#include <algorithm>
+#include <iostream>
+
+#include "v4l2_buffers.hh"
+#include "exception.hh"
+
+using namespace std;
+
+namespace {
+
+constexpr unsigned QUEUE_MS = 66;
+constexpr size_t MIN_QUEUE_DEPTH = 3;
+constexpr size_t MAX_QUEUE_DEPTH = 8;
+constexpr size_t MAX_QUEUE_BYTES = 192 * 1024 * 1024;
+
+} // namespace
+
+V4L2IO parse_v4l2_io(const string & name)
+{
+  if (name == "mmap") {
+    return V4L2IO::MMap;
+  } else if (name == "userptr") {
+    return V4L2IO::UserPtr;
+  } else if (name == "dmabuf") {
+    return V4L2IO::DMABuf;
+  }
+
+  throw runtime_error("unknown V4L2 I/O method: " + name);
+}
+
+string v4l2_io_name(const V4L2IO io)
+{
+  switch (io) {
+    case V4L2IO::MMap: return "mmap";
+    case V4L2IO::UserPtr: return "userptr";
+    case V4L2IO::DMABuf: return "dmabuf";
+  }
+
+  return "unknown";
+}
+
+size_t v4l2_queue_depth(const size_t frame_size, const unsigned fps)
+{
+  size_t depth = 4;
+  if (fps > 0) {
+    depth = clamp<size_t>((fps * QUEUE_MS + 999) / 1000,
+                          MIN_QUEUE_DEPTH, MAX_QUEUE_DEPTH);
+  }
+
+  // the driver needs one buffer to fill while we hold another
+  if (frame_size > 0) {
+    depth = min(depth, max<size_t>(2, MAX_QUEUE_BYTES / frame_size));
+  }
+
+  return depth;
+}
+
+V4L2Buffers::V4L2Buffers(const int fd, const V4L2IO io, const size_t count,
+                         const unsigned fps)
+  : fd_(fd), io_(io),
+    memory_(io == V4L2IO::UserPtr ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP)
+{
+  // size of a frame in the format set on the device
+  v4l2_format fmt {};
+  fmt.type = buffer_type;
+  check_syscall(ioctl(fd_, VIDIOC_G_FMT, &fmt), "VIDIOC_G_FMT");
+  buffer_size_ = fmt.fmt.pix.sizeimage;
+
+  const size_t num_buffers = count > 0 ? count
+                             : v4l2_queue_depth(buffer_size_, fps);
+
+  v4l2_requestbuffers req {};
+  req.type = buffer_type;
+  req.memory = memory_;
+  req.count = num_buffers;
+  check_syscall(ioctl(fd_, VIDIOC_REQBUFS, &req), "VIDIOC_REQBUFS");
+
+  if (req.count == 0) {
+    throw runtime_error("V4L2Buffers: the driver approved no "
+                        + v4l2_io_name(io_) + " buffers");
+  }
+
+  if (req.count != num_buffers) {
+    cerr << "Warning: requested " << num_buffers << " V4L2 buffers but "
+         << req.count << " were approved" << endl;
+  }
+
+  mappings_.reserve(req.count);
+
+  for (unsigned i = 0; i < req.count; i++) {
+    v4l2_buffer buf {};
+    buf.type = buffer_type;
+    buf.memory = memory_;
+    buf.index = i;
+
+    if (io_ == V4L2IO::UserPtr) {
+      // page-aligned, as most drivers require for USERPTR
+      const size_t page_size = sysconf(_SC_PAGESIZE);
+      mappings_.emplace_back((buffer_size_ + page_size - 1) / page_size * page_size,
+                             PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    } else {
+      check_syscall(ioctl(fd_, VIDIOC_QUERYBUF, &buf), "VIDIOC_QUERYBUF");
+      mappings_.emplace_back(buf.length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                             fd_, buf.m.offset);
+
+      if (io_ == V4L2IO::DMABuf) {
+        v4l2_exportbuffer expbuf {};
+        expbuf.type = buffer_type;
+        expbuf.index = i;
+        expbuf.flags = O_RDONLY | O_CLOEXEC;
+        check_syscall(ioctl(fd_, VIDIOC_EXPBUF, &expbuf), "VIDIOC_EXPBUF");
+        dmabufs_.emplace_back(expbuf.fd);
+      }
+    }
+
+    requeue(buf);
+  }
+}
+
+V4L2Buffers::~V4L2Buffers()
+{
+  try {
+    stream_off();
+  } catch (const exception & e) {
+    cerr << "V4L2Buffers: " << e.what() << endl;
+  }
+
+  // buffers can only be freed once nothing maps or exports them
+  dmabufs_.clear();
+  mappings_.clear();
+
+  v4l2_requestbuffers req {};
+  req.type = buffer_type;
+  req.memory = memory_;
+  req.count = 0;
+  if (ioctl(fd_, VIDIOC_REQBUFS, &req) < 0) {
+    cerr << "V4L2Buffers: unable to free the buffers" << endl;
+  }
+}
+
+void V4L2Buffers::stream_on()
+{
+  if (not streaming_) {
+    check_syscall(ioctl(fd_, VIDIOC_STREAMON, &buffer_type), "VIDIOC_STREAMON");
+    streaming_ = true;
+  }
+}
+
+void V4L2Buffers::stream_off()
+{
+  if (streaming_) {
+    streaming_ = false;
+    check_syscall(ioctl(fd_, VIDIOC_STREAMOFF, &buffer_type), "VIDIOC_STREAMOFF");
+  }
+}
+
+bool V4L2Buffers::dequeue(v4l2_buffer & buf)
+{
+  buf = {};
+  buf.type = buffer_type;
+  buf.memory = memory_;
+
+  if (ioctl(fd_, VIDIOC_DQBUF, &buf) < 0) {
+    if (errno == EAGAIN) {
+      return false;
+    }
+    throw unix_error("VIDIOC_DQBUF");
+  }
+
+  if (buf.index >= mappings_.size()) {
+    throw runtime_error("V4L2Buffers: driver returned an unknown buffer");
+  }
+
+  return true;
+}
+
+void V4L2Buffers::requeue(v4l2_buffer & buf)
+{
+  if (memory_ == V4L2_MEMORY_USERPTR) {
+    const MMap & mapping = mappings_.at(buf.index);
+    buf.m.userptr = reinterpret_cast<unsigned long>(mapping.addr());
+    buf.length = mapping.length();
+  }
+
+  check_syscall(ioctl(fd_, VIDIOC_QBUF, &buf), "VIDIOC_QBUF");
+}
@@ -0,0 +1,89 @@
+#ifndef V4L2_BUFFERS_HH
+#define V4L2_BUFFERS_HH
+
+extern "C" {
+#include <linux/videodev2.h>
+}
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "file_descriptor.hh"
+#include "mmap.hh"
+
+// how frame memory is shared with the V4L2 driver
+enum class V4L2IO {
+  MMap,    // the driver allocates the buffers and we map them
+  UserPtr, // the driver fills page-aligned buffers that we allocate
+  DMABuf,  // MMap, with each buffer also exported as a DMABUF fd so that
+           // other devices (e.g., a hardware encoder) can import it
+};
+
+// parse "mmap", "userptr" or "dmabuf"; throws on anything else
+V4L2IO parse_v4l2_io(const std::string & name);
+std::string v4l2_io_name(const V4L2IO io);
+
+// number of driver buffers to keep about 66 ms of frames queued at 'fps'
+// (4 if unknown), so that 120 fps does not drop frames on scheduling
+// hiccups, while at most ~192 MiB of 'frame_size'-byte frames are pinned,
+// so that 8K frames do not sit in a deep queue
+size_t v4l2_queue_depth(const size_t frame_size, const unsigned fps);
+
+// The capture buffers of a V4L2 device, each with its own mapping. The
+// device's format must be set before construction; all buffers start out
+// queued, and streaming is turned off (and the buffers freed) on
+// destruction, which must happen before the device is closed.
+class V4L2Buffers
+{
+public:
+  // request 'count' buffers (0 picks v4l2_queue_depth() for 'fps') from
+  // the capture device behind 'fd' and queue all of them
+  V4L2Buffers(const int fd, const V4L2IO io, const size_t count,
+              const unsigned fps = 0);
+  ~V4L2Buffers();
+
+  void stream_on();
+  void stream_off();
+
+  // dequeue a filled buffer into 'buf'; false if none is ready yet
+  // (the device is non-blocking)
+  bool dequeue(v4l2_buffer & buf);
+
+  // hand a dequeued buffer back to the driver
+  void requeue(v4l2_buffer & buf);
+
+  // CPU view of buffer 'index' (e.g., buf.index of a dequeued buffer)
+  const uint8_t * data(const unsigned index) const
+  { return mappings_.at(index).addr(); }
+
+  // DMABUF fd of buffer 'index'; only with V4L2IO::DMABuf
+  int dmabuf_fd(const unsigned index) const
+  { return dmabufs_.at(index).fd_num(); }
+
+  // accessors
+  V4L2IO io() const { return io_; }
+  size_t count() const { return mappings_.size(); }
+  size_t buffer_size() const { return buffer_size_; }
+
+  // forbid copying and moving
+  V4L2Buffers(const V4L2Buffers & other) = delete;
+  const V4L2Buffers & operator=(const V4L2Buffers & other) = delete;
+  V4L2Buffers(V4L2Buffers && other) = delete;
+  V4L2Buffers & operator=(V4L2Buffers && other) = delete;
+
+private:
+  int fd_;
+  V4L2IO io_;
+  uint32_t memory_; // V4L2_MEMORY_MMAP or V4L2_MEMORY_USERPTR
+  size_t buffer_size_ {0};
+  bool streaming_ {false};
+
+  std::vector<MMap> mappings_ {};         // indexed by buffer index
+  std::vector<FileDescriptor> dmabufs_ {}; // exported with V4L2IO::DMABuf
+
+  static constexpr uint32_t buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+};
+
+#endif /* V4L2_BUFFERS_HH */
@@ -0,0 +1,342 @@
+#include <fcntl.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "y4m_writer.hh"
+#include "exception.hh"
+#include "conversion.hh"
+
+using namespace std;
+using namespace chrono;
+
+namespace {
+
+constexpr char FRAME_HEADER[] = "FRAME\n";
+constexpr size_t FRAME_HEADER_LEN = sizeof(FRAME_HEADER) - 1;
+
+// frames written with one writev() at most
+constexpr size_t MAX_BATCH = 64;
+
+// O_DIRECT transfers must be aligned to the logical block size; 4 KiB
+// covers every common disk
+constexpr size_t DIRECT_BLOCK = 4096;
+constexpr size_t STAGING_SIZE = 8 * 1024 * 1024;
+
+size_t round_up(const size_t length, const size_t alignment)
+{
+  return (length + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+Y4MWriter::Y4MWriter(const string & path,
+                     const uint16_t display_width,
+                     const uint16_t display_height,
+                     const unsigned frame_rate, const size_t queue_depth,
+                     const bool direct_io, const size_t prealloc_bytes,
+                     const bool drop_when_full,
+                     const SegmentLimits & segments)
+  : display_width_(display_width), display_height_(display_height),
+    frame_length_(FRAME_HEADER_LEN + display_width * display_height
+                  + 2 * ((display_width + 1) / 2) * ((display_height + 1) / 2)),
+    header_("YUV4MPEG2 W" + to_string(display_width)
+            + " H" + to_string(display_height)
+            + " F" + to_string(frame_rate) + ":1 Ip A128:117\n"),
+    direct_io_(direct_io), prealloc_bytes_(prealloc_bytes),
+    drop_when_full_(drop_when_full),
+    capture_ts_(queue_depth), ready_(queue_depth), free_(queue_depth),
+    segments_(path, segments),
+    last_stats_time_(steady_clock::now())
+{
+  // every buffer exists before the writer thread starts, so that neither
+  // thread ever modifies the vector; anonymous mappings only take up
+  // memory once frames are copied into them
+  const size_t buffer_size = round_up(frame_length_, sysconf(_SC_PAGESIZE));
+  buffers_.reserve(queue_depth);
+  for (size_t i = 0; i < queue_depth; i++) {
+    buffers_.emplace_back(buffer_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    free_.push(i);
+  }
+
+  open_segment();
+
+  writer_ = thread(&Y4MWriter::writer_main, this);
+}
+
+Y4MWriter::~Y4MWriter()
+{
+  stopping_ = true;
+  wakeup_.signal();
+
+  if (writer_.joinable()) {
+    writer_.join();
+  }
+}
+
+void Y4MWriter::open_segment()
+{
+  const string & path = segments_.current();
+
+  fd_.emplace(check_syscall(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644),
+                            "open " + path));
+  index_fd_.emplace(check_syscall(open((path + ".idx").c_str(),
+                                       O_WRONLY | O_CREAT | O_TRUNC, 0644),
+                                  "open " + path + ".idx"));
+  index_fd_->write_all("frame,offset,capture_ts\n");
+
+  if (direct_io_) {
+    // e.g., tmpfs does not support O_DIRECT
+    const int flags = check_syscall(fcntl(fd_->fd_num(), F_GETFL));
+    if (fcntl(fd_->fd_num(), F_SETFL, flags | O_DIRECT) < 0) {
+      cerr << "Y4MWriter: O_DIRECT is not supported for " << path
+           << ", writing through the page cache" << endl;
+      direct_io_ = false;
+    } else if (not staging_) {
+      staging_.emplace(STAGING_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+  }
+
+  segment_frames_ = 0;
+  file_size_ = 0;
+  preallocated_ = 0;
+  staged_ = 0;
+
+  vector<iovec> iov { { header_.data(), header_.size() } };
+  write_out(iov, header_.size());
+}
+
+bool Y4MWriter::write(const vpx_image & img, const uint64_t capture_ts)
+{
+  if (img.d_w != display_width_ or img.d_h != display_height_) {
+    throw runtime_error("Y4MWriter: image dimensions don't match");
+  }
+
+  size_t index;
+  while (failed_ or not free_.pop(index)) {
+    // every buffer is waiting for the disk
+    if (failed_ or drop_when_full_) {
+      num_dropped_++;
+      return false;
+    }
+
+    space_.read_count(); // blocks until the writer frees a buffer
+  }
+
+  // pack the planes without their row padding
+  uint8_t * dst = buffers_[index].addr();
+  memcpy(dst, FRAME_HEADER, FRAME_HEADER_LEN);
+  dst += FRAME_HEADER_LEN;
+
+  for (int plane = 0; plane < 3; plane++) {
+    const uint8_t * src = img.planes[plane];
+    const int stride = img.stride[plane];
+    const unsigned width = plane == 0 ? img.d_w : (img.d_w + 1) / 2;
+    const unsigned height = plane == 0 ? img.d_h : (img.d_h + 1) / 2;
+
+    for (unsigned row = 0; row < height; row++) {
+      memcpy(dst, src, width);
+      dst += width;
+      src += stride;
+    }
+  }
+
+  capture_ts_[index] = capture_ts;
+
+  // never full: there are no more buffers than slots
+  ready_.push(index);
+  wakeup_.signal();
+
+  return true;
+}
+
+void Y4MWriter::writer_main()
+{
+  try {
+    while (true) {
+      wakeup_.read_count(); // blocks
+
+      // read before writing, so nothing queued before stopping is missed
+      const bool stopping = stopping_;
+      write_queued_frames();
+
+      if (stopping) {
+        break;
+      }
+    }
+
+    if (direct_io_) {
+      write_staged(true);
+    }
+  } catch (const exception & e) {
+    // frames are dropped from now on
+    cerr << "Y4MWriter: " << e.what() << endl;
+    failed_ = true;
+    space_.signal();
+  }
+}
+
+void Y4MWriter::write_queued_frames()
+{
+  vector<size_t> batch;
+  vector<iovec> iov;
+  string index_lines;
+  batch.reserve(MAX_BATCH);
+  iov.reserve(MAX_BATCH);
+
+  while (not ready_.empty()) {
+    // every frame can start a segment
+    if (segment_frames_ > 0 and segments_.due(file_size_)) {
+      if (direct_io_) {
+        write_staged(true);
+      }
+      segments_.rotate(file_size_);
+      open_segment();
+    }
+
+    // don't let a batch run far past the segment size
+    size_t max_batch = MAX_BATCH;
+    const uint64_t max_bytes = segments_.limits().max_bytes;
+    if (max_bytes > file_size_) {
+      max_batch = clamp<size_t>((max_bytes - file_size_) / frame_length_,
+                                1, MAX_BATCH);
+    }
+
+    batch.clear();
+    iov.clear();
+    index_lines.clear();
+
+    size_t index;
+    while (batch.size() < max_batch and ready_.pop(index)) {
+      index_lines += to_string(segment_frames_ + batch.size()) + ","
+                     + to_string(file_size_ + batch.size() * frame_length_)
+                     + "," + to_string(capture_ts_[index]) + "\n";
+      batch.push_back(index);
+      iov.push_back({ buffers_[index].addr(), frame_length_ });
+    }
+
+    write_out(iov, batch.size() * frame_length_);
+    index_fd_->write_all(index_lines);
+    segment_frames_ += batch.size();
+
+    for (const size_t i : batch) {
+      free_.push(i);
+    }
+    space_.signal();
+
+    num_written_ += batch.size();
+    bytes_written_ += batch.size() * frame_length_;
+  }
+
+  // with O_DIRECT, all but the last partial block is on disk now
+  if (direct_io_) {
+    write_staged(false);
+  }
+}
+
+void Y4MWriter::write_out(vector<iovec> & iov, const size_t length)
+{
+  preallocate(file_size_ + length);
+  file_size_ += length;
+
+  if (direct_io_) {
+    // stage through the aligned buffer, writing it out whenever full
+    for (const auto & vec : iov) {
+      const uint8_t * src = static_cast<const uint8_t *>(vec.iov_base);
+      size_t remaining = vec.iov_len;
+
+      while (remaining > 0) {
+        const size_t n = min(remaining, STAGING_SIZE - staged_);
+        memcpy(staging_->addr() + staged_, src, n);
+        staged_ += n;
+        src += n;
+        remaining -= n;
+
+        if (staged_ == STAGING_SIZE) {
+          write_staged(false);
+        }
+      }
+    }
+
+    return;
+  }
+
+  // writev() may write only part of the data
+  iovec * vec = iov.data();
+  size_t count = iov.size();
+
+  while (count > 0) {
+    size_t written = check_syscall(::writev(fd_->fd_num(), vec, count), "writev");
+
+    while (count > 0 and written >= vec->iov_len) {
+      written -= vec->iov_len;
+      vec++;
+      count--;
+    }
+
+    if (count > 0) {
+      vec->iov_base = static_cast<uint8_t *>(vec->iov_base) + written;
+      vec->iov_len -= written;
+    }
+  }
+}
+
+void Y4MWriter::write_staged(const bool final)
+{
+  // O_DIRECT can only write whole blocks: the final one is padded and the
+  // padding truncated afterwards
+  const size_t length = final ? round_up(staged_, DIRECT_BLOCK)
+                              : staged_ / DIRECT_BLOCK * DIRECT_BLOCK;
+  if (length == 0) {
+    return;
+  }
+
+  uint8_t * const data = staging_->addr();
+  memset(data + staged_, 0, length - min(length, staged_));
+
+  for (size_t written = 0; written < length; ) {
+    written += check_syscall(::write(fd_->fd_num(), data + written,
+                                     length - written), "write");
+  }
+
+  if (final) {
+    staged_ = 0;
+    check_syscall(ftruncate(fd_->fd_num(), file_size_), "ftruncate");
+    return;
+  }
+
+  memmove(data, data + length, staged_ - length);
+  staged_ -= length;
+}
+
+void Y4MWriter::preallocate(const uint64_t length)
+{
+  while (prealloc_bytes_ > 0 and length > preallocated_) {
+    // KEEP_SIZE: the file still only grows as frames are written
+    if (fallocate(fd_->fd_num(), FALLOC_FL_KEEP_SIZE, preallocated_,
+                  prealloc_bytes_) < 0) {
+      cerr << "Y4MWriter: fallocate failed, not preallocating" << endl;
+      prealloc_bytes_ = 0;
+      return;
+    }
+
+    preallocated_ += prealloc_bytes_;
+  }
+}
+
+void Y4MWriter::output_periodic_stats()
+{
+  const auto now = steady_clock::now();
+  const double seconds = duration<double>(now - last_stats_time_).count();
+  last_stats_time_ = now;
+
+  const uint64_t written = num_written_.exchange(0);
+  const uint64_t dropped = num_dropped_.exchange(0);
+  const uint64_t bytes = bytes_written_.exchange(0);
+
+  cerr << "  - Y4M frames written/dropped: " << written << "/" << dropped
+       << ", " << double_to_string(seconds > 0 ? bytes / seconds / 1e6 : 0)
+       << " MB/s" << endl;
+}
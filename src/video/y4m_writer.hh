@@ -0,0 +1,112 @@
+#ifndef Y4M_WRITER_HH
+#define Y4M_WRITER_HH
+
+extern "C" {
+#include <vpx/vpx_image.h>
+}
+
+#include <sys/uio.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "eventfd.hh"
+#include "file_descriptor.hh"
+#include "mmap.hh"
+#include "segments.hh"
+#include "spsc_ring.hh"
+
+// Writes I420 frames to a YUV4MPEG2 file on a thread of its own, so that a
+// slow disk never holds back the thread producing the frames. write()
+// copies a frame into a pooled buffer and queues it; the writer thread
+// writes all queued frames with a single writev(). When 'queue_depth'
+// frames are already waiting for the disk, new frames are dropped, or,
+// for offline use, write() waits for the disk. Every frame is listed in
+// "<path>.idx" ("frame number,byte offset,capture timestamp"); with segment
+// limits, the file is split into segments with an index each.
+class Y4MWriter
+{
+public:
+  // 'direct_io' bypasses the page cache with O_DIRECT if the file system
+  // supports it; 'prealloc_bytes' > 0 reserves disk space that many bytes
+  // at a time with fallocate()
+  Y4MWriter(const std::string & path,
+            const uint16_t display_width, const uint16_t display_height,
+            const unsigned frame_rate, const size_t queue_depth = 8,
+            const bool direct_io = false, const size_t prealloc_bytes = 0,
+            const bool drop_when_full = true,
+            const SegmentLimits & segments = {});
+
+  // writes out the frames still queued
+  ~Y4MWriter();
+
+  // producer only: queue a copy of 'img'; false if it was dropped (or the
+  // writer failed)
+  bool write(const vpx_image & img, const uint64_t capture_ts = 0);
+
+  // output frames written and dropped and the write rate of the last
+  // period and reset the counters; may be called from any (one) thread
+  void output_periodic_stats();
+
+  // forbid copying and moving
+  Y4MWriter(const Y4MWriter & other) = delete;
+  const Y4MWriter & operator=(const Y4MWriter & other) = delete;
+  Y4MWriter(Y4MWriter && other) = delete;
+  Y4MWriter & operator=(Y4MWriter && other) = delete;
+
+private:
+  uint16_t display_width_;
+  uint16_t display_height_;
+  size_t frame_length_; // "FRAME\n" and the three planes
+
+  std::string header_; // written at the start of every segment
+  bool direct_io_;
+  size_t prealloc_bytes_;
+  bool drop_when_full_;
+
+  // buffers_[i] holds a whole frame; indices travel from the producer to
+  // the writer thread through 'ready_' and back through 'free_'. All
+  // buffers are mapped by the constructor, and the vector is left alone
+  // from then on, as both threads index it.
+  std::vector<MMap> buffers_ {};
+  std::vector<uint64_t> capture_ts_; // of the frame in each buffer
+  SPSCRing<size_t> ready_;
+  SPSCRing<size_t> free_;
+  Eventfd wakeup_ {0}; // blocking: the writer thread sleeps on it
+  Eventfd space_ {0};  // blocking: write() waits on it if not dropping
+
+  std::atomic<bool> stopping_ {false};
+  std::atomic<bool> failed_ {false};
+
+  // writer thread only (and the constructor)
+  SegmentRotator segments_;
+  std::optional<FileDescriptor> fd_ {};
+  std::optional<FileDescriptor> index_fd_ {};
+  uint64_t segment_frames_ {0};  // frames in the current segment
+  uint64_t file_size_ {0};       // bytes written to the current segment
+  uint64_t preallocated_ {0};    // bytes reserved with fallocate()
+  std::optional<MMap> staging_ {}; // O_DIRECT: block-aligned bounce buffer
+  size_t staged_ {0};              // O_DIRECT: bytes in 'staging_'
+
+  // read and reset by output_periodic_stats()
+  std::atomic<uint64_t> num_written_ {0};
+  std::atomic<uint64_t> num_dropped_ {0};
+  std::atomic<uint64_t> bytes_written_ {0};
+  std::chrono::steady_clock::time_point last_stats_time_;
+
+  std::thread writer_ {};
+
+  // writer thread calls the functions below
+  void open_segment();
+  void writer_main();
+  void write_queued_frames();
+  void write_out(std::vector<iovec> & iov, const size_t length);
+  void write_staged(const bool final);
+  void preallocate(const uint64_t length);
+};
+
+#endif /* Y4M_WRITER_HH */
@@ -1,9 +1,15 @@
+extern "C" {
+#include <linux/videodev2.h>
+}
+
+#include <cstring>
 #include <iostream>
 #include <vector>
 
 #include "yuv4mpeg.hh"
 #include "exception.hh"
 #include "conversion.hh"
+#include "pixel_format.hh"
 #include "split.hh"
 
 using namespace std;
@@ -15,14 +21,59 @@ YUV4MPEG::YUV4MPEG(const string & video_file_path,
   : fd_(check_syscall(open(video_file_path.c_str(), O_RDONLY))),
     display_width_(display_width),
     display_height_(display_height),
-    loop_(loop)
+    loop_(loop),
+    mapping_(fd_.file_size(), PROT_READ, MAP_PRIVATE, fd_.fd_num(), 0)
 {
+  // frames are mostly replayed in order
+  madvise(mapping_.addr(), mapping_.length(), MADV_SEQUENTIAL);
+
+  // index the frames: each is "FRAME[ params]\n" followed by the planes
+  const char * const data = reinterpret_cast<const char *>(mapping_.addr());
+  const size_t file_size = mapping_.length();
+  const string_view frame_tag = "FRAME";
+
+  size_t offset = parse_header();
+
+  while (offset < file_size) {
+    const string_view rest(data + offset, file_size - offset);
+    if (rest.substr(0, frame_tag.size()) != frame_tag) {
+      throw runtime_error("invalid YUV4MPEG2 input format");
+    }
+
+    const size_t newline = rest.find('\n');
+    if (newline == string_view::npos or
+        rest.size() - newline - 1 < frame_size()) {
+      cerr << "YUV4MPEG: ignoring a truncated frame at the end of "
+           << video_file_path << endl;
+      break;
+    }
+
+    frame_offsets_.push_back(offset + newline + 1);
+    offset += newline + 1 + frame_size();
+  }
+
+  if (frame_offsets_.empty()) {
+    throw runtime_error("YUV4MPEG2 file contains no frames");
+  }
+}
+
+size_t YUV4MPEG::parse_header()
+{
+  const string_view file(reinterpret_cast<const char *>(mapping_.addr()),
+                         mapping_.length());
+
   const string y4m_signature = "YUV4MPEG2";
-  if (fd_.readn(y4m_signature.size()) != y4m_signature) {
+  if (file.substr(0, y4m_signature.size()) != y4m_signature) {
     throw runtime_error("invalid YUV4MPEG2 file signature");
   }
 
-  const string & header = fd_.getline();
+  const size_t newline = file.find('\n');
+  if (newline == string_view::npos) {
+    throw runtime_error("invalid YUV4MPEG2 header");
+  }
+
+  const string header(file.substr(y4m_signature.size(),
+                                  newline - y4m_signature.size()));
   const vector<string> & tokens = split(header, " ");
 
   for (const auto & token : tokens) {
@@ -32,13 +83,13 @@ YUV4MPEG::YUV4MPEG(const string & video_file_path,
 
     switch (token[0]) {
       case 'W': // width
-        if (strict_stoi(token.substr(1)) != display_width) {
+        if (strict_stoi(token.substr(1)) != display_width_) {
           throw runtime_error("wrong YUV4MPEG2 frame width");
         }
         break;
 
       case 'H': // height
-        if (strict_stoi(token.substr(1)) != display_height) {
+        if (strict_stoi(token.substr(1)) != display_height_) {
           throw runtime_error("wrong YUV4MPEG2 frame height");
         }
         break;
@@ -49,10 +100,39 @@ YUV4MPEG::YUV4MPEG(const string & video_file_path,
         }
         break;
 
+      case 'F': { // frame rate as a ratio
+        const vector<string> & ratio = split(token.substr(1), ":");
+        if (ratio.size() == 2 and strict_stoi(ratio[1]) > 0) {
+          frame_rate_ = double(strict_stoi(ratio[0])) / strict_stoi(ratio[1]);
+        }
+        break;
+      }
+
       default:
         break;
     }
   }
+
+  return newline + 1;
+}
+
+YUV4MPEG::Frame YUV4MPEG::frame(const size_t index) const
+{
+  const char * const y = reinterpret_cast<const char *>(mapping_.addr())
+                         + frame_offsets_.at(index);
+
+  return { {y, y_size()},
+           {y + y_size(), uv_size()},
+           {y + y_size() + uv_size(), uv_size()} };
+}
+
+void YUV4MPEG::seek(const size_t index)
+{
+  if (index >= num_frames()) {
+    throw runtime_error("YUV4MPEG: cannot seek past the last frame");
+  }
+
+  next_frame_ = index;
 }
 
 bool YUV4MPEG::read_frame(RawImage & raw_img)
@@ -62,30 +142,20 @@ bool YUV4MPEG::read_frame(RawImage & raw_img)
     throw runtime_error("YUV4MPEG: image dimensions don't match");
   }
 
-  string frame_header = fd_.getline();
-
-  if (fd_.eof() and frame_header.empty()) {
-    if (loop_) {
-      // reset the file offset to the beginning and skip the header line
-      fd_.reset_offset();
-      fd_.getline();
-
-      // should read "FRAME" again
-      frame_header = fd_.getline();
-    } else {
+  if (next_frame_ == num_frames()) {
+    if (not loop_) {
       // cannot read past end of file if not set to the 'loop' mode
       return false;
     }
-  }
 
-  if (frame_header.substr(0, 5) != "FRAME") {
-    throw runtime_error("invalid YUV4MPEG2 input format");
+    next_frame_ = 0;
   }
 
-  // read Y, U, V planes in order
-  raw_img.copy_y_from(fd_.readn(y_size()));
-  raw_img.copy_u_from(fd_.readn(uv_size()));
-  raw_img.copy_v_from(fd_.readn(uv_size()));
+  // Y4M planes are laid out like V4L2's YU12 with no row padding; this
+  // also honors the image's strides and converts to NV12 if needed
+  const Frame src = frame(next_frame_++);
+  copy_planar_420(reinterpret_cast<const uint8_t *>(src.y.data()),
+                  display_width_, V4L2_PIX_FMT_YUV420, raw_img);
 
   return true;
 }
@@ -2,13 +2,28 @@
 #define YUV4MPEG_HH
 
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "file_descriptor.hh"
+#include "mmap.hh"
 #include "video_input.hh"
 
+// Reads a YUV4MPEG2 (4:2:0) file through a read-only mapping. The frames
+// are indexed once on construction, so they can be accessed in any order
+// and read either as zero-copy views into the mapping or copied into a
+// RawImage with a single pass over each plane.
 class YUV4MPEG : public VideoInput
 {
 public:
+  // zero-copy view of a frame's planes, valid while the reader exists
+  struct Frame
+  {
+    std::string_view y;
+    std::string_view u;
+    std::string_view v;
+  };
+
   YUV4MPEG(const std::string & video_file_path,
            const uint16_t display_width,
            const uint16_t display_height,
@@ -18,13 +33,27 @@ public:
   size_t y_size() const { return display_width_ * display_height_; }
   size_t uv_size() const { return display_width_ * display_height_ / 4; }
 
-  // try to fetch a video frame from video file into raw_img
+  // number of complete frames in the file
+  size_t num_frames() const { return frame_offsets_.size(); }
+
+  // frame rate from the header (e.g., 30000/1001); 0 if absent
+  double frame_rate() const { return frame_rate_; }
+
+  // frame 'index' (< num_frames()); throws if out of range
+  Frame frame(const size_t index) const;
+
+  // make 'index' the next frame read_frame() returns
+  void seek(const size_t index);
+
+  // copy the next frame into raw_img (I420 or NV12); false at the end of
+  // the file unless looping
   bool read_frame(RawImage & raw_img) override;
 
   // accessors
   FileDescriptor & fd() { return fd_; }
   uint16_t display_width() const override { return display_width_; }
   uint16_t display_height() const override { return display_height_; }
+  size_t next_frame() const { return next_frame_; }
 
 private:
   FileDescriptor fd_;
@@ -33,6 +62,17 @@ private:
 
   // loop over the file infinitely
   bool loop_;
+
+  double frame_rate_ {0};
+
+  // the whole file, and where each frame's Y plane starts in it
+  MMap mapping_;
+  std::vector<size_t> frame_offsets_ {};
+
+  size_t next_frame_ {0};
+
+  // parse the stream header; returns the offset of the first frame
+  size_t parse_header();
 };
 
 #endif /* YUV4MPEG_HH */
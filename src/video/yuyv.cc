@@ -0,0 +1,332 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define YUYV_HAVE_NEON 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define YUYV_HAVE_X86 1
+#endif
+
+#include "yuyv.hh"
+#include "pixel_format.hh"
+
+using namespace std;
+
+namespace {
+
+// converts two source rows into two luma rows and one row of each chroma
+// plane; for an odd last row, both row arguments point to the same row
+using RowPairKernel = void (*)(const uint8_t * src0, const uint8_t * src1,
+                               uint8_t * y0, uint8_t * y1,
+                               uint8_t * u, uint8_t * v,
+                               const unsigned width);
+
+// also finishes the columns left over by the vectorized kernels
+void convert_scalar_from(const uint8_t * src0, const uint8_t * src1,
+                         uint8_t * y0, uint8_t * y1,
+                         uint8_t * u, uint8_t * v,
+                         const unsigned x_begin, const unsigned width)
+{
+  for (unsigned x = x_begin; x < width; x += 2) {
+    const uint8_t * p0 = src0 + 2 * x;
+    const uint8_t * p1 = src1 + 2 * x;
+
+    y0[x] = p0[0];
+    y0[x + 1] = p0[2];
+    y1[x] = p1[0];
+    y1[x + 1] = p1[2];
+
+    // rounds the same way as the SIMD averaging instructions
+    u[x / 2] = static_cast<uint8_t>((p0[1] + p1[1] + 1) >> 1);
+    v[x / 2] = static_cast<uint8_t>((p0[3] + p1[3] + 1) >> 1);
+  }
+}
+
+void convert_scalar(const uint8_t * src0, const uint8_t * src1,
+                    uint8_t * y0, uint8_t * y1, uint8_t * u, uint8_t * v,
+                    const unsigned width)
+{
+  convert_scalar_from(src0, src1, y0, y1, u, v, 0, width);
+}
+
+#ifdef YUYV_HAVE_NEON
+// 32 pixels per iteration: vld4 splits YUYV into Y0, U, Y1, V lanes for free
+void convert_neon(const uint8_t * src0, const uint8_t * src1,
+                  uint8_t * y0, uint8_t * y1, uint8_t * u, uint8_t * v,
+                  const unsigned width)
+{
+  unsigned x = 0;
+
+  for (; x + 32 <= width; x += 32) {
+    const uint8x16x4_t p0 = vld4q_u8(src0 + 2 * x);
+    const uint8x16x4_t p1 = vld4q_u8(src1 + 2 * x);
+
+    const uint8x16x2_t luma0 = {{ p0.val[0], p0.val[2] }};
+    const uint8x16x2_t luma1 = {{ p1.val[0], p1.val[2] }};
+    vst2q_u8(y0 + x, luma0);
+    vst2q_u8(y1 + x, luma1);
+
+    vst1q_u8(u + x / 2, vrhaddq_u8(p0.val[1], p1.val[1]));
+    vst1q_u8(v + x / 2, vrhaddq_u8(p0.val[3], p1.val[3]));
+  }
+
+  convert_scalar_from(src0, src1, y0, y1, u, v, x, width);
+}
+#endif
+
+#ifdef YUYV_HAVE_X86
+// 32 pixels per iteration: even bytes are luma, odd bytes alternate U and V
+__attribute__((target("sse2")))
+void convert_sse2(const uint8_t * src0, const uint8_t * src1,
+                  uint8_t * y0, uint8_t * y1, uint8_t * u, uint8_t * v,
+                  const unsigned width)
+{
+  const __m128i lo_mask = _mm_set1_epi16(0x00FF);
+  unsigned x = 0;
+
+  for (; x + 32 <= width; x += 32) {
+    __m128i uv[2][2];
+
+    for (unsigned r = 0; r < 2; r++) {
+      const uint8_t * s = (r == 0 ? src0 : src1) + 2 * x;
+      uint8_t * dst_y = (r == 0 ? y0 : y1) + x;
+
+      const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+      const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 16));
+      const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 32));
+      const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 48));
+
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst_y),
+        _mm_packus_epi16(_mm_and_si128(a, lo_mask), _mm_and_si128(b, lo_mask)));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst_y + 16),
+        _mm_packus_epi16(_mm_and_si128(c, lo_mask), _mm_and_si128(d, lo_mask)));
+
+      uv[r][0] = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+      uv[r][1] = _mm_packus_epi16(_mm_srli_epi16(c, 8), _mm_srli_epi16(d, 8));
+    }
+
+    const __m128i uv0 = _mm_avg_epu8(uv[0][0], uv[1][0]);
+    const __m128i uv1 = _mm_avg_epu8(uv[0][1], uv[1][1]);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(u + x / 2),
+      _mm_packus_epi16(_mm_and_si128(uv0, lo_mask), _mm_and_si128(uv1, lo_mask)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(v + x / 2),
+      _mm_packus_epi16(_mm_srli_epi16(uv0, 8), _mm_srli_epi16(uv1, 8)));
+  }
+
+  convert_scalar_from(src0, src1, y0, y1, u, v, x, width);
+}
+
+// same as SSE2 with 64 pixels per iteration; packus works within 128-bit
+// lanes, so every packed result is put back in order with permute4x64
+__attribute__((target("avx2")))
+void convert_avx2(const uint8_t * src0, const uint8_t * src1,
+                  uint8_t * y0, uint8_t * y1, uint8_t * u, uint8_t * v,
+                  const unsigned width)
+{
+  constexpr int IN_ORDER = _MM_SHUFFLE(3, 1, 2, 0);
+  const __m256i lo_mask = _mm256_set1_epi16(0x00FF);
+  unsigned x = 0;
+
+  for (; x + 64 <= width; x += 64) {
+    __m256i uv[2][2];
+
+    for (unsigned r = 0; r < 2; r++) {
+      const uint8_t * s = (r == 0 ? src0 : src1) + 2 * x;
+      uint8_t * dst_y = (r == 0 ? y0 : y1) + x;
+
+      const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s));
+      const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + 32));
+      const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + 64));
+      const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + 96));
+
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst_y),
+        _mm256_permute4x64_epi64(_mm256_packus_epi16(
+          _mm256_and_si256(a, lo_mask), _mm256_and_si256(b, lo_mask)), IN_ORDER));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst_y + 32),
+        _mm256_permute4x64_epi64(_mm256_packus_epi16(
+          _mm256_and_si256(c, lo_mask), _mm256_and_si256(d, lo_mask)), IN_ORDER));
+
+      uv[r][0] = _mm256_permute4x64_epi64(_mm256_packus_epi16(
+        _mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8)), IN_ORDER);
+      uv[r][1] = _mm256_permute4x64_epi64(_mm256_packus_epi16(
+        _mm256_srli_epi16(c, 8), _mm256_srli_epi16(d, 8)), IN_ORDER);
+    }
+
+    const __m256i uv0 = _mm256_avg_epu8(uv[0][0], uv[1][0]);
+    const __m256i uv1 = _mm256_avg_epu8(uv[0][1], uv[1][1]);
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(u + x / 2),
+      _mm256_permute4x64_epi64(_mm256_packus_epi16(
+        _mm256_and_si256(uv0, lo_mask), _mm256_and_si256(uv1, lo_mask)), IN_ORDER));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(v + x / 2),
+      _mm256_permute4x64_epi64(_mm256_packus_epi16(
+        _mm256_srli_epi16(uv0, 8), _mm256_srli_epi16(uv1, 8)), IN_ORDER));
+  }
+
+  // the tail runs legacy SSE code, which stalls on dirty upper halves of the
+  // AVX registers (and the compiler leaves them dirty for a tail call)
+  _mm256_zeroupper();
+  convert_sse2(src0 + 2 * x, src1 + 2 * x, y0 + x, y1 + x,
+               u + x / 2, v + x / 2, width - x);
+}
+#endif
+
+struct Kernel
+{
+  const char * name;
+  RowPairKernel convert;
+};
+
+Kernel select_kernel()
+{
+#if defined(YUYV_HAVE_NEON)
+  return {"neon", convert_neon};
+#elif defined(YUYV_HAVE_X86)
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2")) {
+    return {"avx2", convert_avx2};
+  }
+
+  if (__builtin_cpu_supports("sse2")) {
+    return {"sse2", convert_sse2};
+  }
+
+  return {"scalar", convert_scalar};
+#else
+  return {"scalar", convert_scalar};
+#endif
+}
+
+// resolved once on first use
+const Kernel & kernel()
+{
+  static const Kernel selected = select_kernel();
+  return selected;
+}
+
+// every kernel this CPU can run, scalar first
+vector<Kernel> supported_kernels()
+{
+  vector<Kernel> kernels { {"scalar", convert_scalar} };
+
+#if defined(YUYV_HAVE_NEON)
+  kernels.push_back({"neon", convert_neon});
+#elif defined(YUYV_HAVE_X86)
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("sse2")) {
+    kernels.push_back({"sse2", convert_sse2});
+  }
+
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back({"avx2", convert_avx2});
+  }
+#endif
+
+  return kernels;
+}
+
+void convert_rows(const RowPairKernel convert,
+                  const uint8_t * src, const size_t src_stride,
+                  RawImage & dst,
+                  const unsigned row_begin, const unsigned row_end)
+{
+  const unsigned width = dst.display_width();
+  const unsigned height = dst.display_height();
+  const unsigned end = row_end == 0 ? height : min(row_end, height);
+
+  if (dst.format() != VPX_IMG_FMT_I420) {
+    throw runtime_error("yuyv_to_i420: destination must be I420");
+  }
+
+  if (width % 2 != 0) {
+    throw runtime_error("yuyv_to_i420: YUYV width must be even");
+  }
+
+  // a band may only end mid-pair at the bottom of the image
+  if (row_begin % 2 != 0 or (end % 2 != 0 and end != height)) {
+    throw runtime_error("yuyv_to_i420: bands must be aligned to row pairs");
+  }
+
+  for (unsigned row = row_begin; row < end; row += 2) {
+    const bool has_pair = row + 1 < height;
+
+    const uint8_t * src0 = src + row * src_stride;
+    const uint8_t * src1 = has_pair ? src0 + src_stride : src0;
+
+    uint8_t * y0 = dst.y_plane() + row * dst.y_stride();
+    uint8_t * y1 = has_pair ? y0 + dst.y_stride() : y0;
+
+    convert(src0, src1, y0, y1,
+            dst.u_plane() + row / 2 * dst.u_stride(),
+            dst.v_plane() + row / 2 * dst.v_stride(),
+            width);
+  }
+}
+
+} // namespace
+
+void yuyv_to_i420(const uint8_t * src, const size_t src_stride,
+                  RawImage & dst,
+                  const unsigned row_begin, const unsigned row_end)
+{
+  convert_rows(kernel().convert, src, src_stride, dst, row_begin, row_end);
+}
+
+void yuyv_to_i420_with(const string_view kernel_name,
+                       const uint8_t * src, const size_t src_stride,
+                       RawImage & dst,
+                       const unsigned row_begin, const unsigned row_end)
+{
+  for (const auto & k : supported_kernels()) {
+    if (k.name == kernel_name) {
+      convert_rows(k.convert, src, src_stride, dst, row_begin, row_end);
+      return;
+    }
+  }
+
+  throw runtime_error("yuyv_to_i420: unsupported kernel "
+                      + string(kernel_name));
+}
+
+void yuyv_to_rgb565_scaled(const uint8_t * src, const size_t src_stride,
+                           const unsigned src_width, const unsigned src_height,
+                           uint8_t * dst, const size_t dst_stride,
+                           const unsigned dst_width, const unsigned dst_height)
+{
+  for (unsigned dy = 0; dy < dst_height; dy++) {
+    const uint8_t * src_row = src + size_t(dy) * src_height / dst_height
+                                    * src_stride;
+    uint8_t * dst_row = dst + dy * dst_stride;
+
+    for (unsigned dx = 0; dx < dst_width; dx++) {
+      const unsigned sx = size_t(dx) * src_width / dst_width;
+
+      // a YUYV macropixel holds the chroma shared by an even/odd pixel pair
+      const uint8_t * pair = src_row + 2 * (sx & ~1u);
+      const uint16_t rgb565 = yuv_to_rgb565(pair[(sx & 1) * 2], pair[1], pair[3]);
+      memcpy(dst_row + 2 * dx, &rgb565, sizeof(rgb565));
+    }
+  }
+}
+
+const char * yuyv_kernel_name()
+{
+  return kernel().name;
+}
+
+vector<string> yuyv_kernel_names()
+{
+  vector<string> names;
+  for (const auto & k : supported_kernels()) {
+    names.emplace_back(k.name);
+  }
+  return names;
+}
@@ -0,0 +1,39 @@
+#ifndef YUYV_HH
+#define YUYV_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "image.hh"
+
+// convert rows [row_begin, row_end) of a packed YUYV 4:2:2 image into the
+// I420 image 'dst': luma is deinterleaved and each pair of chroma rows is
+// averaged into one; row_begin must be even, and row_end = 0 means all rows
+void yuyv_to_i420(const uint8_t * src, const size_t src_stride,
+                  RawImage & dst,
+                  const unsigned row_begin = 0, const unsigned row_end = 0);
+
+// nearest-neighbour downscale of a packed YUYV image fused with BT.601
+// conversion to RGB565; only the source pixels that land in 'dst' are read
+void yuyv_to_rgb565_scaled(const uint8_t * src, const size_t src_stride,
+                           const unsigned src_width, const unsigned src_height,
+                           uint8_t * dst, const size_t dst_stride,
+                           const unsigned dst_width, const unsigned dst_height);
+
+// name of the conversion kernel selected for this CPU (e.g., "avx2")
+const char * yuyv_kernel_name();
+
+// names of every conversion kernel this CPU can run, "scalar" first
+std::vector<std::string> yuyv_kernel_names();
+
+// yuyv_to_i420 with the named kernel instead of the selected one, to check
+// and time the kernels against each other
+void yuyv_to_i420_with(const std::string_view kernel_name,
+                       const uint8_t * src, const size_t src_stride,
+                       RawImage & dst,
+                       const unsigned row_begin = 0, const unsigned row_end = 0);
+
+#endif /* YUYV_HH */